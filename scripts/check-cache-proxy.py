@@ -0,0 +1,135 @@
+#!/usr/bin/env python3
+
+# End to end check of the caching proxy (hidden video setting proxy.enabled).
+#
+#   scripts/check-cache-proxy.py [--proxy-port PORT] <media file>
+#
+# Serves the file from a local HTTP server with Range support, and asks for it to be loaded in
+# the player. Then it reads ranges of the file through the proxy and compares them with the file.
+# Every range is read twice. The second time, the data must come from the proxy's disk cache,
+# without requests to the server.
+
+import argparse, hashlib, http.server, os, random, sys, threading
+import urllib.error, urllib.parse, urllib.request
+
+SEGMENT_SIZE = 2 * 1024 * 1024 # SegmentCache::SegmentSize
+TOKEN_LENGTH = 24              # PROXY_TOKEN_LENGTH
+
+class RangeHandler(http.server.BaseHTTPRequestHandler):
+  data = b""
+  requests = 0
+  lock = threading.Lock()
+
+  def do_GET(self):
+    with RangeHandler.lock:
+      RangeHandler.requests += 1
+
+    data = RangeHandler.data
+    start, end = 0, len(data) - 1
+    status = 200
+
+    spec = self.headers.get("Range")
+    if spec and spec.startswith("bytes=") and "," not in spec:
+      first, _, last = spec[6:].partition("-")
+      if first:
+        start = int(first)
+        if last:
+          end = min(int(last), end)
+      else:
+        start = max(0, len(data) - int(last))
+      if start > end:
+        self.send_response(416)
+        self.send_header("Content-Range", "bytes */%d" % len(data))
+        self.end_headers()
+        return
+      status = 206
+
+    self.send_response(status)
+    self.send_header("Content-Type", "application/octet-stream")
+    self.send_header("Accept-Ranges", "bytes")
+    self.send_header("Content-Length", str(end - start + 1))
+    if status == 206:
+      self.send_header("Content-Range", "bytes %d-%d/%d" % (start, end, len(data)))
+    self.end_headers()
+    try:
+      self.wfile.write(data[start:end + 1])
+    except (BrokenPipeError, ConnectionResetError):
+      pass
+
+  def log_message(self, format, *args):
+    pass
+
+def fetch(url, first, last):
+  spec = "bytes=%d-%s" % (first, "" if last is None else last)
+  request = urllib.request.Request(url, headers={"Range": spec})
+  with urllib.request.urlopen(request, timeout=30) as response:
+    return response.status, response.read()
+
+if __name__ == "__main__":
+  parser = argparse.ArgumentParser(description="Check the caching proxy against a local file server.")
+  parser.add_argument("file", help="a media file the player can play")
+  parser.add_argument("--proxy-port", type=int, help="the port getProxyStats() reports")
+  args = parser.parse_args()
+
+  with open(args.file, "rb") as f:
+    RangeHandler.data = f.read()
+  data = RangeHandler.data
+  size = len(data)
+  if size <= 2 * SEGMENT_SIZE:
+    sys.exit("The file must be larger than two proxy segments (%d bytes)." % (2 * SEGMENT_SIZE))
+
+  server = http.server.ThreadingHTTPServer(("127.0.0.1", 0), RangeHandler)
+  threading.Thread(target=server.serve_forever, daemon=True).start()
+
+  name = urllib.parse.quote(os.path.basename(args.file))
+  url = "http://127.0.0.1:%d/%s" % (server.server_port, name)
+  print("Serving %s as %s" % (args.file, url))
+  print("With proxy.enabled set, load it in the player (it stays paused), e.g. from the devtools console:")
+  print('  window.channel.objects.player.load("%s", {}, {type: "video", media: {}}, "", "")' % url)
+  print("and let it finish buffering.")
+  port = args.proxy_port or int(input("Proxy port (getProxyStats().port): "))
+
+  # The route of a loaded URL; see CacheProxy::rewrite().
+  token = hashlib.sha1(url.encode("utf-8")).hexdigest()[:TOKEN_LENGTH]
+  proxied = "http://127.0.0.1:%d/%s/%s" % (port, token, name)
+
+  ranges = [(0, 99), (SEGMENT_SIZE - 100, SEGMENT_SIZE + 99), (SEGMENT_SIZE, 2 * SEGMENT_SIZE - 1),
+            (size - 1000, None), (0, None)]
+  rand = random.Random(size)
+  for _ in range(5):
+    first = rand.randrange(size)
+    ranges.append((first, min(size - 1, first + rand.randrange(3 * SEGMENT_SIZE))))
+
+  failed = 0
+  for round in ("uncached", "cached"):
+    before = RangeHandler.requests
+    for first, last in ranges:
+      end = size - 1 if last is None else last
+      try:
+        status, body = fetch(proxied, first, last)
+      except (urllib.error.URLError, OSError) as e:
+        print("FAIL %s bytes=%d-%d: %s" % (round, first, end, e))
+        failed += 1
+        continue
+      if status != 206 or body != data[first:end + 1]:
+        print("FAIL %s bytes=%d-%d: status %d, %d bytes, %s" %
+              (round, first, end, status, len(body), "same data" if body == data[first:end + 1] else "wrong data"))
+        failed += 1
+    requests = RangeHandler.requests - before
+    print("%s: %d ranges read, %d requests to the server" % (round, len(ranges), requests))
+    if round == "cached" and requests:
+      print("FAIL cached: the proxy went to the server (or the player was still buffering)")
+      failed += 1
+
+  try:
+    fetch("http://127.0.0.1:%d/%s/%s" % (port, "0" * TOKEN_LENGTH, name), 0, 99)
+    print("FAIL an unknown route was served")
+    failed += 1
+  except urllib.error.HTTPError as e:
+    if e.code != 404:
+      print("FAIL an unknown route gave status %d instead of 404" % e.code)
+      failed += 1
+
+  server.shutdown()
+  print("FAILED (%d)" % failed if failed else "OK")
+  sys.exit(1 if failed else 0)
@@ -27,6 +27,8 @@ DisplayComponent::DisplayComponent(QObject* parent) : ComponentBase(parent), m_i
   m_lastVideoMode = -1;
   m_lastDisplay = -1;
   m_applicationWindow = nullptr;
+  m_modeSwitchPending = false;
+  m_modeSwitchRate = 0;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -63,6 +65,10 @@ bool DisplayComponent::componentInitialize()
   m_displayManager = new DisplayManagerWin(this);
 #endif
 
+  if (m_displayManager)
+    connect(m_displayManager, &DisplayManager::displayModeChanged,
+            this, &DisplayComponent::onDisplayModeChanged);
+
   if (initializeDisplayManager())
   {
     QGuiApplication* app = (QGuiApplication*)QGuiApplication::instance();
@@ -73,6 +79,7 @@ bool DisplayComponent::componentInitialize()
     for(QScreen *screen : app->screens())
     {
       connect(screen, SIGNAL(refreshRateChanged(qreal)), this, SLOT(monitorChange()));
+      connect(screen, SIGNAL(refreshRateChanged(qreal)), this, SLOT(onScreenRefreshRateChanged(qreal)));
       connect(screen, SIGNAL(geometryChanged(QRect)), this, SLOT(monitorChange()));
     }
 
@@ -135,9 +142,13 @@ bool DisplayComponent::switchToBestVideoMode(float frameRate)
       << m_displayManager->m_displays[currentDisplay]->m_videoModes[bestmode]->getPrettyName()
       << "on display" << currentDisplay;
 
+      m_modeSwitchPending = true;
+      m_modeSwitchRate = m_displayManager->m_displays[currentDisplay]->m_videoModes[bestmode]->m_refreshRate;
+
       if (!m_displayManager->setDisplayMode(currentDisplay, bestmode))
       {
         QLOG_INFO() << "Mode switching failed.";
+        m_modeSwitchPending = false;
         return false;
       }
       return true;
@@ -152,6 +163,38 @@ bool DisplayComponent::switchToBestVideoMode(float frameRate)
   return false;
 }
 
+//////////////////////////////////////////////////////////////////////////////////////////////////
+void DisplayComponent::videoModeSwitchDone()
+{
+  if (!m_modeSwitchPending)
+    return;
+
+  QLOG_INFO() << "Video mode switch completed.";
+  m_modeSwitchPending = false;
+  emit videoModeSwitched();
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+void DisplayComponent::cancelVideoModeSwitchWait()
+{
+  m_modeSwitchPending = false;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+void DisplayComponent::onDisplayModeChanged(int display)
+{
+  Q_UNUSED(display);
+  videoModeSwitchDone();
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+void DisplayComponent::onScreenRefreshRateChanged(qreal rate)
+{
+  // Qt only knows about the refresh rate, which is all switchToBestVideoMode() changes.
+  if (m_modeSwitchPending && fabs(rate - m_modeSwitchRate) < 0.5)
+    videoModeSwitchDone();
+}
+
 //////////////////////////////////////////////////////////////////////////////////////////////////
 bool DisplayComponent::switchToBestOverallVideoMode(int display)
 {
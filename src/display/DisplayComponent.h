@@ -43,6 +43,10 @@ public:
 
   double currentRefreshRate();
 
+  // Stop waiting for the mode switch done by switchToBestVideoMode() to be confirmed, so that a
+  // later, unrelated mode change doesn't emit videoModeSwitched().
+  void cancelVideoModeSwitchWait();
+
   QString debugInformation();
 
 private:
@@ -55,6 +59,14 @@ private:
   int m_lastDisplay;
   QTimer m_initTimer;
   QWindow* m_applicationWindow;
+  bool m_modeSwitchPending;
+  float m_modeSwitchRate;
+
+  void videoModeSwitchDone();
+
+private Q_SLOTS:
+  void onDisplayModeChanged(int display);
+  void onScreenRefreshRateChanged(qreal rate);
 
 public Q_SLOTS:
   void  monitorChange();
@@ -64,6 +76,10 @@ public Q_SLOTS:
 Q_SIGNALS:
   void refreshRateChanged();
 
+  // Emitted when the mode switch started by switchToBestVideoMode() has taken effect, as reported
+  // by the display manager or by Qt. Not emitted if neither notices the switch.
+  void videoModeSwitched();
+
 };
 
 #endif // DISPLAYCOMPONENT_H
@@ -125,6 +125,11 @@ public:
   bool isValidDisplayMode(int display, int mode);
   int getDisplayFromPoint(const QPoint& pt);
 
+Q_SIGNALS:
+  // Emitted once a mode set with setDisplayMode() has actually taken effect. Only platforms that
+  // get notified about mode changes emit this.
+  void displayModeChanged(int display);
+
 private:
   bool isRateMultipleOf(float refresh, float multiple, bool exact = true);
 };
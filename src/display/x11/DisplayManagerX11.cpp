@@ -1,5 +1,10 @@
 #include "DisplayManagerX11.h"
 
+#include <QSocketNotifier>
+#include <QTimer>
+
+#include "QsLog.h"
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 bool DisplayManagerX11::initialize()
 {
@@ -14,6 +19,16 @@ bool DisplayManagerX11::initialize()
   if (!XRRQueryExtension(xdisplay, &event_base, &error_base))
     return false;
 
+  if (!notifier)
+  {
+    eventBase = event_base;
+    XRRSelectInput(xdisplay, RootWindow(xdisplay, DefaultScreen(xdisplay)),
+                   RRScreenChangeNotifyMask | RRCrtcChangeNotifyMask);
+    XFlush(xdisplay);
+    notifier = new QSocketNotifier(ConnectionNumber(xdisplay), QSocketNotifier::Read, this);
+    connect(notifier, &QSocketNotifier::activated, this, &DisplayManagerX11::handleXEvents);
+  }
+
   if (resources)
     XRRFreeScreenResources(resources);
 
@@ -90,7 +105,11 @@ bool DisplayManagerX11::setDisplayMode(int display, int mode)
   RROutput output = resources->outputs[displayptr->m_privId];
   RRMode xrmode = resources->modes[videomode->m_privId].id;
 
+  // Whatever was pending is superseded.
+  pendingDisplay = pendingMode = -1;
+
   bool success = false;
+  int status;
   XRRCrtcInfo *crtc = NULL;
   XRROutputInfo *out = XRRGetOutputInfo(xdisplay, resources, output);
   if (!out || !out->crtc)
@@ -100,13 +119,23 @@ bool DisplayManagerX11::setDisplayMode(int display, int mode)
     goto done;
 
   // Keep all information, except the mode.
-  success = XRRSetCrtcConfig(xdisplay, resources, out->crtc, crtc->timestamp,
-                             crtc->x, crtc->y, xrmode, crtc->rotation,
-                             crtc->outputs, crtc->noutput);
-
-  // The return value isn't always accurate, apparently.
+  status = XRRSetCrtcConfig(xdisplay, resources, out->crtc, crtc->timestamp,
+                            crtc->x, crtc->y, xrmode, crtc->rotation,
+                            crtc->outputs, crtc->noutput);
+  if (status != RRSetConfigSuccess)
+  {
+    QLOG_ERROR() << "XRRSetCrtcConfig failed with status" << status;
+    goto done;
+  }
   success = true;
 
+  // Completion is reported by handleXEvents(). The call waits for the server's reply, and the
+  // notify events sent before it are already read into Xlib's queue by then, so the socket
+  // notifier won't see them. They're handled once the caller is waiting for them.
+  pendingDisplay = display;
+  pendingMode = mode;
+  QTimer::singleShot(0, this, &DisplayManagerX11::handleXEvents);
+
 done:
   if (crtc)
     XRRFreeCrtcInfo(crtc);
@@ -116,6 +145,31 @@ done:
   return success;
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void DisplayManagerX11::handleXEvents()
+{
+  bool changed = false;
+  while (XPending(xdisplay))
+  {
+    XEvent event;
+    XNextEvent(xdisplay, &event);
+    XRRUpdateConfiguration(&event);
+    if (event.type == eventBase + RRScreenChangeNotify || event.type == eventBase + RRNotify)
+      changed = true;
+  }
+
+  if (!changed || pendingDisplay < 0)
+    return;
+
+  if (getCurrentDisplayMode(pendingDisplay) == pendingMode)
+  {
+    int display = pendingDisplay;
+    pendingDisplay = pendingMode = -1;
+    QLOG_DEBUG() << "XRandR reports mode switch done on display" << display;
+    emit displayModeChanged(display);
+  }
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 int DisplayManagerX11::getCurrentDisplayMode(int display)
 {
@@ -19,6 +19,8 @@
 
 #include "display/DisplayManager.h"
 
+class QSocketNotifier;
+
 class DisplayManagerX11 : public DisplayManager
 {
   Q_OBJECT
@@ -26,8 +28,19 @@ private:
   Display* xdisplay;
   XRRScreenResources* resources;
 
+  // XRandR change notifications, used to detect when a mode switch is done.
+  QSocketNotifier* notifier;
+  int eventBase;
+  int pendingDisplay;
+  int pendingMode;
+
+private Q_SLOTS:
+  void handleXEvents();
+
 public:
-  DisplayManagerX11(QObject* parent) : DisplayManager(parent), xdisplay(0), resources(0) {};
+  DisplayManagerX11(QObject* parent)
+    : DisplayManager(parent), xdisplay(0), resources(0), notifier(0), eventBase(0),
+      pendingDisplay(-1), pendingMode(-1) {};
   virtual ~DisplayManagerX11();
 
   virtual bool initialize();
@@ -16,6 +16,9 @@
 #include <QOperatingSystemVersion>
 #include <QCryptographicHash>
 #include <QTemporaryDir>
+#include <QTimer>
+#include <QTextStream>
+#include <QHash>
 
 #ifdef HAVE_MINIZIP
 #include <minizip/unzip.h>
@@ -87,11 +90,19 @@ static QSize g_mediaFoundationH264MaxResolution;
 
 static QString g_codecVersion;
 static QList<CodecDriver> g_cachedCodecList;
+static bool g_cachedCodecListValid;
+// Positions in g_cachedCodecList by (type, format).
+static QHash<QPair<int, QString>, QVector<int>> g_cachedCodecIndex;
+// determineRequiredCodecs() results by stream signature. Depends on the codec list, so it's
+// reset together with it.
+static QHash<QString, QList<CodecDriver>> g_requiredCodecsCache;
 
 static QString g_deviceID;
 
 static QString g_eaeWatchFolder;
 static QProcess* g_eaeProcess;
+// Partial file -> the FileDownloader writing to it.
+static QHash<QString, FileDownloader*> g_activeDownloads;
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 static QString getBuildType()
@@ -188,6 +199,8 @@ static int indexOfCodecInList(const QList<CodecDriver>& list, const CodecDriver&
 void Codecs::updateCachedCodecList()
 {
   g_cachedCodecList.clear();
+  g_cachedCodecIndex.clear();
+  g_requiredCodecsCache.clear();
 
   for (CodecType type : {CodecType::Decoder, CodecType::Encoder})
   {
@@ -221,14 +234,40 @@ void Codecs::updateCachedCodecList()
     else
       g_cachedCodecList.append(installedCodec);
   }
+
+  for (int n = 0; n < g_cachedCodecList.size(); n++)
+  {
+    const CodecDriver& codec = g_cachedCodecList[n];
+    g_cachedCodecIndex[qMakePair((int)codec.type, codec.format)].append(n);
+  }
+
+  g_cachedCodecListValid = true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void Codecs::invalidateCachedCodecList()
+{
+  g_cachedCodecListValid = false;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 const QList<CodecDriver>& Codecs::getCachedCodecList()
 {
+  if (!g_cachedCodecListValid)
+    updateCachedCodecList();
   return g_cachedCodecList;
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+QList<CodecDriver> Codecs::findCachedCodecsByFormat(CodecType type, const QString& format)
+{
+  const QList<CodecDriver>& list = getCachedCodecList();
+  QList<CodecDriver> result;
+  for (int n : g_cachedCodecIndex.value(qMakePair((int)type, format)))
+    result.append(list[n]);
+  return result;
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 QList<CodecDriver> Codecs::findCodecsByFormat(const QList<CodecDriver>& list, CodecType type, const QString& format)
 {
@@ -659,41 +698,94 @@ static Downloader::HeaderList getPlexHeaders()
   return headers;
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
 static QUrl buildCodecQuery(QString version, QString name, QString build)
 {
-  return QUrl("");
+  // There is no default codec server. Pointing this at a local server serving the codec info
+  // XML and the files also allows testing the download code.
+  QString base = SettingsComponent::Get().value(SETTINGS_SECTION_MAIN, "codecsBaseUrl").toString();
+  if (base.isEmpty())
+    return QUrl("");
+
+  QUrl url(base + "/" + name);
+  QUrlQuery query;
+  query.addQueryItem("version", version);
+  query.addQueryItem("build", build);
+  query.addQueryItem("deviceId", g_deviceID);
+  url.setQuery(query);
+  return url;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Identifies a download; context is either "eae" or a CodecDriver.
+static QString jobName(const QVariant& context)
+{
+  if (context == QVariant("eae"))
+    return "eae";
+  return context.value<CodecDriver>().getMangledName();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static QString jobDestination(const QVariant& context)
+{
+  if (context == QVariant("eae"))
+    return eaePrefixPath() + ".zip";
+  return context.value<CodecDriver>().getPath();
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 void CodecsFetcher::startNext()
 {
-  if (m_fetchEAE)
+  while (m_running < MaxParallelDownloads)
   {
-    m_fetchEAE = false;
+    QVariant context;
+    QUrl url;
 
-    QUrl url = buildCodecQuery(STRINGIFY(EAE_VERSION), "easyaudioencoder", getEAEBuildType());
+    if (m_fetchEAE)
+    {
+      m_fetchEAE = false;
+      context = QVariant("eae");
+      url = buildCodecQuery(STRINGIFY(EAE_VERSION), "easyaudioencoder", getEAEBuildType());
+    }
+    else if (!m_Codecs.isEmpty())
+    {
+      CodecDriver codec = m_Codecs.dequeue();
+      context = QVariant::fromValue(codec);
+      url = buildCodecQuery(g_codecVersion, codec.getMangledName(), getBuildType());
+    }
+    else
+    {
+      break;
+    }
 
-    Downloader *downloader = new Downloader(QVariant("eae"), url, getPlexHeaders(), this);
+    m_running++;
+    Downloader *downloader = new Downloader(&m_network, context, url, getPlexHeaders(), this);
     connect(downloader, &Downloader::done, this, &CodecsFetcher::codecInfoDownloadDone);
-    return;
   }
 
-  if (m_Codecs.isEmpty())
+  if (m_running == 0)
   {
     // Do final initializations.
     if (m_eaeNeeded && startCodecs)
       startEAE();
 
     emit done(this);
-    return;
   }
+}
 
-  CodecDriver codec = m_Codecs.dequeue();
-
-  QUrl url = buildCodecQuery(g_codecVersion, codec.getMangledName(), getBuildType());
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void CodecsFetcher::startDownload(const QVariant& context, const QUrl& url)
+{
+  FileDownloader *downloader = new FileDownloader(&m_network, context, url, getPlexHeaders(),
+                                                  jobDestination(context), this);
+  connect(downloader, &FileDownloader::done, this, &CodecsFetcher::codecDownloadDone);
+}
 
-  Downloader *downloader = new Downloader(QVariant::fromValue(codec), url, getPlexHeaders(), this);
-  connect(downloader, &Downloader::done, this, &CodecsFetcher::codecInfoDownloadDone);
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void CodecsFetcher::downloadFinished()
+{
+  m_running--;
+  startNext();
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -730,15 +822,15 @@ bool CodecsFetcher::processCodecInfoReply(const QVariant& context, const QByteAr
   }
 
   QString hash = attrs.namedItem("fileSha").toAttr().value();
-  m_currentHash = QByteArray::fromHex(hash.toUtf8());
+  QByteArray expectedHash = QByteArray::fromHex(hash.toUtf8());
   // it's hardcoded to SHA-1
-  if (!m_currentHash.size()) {
+  if (!expectedHash.size()) {
     QLOG_ERROR() << "Hash value in unexpected format or missing:" << hash;
     return false;
   }
+  m_hashes[jobName(context)] = expectedHash;
 
-  Downloader *downloader = new Downloader(context, url, getPlexHeaders(), this);
-  connect(downloader, &Downloader::done, this, &CodecsFetcher::codecDownloadDone);
+  startDownload(context, url);
 
   return true;
 }
@@ -749,7 +841,7 @@ void CodecsFetcher::codecInfoDownloadDone(QVariant userData, bool success, const
   if (!success || !processCodecInfoReply(userData, data))
   {
     QLOG_ERROR() << "Codec download failed.";
-    startNext();
+    downloadFinished();
   }
 }
 
@@ -952,23 +1044,55 @@ static bool extractZip(QString zip, QString dest)
 #endif
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-void CodecsFetcher::processCodecDownloadDone(const QVariant& context, const QByteArray& data)
+// Move a finished download over dest. The old file is only removed once the new one is in place,
+// so a failed rename doesn't lose an installed codec.
+static bool replaceFile(const QString& source, const QString& dest)
 {
-  QByteArray hash = QCryptographicHash::hash(data, QCryptographicHash::Sha1);
+  QString old = dest + ".old";
+  QFile::remove(old);
+  bool hadOld = QFile::exists(dest) && QFile::rename(dest, old);
 
-  if (hash != m_currentHash)
+  if (!QFile::rename(source, dest))
   {
-    QLOG_ERROR() << "Checksum mismatch: got" << hash.toHex() << "expected" << m_currentHash.toHex();
+    if (hadOld)
+      QFile::rename(old, dest);
+    return false;
+  }
+
+  if (hadOld)
+    QFile::remove(old);
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void CodecsFetcher::processCodecDownloadDone(const QVariant& context, const QString& partialFile,
+                                             const QByteArray& sha1)
+{
+  QByteArray expectedHash = m_hashes.take(jobName(context));
+
+  if (sha1 != expectedHash)
+  {
+    QLOG_ERROR() << "Checksum mismatch: got" << sha1.toHex() << "expected" << expectedHash.toHex();
+    // Don't try to resume from bad data next time.
+    if (!partialFile.isEmpty())
+      QFile::remove(partialFile);
     return;
   }
 
-  if (context == QVariant("eae"))
+  QString dest = jobDestination(context);
+
+  // Another fetcher's download of the same file got it installed.
+  if (partialFile.isEmpty())
   {
-    QString dest = eaePrefixPath() + ".zip";
+    QLOG_INFO() << "Codec was installed as" << dest << "by another download.";
+    return;
+  }
 
+  if (context == QVariant("eae"))
+  {
     QLOG_INFO() << "Storing EAE as" << dest;
 
-    if (!Utils::safelyWriteFile(dest, data))
+    if (!replaceFile(partialFile, dest))
     {
       QLOG_ERROR() << "Writing codec file failed.";
       return;
@@ -990,16 +1114,16 @@ void CodecsFetcher::processCodecDownloadDone(const QVariant& context, const QByt
   {
     CodecDriver codec = context.value<CodecDriver>();
 
-    QLOG_INFO() << "Storing codec as" << codec.getPath();
+    QLOG_INFO() << "Storing codec as" << dest;
 
-    if (!Utils::safelyWriteFile(codec.getPath(), data))
+    if (!replaceFile(partialFile, dest))
     {
       QLOG_ERROR() << "Writing codec file failed.";
       return;
     }
 
-    // This causes libmpv and eventually libavcodec to rescan and load new codecs.
-    Codecs::updateCachedCodecList();
+    // Rebuilding the list causes libmpv and eventually libavcodec to rescan and load new codecs.
+    Codecs::invalidateCachedCodecList();
     for (const CodecDriver& item : Codecs::getCachedCodecList())
     {
       if (Codecs::sameCodec(item, codec) && !item.present)
@@ -1014,18 +1138,19 @@ void CodecsFetcher::processCodecDownloadDone(const QVariant& context, const QByt
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-void CodecsFetcher::codecDownloadDone(QVariant userData, bool success, const QByteArray& data)
+void CodecsFetcher::codecDownloadDone(QVariant userData, bool success, const QString& partialFile,
+                                      const QByteArray& sha1)
 {
   QLOG_INFO() << "Codec request finished.";
   if (success)
   {
-    processCodecDownloadDone(userData, data);
+    processCodecDownloadDone(userData, partialFile, sha1);
   }
   else
   {
     QLOG_ERROR() << "Codec download HTTP request failed.";
   }
-  startNext();
+  downloadFinished();
 }
 
 
@@ -1095,61 +1220,252 @@ void CodecsFetcher::startEAE()
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-Downloader::Downloader(QVariant userData, const QUrl& url, const HeaderList& headers, QObject* parent)
-  : QObject(parent), m_userData(userData), m_lastProgress(-1)
+static void logProgress(int& lastProgress, qint64 bytesReceived, qint64 bytesTotal)
+{
+  if (bytesTotal > 0)
+  {
+    int progress = (int)(bytesReceived * 100 / bytesTotal);
+    if (lastProgress < 0 || progress > lastProgress + 10)
+    {
+      lastProgress = progress;
+      QLOG_INFO() << "HTTP request at" << progress << "% (" << bytesReceived << "/" << bytesTotal << ")";
+    }
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+Downloader::Downloader(QNetworkAccessManager* manager, QVariant userData, const QUrl& url,
+                       const HeaderList& headers, QObject* parent)
+  : QObject(parent), m_reply(nullptr), m_userData(userData), m_lastProgress(-1)
 {
   QLOG_INFO() << "HTTP request:" << url.toDisplayString();
   m_currentStartTime.start();
 
-  connect(&m_WebCtrl, &QNetworkAccessManager::finished, this, &Downloader::networkFinished);
-
   QNetworkRequest request(url);
   for (int n = 0; n < headers.size(); n++)
     request.setRawHeader(headers[n].first.toUtf8(), headers[n].second.toUtf8());
-  QNetworkReply *reply = m_WebCtrl.get(request);
-  if (reply)
+  m_reply = manager->get(request);
+  connect(m_reply, &QNetworkReply::finished, this, &Downloader::networkFinished);
+  connect(m_reply, &QNetworkReply::downloadProgress, this, &Downloader::downloadProgress);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void Downloader::downloadProgress(qint64 bytesReceived, qint64 bytesTotal)
+{
+  logProgress(m_lastProgress, bytesReceived, bytesTotal);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void Downloader::networkFinished()
+{
+  QLOG_INFO() << "HTTP finished after" << (m_currentStartTime.elapsed() + 500) / 1000
+              << "seconds for a request of" << m_reply->size() << "bytes.";
+
+  if (m_reply->error() == QNetworkReply::NoError)
+  {
+    emit done(m_userData, true, m_reply->readAll());
+  }
+  else
+  {
+    QLOG_ERROR() << "HTTP download error:" << m_reply->errorString();
+    emit done(m_userData, false, QByteArray());
+  }
+  m_reply->deleteLater();
+  deleteLater();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+FileDownloader::FileDownloader(QNetworkAccessManager* manager, QVariant userData, const QUrl& url,
+                               const Downloader::HeaderList& headers, const QString& dest,
+                               QObject* parent)
+  : QObject(parent), m_manager(manager), m_reply(nullptr), m_userData(userData), m_url(url),
+    m_headers(headers), m_file(partialPath(dest)), m_hash(QCryptographicHash::Sha1), m_offset(0),
+    m_retries(0), m_writeError(false), m_lastProgress(-1)
+{
+  m_currentStartTime.start();
+  open();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+FileDownloader::~FileDownloader()
+{
+  // Gone without finishing; let a waiting download take over.
+  if (unregister())
+    emit finished(false, QByteArray());
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void FileDownloader::open()
+{
+  // Two downloads appending to the same partial file would corrupt it.
+  FileDownloader* running = g_activeDownloads.value(m_file.fileName());
+  if (running)
   {
-    connect(reply, &QNetworkReply::downloadProgress, this, &Downloader::downloadProgress);
+    QLOG_INFO() << "Waiting for the running download of" << m_url.toDisplayString();
+    connect(running, &FileDownloader::finished, this, &FileDownloader::runningFinished);
+    return;
   }
+
+  if (!m_file.open(QIODevice::ReadWrite))
+  {
+    QLOG_ERROR() << "Could not open" << m_file.fileName() << "for writing.";
+    // Report asynchronously, like any other result.
+    QTimer::singleShot(0, this, [this] { finish(false); });
+    return;
+  }
+  g_activeDownloads.insert(m_file.fileName(), this);
+
+  // Data left over from an earlier attempt is kept, but must be part of the hash.
+  while (!m_file.atEnd())
+    m_hash.addData(m_file.read(1 << 16));
+  if (m_file.pos() > 0)
+    QLOG_INFO() << "Resuming download of" << m_url.toDisplayString() << "at" << m_file.pos() << "bytes.";
+
+  start();
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-void Downloader::downloadProgress(qint64 bytesReceived, qint64 bytesTotal)
+void FileDownloader::runningFinished(bool success, const QByteArray& sha1)
 {
-  if (bytesTotal > 0)
+  if (success)
   {
-    int progress = (int)(bytesReceived * 100 / bytesTotal);
-    if (m_lastProgress < 0 || progress > m_lastProgress + 10)
-    {
-      m_lastProgress = progress;
-      QLOG_INFO() << "HTTP request at" << progress << "% (" << bytesReceived << "/" << bytesTotal << ")";
-    }
+    QLOG_INFO() << "Download of" << m_url.toDisplayString() << "was done by the running one.";
+    emit done(m_userData, true, QString(), sha1);
+    deleteLater();
+    return;
   }
+
+  open();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool FileDownloader::unregister()
+{
+  auto it = g_activeDownloads.find(m_file.fileName());
+  if (it == g_activeDownloads.end() || it.value() != this)
+    return false;
+  g_activeDownloads.erase(it);
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void FileDownloader::start()
+{
+  QLOG_INFO() << "HTTP request:" << m_url.toDisplayString();
+
+  QNetworkRequest request(m_url);
+  for (int n = 0; n < m_headers.size(); n++)
+    request.setRawHeader(m_headers[n].first.toUtf8(), m_headers[n].second.toUtf8());
+
+  m_offset = m_file.pos();
+  if (m_offset > 0)
+    request.setRawHeader("Range", "bytes=" + QByteArray::number(m_offset) + "-");
+
+  m_reply = m_manager->get(request);
+  connect(m_reply, &QNetworkReply::metaDataChanged, this, &FileDownloader::metaDataChanged);
+  connect(m_reply, &QNetworkReply::readyRead, this, &FileDownloader::readyRead);
+  connect(m_reply, &QNetworkReply::finished, this, &FileDownloader::networkFinished);
+  connect(m_reply, &QNetworkReply::downloadProgress, this, &FileDownloader::downloadProgress);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-void Downloader::networkFinished(QNetworkReply* pReply)
+void FileDownloader::metaDataChanged()
 {
+  int status = m_reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+  if (m_offset > 0 && status == 200)
+  {
+    // The server ignored the Range header and sends the whole file.
+    QLOG_INFO() << "Server can't resume the download; starting over.";
+    m_file.resize(0);
+    m_file.seek(0);
+    m_hash.reset();
+    m_offset = 0;
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void FileDownloader::readyRead()
+{
+  if (m_writeError)
+    return;
+
+  QByteArray data = m_reply->readAll();
+
+  // Only the file itself goes into the file. Error pages (or the body of a 416 for a file that's
+  // already complete) would corrupt the part that is kept for resuming.
+  int status = m_reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+  if (status != 200 && status != 206)
+    return;
+
+  if (m_file.write(data) != data.size())
+  {
+    QLOG_ERROR() << "Writing" << m_file.fileName() << "failed.";
+    m_writeError = true;
+    m_reply->abort();
+    return;
+  }
+  m_hash.addData(data);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void FileDownloader::downloadProgress(qint64 bytesReceived, qint64 bytesTotal)
+{
+  if (bytesTotal > 0)
+    bytesTotal += m_offset;
+  logProgress(m_lastProgress, bytesReceived + m_offset, bytesTotal);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void FileDownloader::networkFinished()
+{
+  readyRead();
+
+  QNetworkReply* reply = m_reply;
+  m_reply = nullptr;
+  reply->deleteLater();
+
   QLOG_INFO() << "HTTP finished after" << (m_currentStartTime.elapsed() + 500) / 1000
-              << "seconds for a request of" << pReply->size() << "bytes.";
+              << "seconds for a file of" << m_file.pos() << "bytes.";
 
-  if (pReply->error() == QNetworkReply::NoError)
+  int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+  if (reply->error() == QNetworkReply::NoError || (m_offset > 0 && status == 416))
   {
-    emit done(m_userData, true, pReply->readAll());
+    // 416 means there's nothing left to request; the checksum tells whether the file is good.
+    finish(!m_writeError);
+    return;
   }
-  else
+
+  QLOG_ERROR() << "HTTP download error:" << reply->errorString();
+
+  // Connection level errors (as opposed to e.g. 404) are worth resuming from where we are.
+  if (!m_writeError && reply->error() < QNetworkReply::ContentAccessDenied && m_retries < MaxRetries)
   {
-    QLOG_ERROR() << "HTTP download error:" << pReply->errorString();
-    emit done(m_userData, false, QByteArray());
+    m_retries++;
+    QLOG_INFO() << "Retrying download (" << m_retries << "/" << MaxRetries << ").";
+    start();
+    return;
   }
-  pReply->deleteLater();
-  m_WebCtrl.clearAccessCache(); // make sure the TCP connection is closed
+
+  finish(false);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void FileDownloader::finish(bool success)
+{
+  // On failure the partial file is left in place, so a later attempt can resume it.
+  m_file.close();
+  bool registered = unregister();
+  QByteArray sha1 = success ? m_hash.result() : QByteArray();
+  emit done(m_userData, success, m_file.fileName(), sha1);
+  if (registered)
+    emit finished(success, sha1);
+  deleteLater();
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 static CodecDriver selectBestDecoder(const StreamInfo& stream)
 {
-  QList<CodecDriver> codecs = Codecs::findCodecsByFormat(Codecs::getCachedCodecList(), CodecType::Decoder, stream.codec);
+  QList<CodecDriver> codecs = Codecs::findCachedCodecsByFormat(CodecType::Decoder, stream.codec);
   CodecDriver best = {};
   int bestScore = -1;
   for (auto codec : codecs)
@@ -1209,9 +1525,32 @@ static CodecDriver selectBestDecoder(const StreamInfo& stream)
   return best;
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static QString streamSignature(const PlaybackInfo& info)
+{
+  QString sig;
+  QTextStream s(&sig);
+  s << info.enableAC3Transcoding << useSystemAudioDecoders() << useSystemVideoDecoders();
+  for (const StreamInfo& stream : info.streams)
+  {
+    s << "|" << stream.isVideo << stream.isAudio << "," << stream.codec << "," << stream.profile
+      << "," << stream.audioChannels << "," << stream.audioSampleRate
+      << "," << stream.videoResolution.width() << "x" << stream.videoResolution.height();
+  }
+  s.flush();
+  return sig;
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 QList<CodecDriver> Codecs::determineRequiredCodecs(const PlaybackInfo& info)
 {
+  // Both load hooks end up here, usually with the same streams.
+  getCachedCodecList();
+  QString signature = streamSignature(info);
+  auto cached = g_requiredCodecsCache.constFind(signature);
+  if (cached != g_requiredCodecsCache.constEnd())
+    return cached.value();
+
   QList<CodecDriver> result;
 
   bool needAC3Encoder = false;
@@ -1259,7 +1598,7 @@ QList<CodecDriver> Codecs::determineRequiredCodecs(const PlaybackInfo& info)
 
   if (needAC3Encoder)
   {
-    QList<CodecDriver> codecs = Codecs::findCodecsByFormat(Codecs::getCachedCodecList(), CodecType::Encoder, "ac3");
+    QList<CodecDriver> codecs = Codecs::findCachedCodecsByFormat(CodecType::Encoder, "ac3");
     CodecDriver encoder = {};
     for (auto codec : codecs)
     {
@@ -1281,6 +1620,7 @@ QList<CodecDriver> Codecs::determineRequiredCodecs(const PlaybackInfo& info)
     }
   }
 
+  g_requiredCodecsCache.insert(signature, result);
   return result;
 }
 
@@ -12,6 +12,9 @@
 #include <QVariant>
 #include <QElapsedTimer>
 #include <QSet>
+#include <QFile>
+#include <QHash>
+#include <QCryptographicHash>
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 enum class CodecType {
@@ -71,38 +74,98 @@ struct PlaybackInfo {
 
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
+// Small HTTP request whose reply is returned in memory.
 class Downloader : public QObject
 {
   Q_OBJECT
 public:
   typedef QPair<QString, QString> Header;
   typedef QList<Header> HeaderList;
-  explicit Downloader(QVariant userData, const QUrl& url, const HeaderList& headers, QObject* parent);
+  // The manager is shared between requests, so that connections to the same server are reused.
+  explicit Downloader(QNetworkAccessManager* manager, QVariant userData, const QUrl& url,
+                      const HeaderList& headers, QObject* parent);
 Q_SIGNALS:
   void done(QVariant userData, bool success, const QByteArray& data);
 
 private Q_SLOTS:
-  void networkFinished(QNetworkReply* pReply);
+  void networkFinished();
   void downloadProgress(qint64 bytesReceived, qint64 bytesTotal);
 
 private:
-  QNetworkAccessManager m_WebCtrl;
-  QByteArray m_DownloadedData;
+  QNetworkReply* m_reply;
   QVariant m_userData;
   QElapsedTimer m_currentStartTime;
   int m_lastProgress;
 };
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Downloads a file straight to disk, computing its SHA-1 on the fly. Data goes to partialPath()
+// of the destination. If that file already exists, e.g. from an interrupted download, only the
+// missing part is requested with an HTTP Range request. Interrupted transfers are resumed the
+// same way. The caller gets the partial file and its hash, and decides whether to keep it.
+//
+// Only one download at a time writes to a destination. A second one waits for the running one.
+// If that succeeds, its file went to its own caller, and the second one reports success with
+// the same hash and no partialFile. Otherwise the second one resumes what it left.
+class FileDownloader : public QObject
+{
+  Q_OBJECT
+public:
+  explicit FileDownloader(QNetworkAccessManager* manager, QVariant userData, const QUrl& url,
+                          const Downloader::HeaderList& headers, const QString& dest, QObject* parent);
+  ~FileDownloader() override;
+
+  static QString partialPath(const QString& dest) { return dest + ".part"; }
+
+Q_SIGNALS:
+  void done(QVariant userData, bool success, const QString& partialFile, const QByteArray& sha1);
+  // After done(), for the downloads waiting on this one.
+  void finished(bool success, const QByteArray& sha1);
+
+private Q_SLOTS:
+  void metaDataChanged();
+  void readyRead();
+  void networkFinished();
+  void downloadProgress(qint64 bytesReceived, qint64 bytesTotal);
+  void runningFinished(bool success, const QByteArray& sha1);
+
+private:
+  void open();
+  void start();
+  void finish(bool success);
+  // Stop being the running download of the destination.
+  bool unregister();
+
+  // Number of times an interrupted transfer is resumed before giving up.
+  static const int MaxRetries = 3;
+
+  QNetworkAccessManager* m_manager;
+  QNetworkReply* m_reply;
+  QVariant m_userData;
+  QUrl m_url;
+  Downloader::HeaderList m_headers;
+  QFile m_file;
+  QCryptographicHash m_hash;
+  qint64 m_offset; // bytes already on disk when the current request was started
+  int m_retries;
+  bool m_writeError;
+  QElapsedTimer m_currentStartTime;
+  int m_lastProgress;
+};
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 class CodecsFetcher : public QObject
 {
   Q_OBJECT
 public:
   CodecsFetcher()
-  : startCodecs(true), m_eaeNeeded(false), m_fetchEAE(false)
+  : startCodecs(true), m_eaeNeeded(false), m_fetchEAE(false), m_running(0)
   {
   }
 
+  // Number of codecs downloaded at the same time.
+  static const int MaxParallelDownloads = 3;
+
   // Download the given list of codecs (skip download for codecs already
   // installed). Then call done(userData), regardless of success.
   void installCodecs(const QList<CodecDriver>& codecs);
@@ -117,19 +180,24 @@ Q_SIGNALS:
 
 private Q_SLOTS:
   void codecInfoDownloadDone(QVariant userData, bool success, const QByteArray& data);
-  void codecDownloadDone(QVariant userData, bool success, const QByteArray& data);
+  void codecDownloadDone(QVariant userData, bool success, const QString& partialFile, const QByteArray& sha1);
 
 private:
   bool codecNeedsDownload(const CodecDriver& codec);
   bool processCodecInfoReply(const QVariant& context, const QByteArray& data);
-  void processCodecDownloadDone(const QVariant& context, const QByteArray& data);
+  void processCodecDownloadDone(const QVariant& context, const QString& partialFile, const QByteArray& sha1);
   void startNext();
+  void startDownload(const QVariant& context, const QUrl& url);
+  void downloadFinished();
   void startEAE();
 
+  QNetworkAccessManager m_network;
   QQueue<CodecDriver> m_Codecs;
-  QByteArray m_currentHash;
+  // Expected SHA-1 per download, keyed by jobName().
+  QHash<QString, QByteArray> m_hashes;
   bool m_eaeNeeded;
   bool m_fetchEAE;
+  int m_running;
 };
 
 class Codecs
@@ -148,13 +216,20 @@ public:
     return a.type == b.type && a.format == b.format && a.driver == b.driver;
   }
 
+  // Rebuild the cached codec list from the codec manifest and the codecs installed in the player.
   static void updateCachedCodecList();
+  // Make the next getCachedCodecList() call rebuild the list. Call this when the installed
+  // codecs changed.
+  static void invalidateCachedCodecList();
 
   static void Uninit();
 
   static const QList<CodecDriver>& getCachedCodecList();
 
   static QList<CodecDriver> findCodecsByFormat(const QList<CodecDriver>& list, CodecType type, const QString& format);
+  // Like findCodecsByFormat() on getCachedCodecList(), but uses a hash lookup.
+  static QList<CodecDriver> findCachedCodecsByFormat(CodecType type, const QString& format);
+  // The result is cached by the relevant stream properties until the codec list changes.
   static QList<CodecDriver> determineRequiredCodecs(const PlaybackInfo& info);
 };
 
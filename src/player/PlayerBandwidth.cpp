@@ -0,0 +1,265 @@
+#include "PlayerBandwidth.h"
+
+#include <QDateTime>
+#include <QFile>
+#include <QJsonDocument>
+#include <QJsonObject>
+
+#include <algorithm>
+
+#include "shared/Paths.h"
+#include "utils/Utils.h"
+#include "QtHelper.h"
+#include "QsLog.h"
+
+// Interval at which cache-speed is sampled.
+#define BANDWIDTH_SAMPLE_MS 1000
+
+// Samples of the current session the percentiles are computed from.
+#define BANDWIDTH_MAX_SAMPLES 120
+
+// Fewer samples than this don't replace what was persisted.
+#define BANDWIDTH_MIN_SAMPLES 5
+
+// Time after a seek during which the cache refill is measured.
+#define BANDWIDTH_REFILL_MS 10000
+
+// Weight of a new sample in the smoothed average; refills are full speed, so count more.
+#define BANDWIDTH_ALPHA 0.1
+#define BANDWIDTH_REFILL_ALPHA 0.3
+
+// Share of the 10th percentile that's recommended as the streaming bitrate.
+#define BANDWIDTH_HEADROOM 0.8
+
+// Hosts persisted; the least recently updated ones are dropped first.
+#define BANDWIDTH_MAX_HOSTS 50
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+BandwidthEstimator::BandwidthEstimator(QObject* parent)
+  : QObject(parent), m_mpv(nullptr), m_timer(this), m_samplePos(0), m_lastReported(0), m_loaded(false)
+{
+  m_timer.setInterval(BANDWIDTH_SAMPLE_MS);
+  connect(&m_timer, &QTimer::timeout, this, &BandwidthEstimator::sample);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void BandwidthEstimator::start(const QString& host)
+{
+  load();
+
+  if (host != m_host)
+  {
+    m_host = host;
+    m_samples.clear();
+    m_samplePos = 0;
+    m_lastReported = 0;
+  }
+  m_refill.invalidate();
+
+  if (m_host.isEmpty() || !m_mpv)
+    return;
+
+  // The starting cache fill is a refill too.
+  m_refill.start();
+  m_timer.start();
+
+  // Let the client know what's known about this host right away.
+  QVariantMap current = estimate();
+  if (!current.isEmpty() && m_lastReported == 0)
+  {
+    m_lastReported = current["recommended"].toDouble();
+    emit estimateChanged(current);
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void BandwidthEstimator::stop()
+{
+  if (!m_timer.isActive())
+    return;
+  m_timer.stop();
+  save();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void BandwidthEstimator::seekStarted()
+{
+  if (m_timer.isActive())
+    m_refill.start();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void BandwidthEstimator::rebuffered()
+{
+  if (!m_timer.isActive())
+    return;
+
+  // The network didn't keep up with the stream. Whatever the samples say, that's worth
+  // being more careful about.
+  HostEstimate& e = m_hosts[m_host];
+  e.rebuffers++;
+  e.p10 *= BANDWIDTH_HEADROOM;
+  m_refill.start();
+  QLOG_INFO() << "Rebuffering, lowering the bandwidth estimate of" << m_host << "to" << (int)e.p10 << "kbit/s";
+  update();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void BandwidthEstimator::sample()
+{
+  // cache-speed only says something about the network while the cache is filling; once it's
+  // full, reads are limited by playback.
+  if (mpv::qt::get_property(m_mpv, "demuxer-cache-idle").toBool())
+    return;
+
+  qint64 speed = mpv::qt::get_property(m_mpv, "cache-speed").toLongLong();
+  if (speed <= 0)
+    return;
+
+  bool refill = m_refill.isValid() && m_refill.elapsed() < BANDWIDTH_REFILL_MS;
+  addSample(speed * 8 / 1000.0, refill ? BANDWIDTH_REFILL_ALPHA : BANDWIDTH_ALPHA);
+  update();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void BandwidthEstimator::addSample(double kbps, double weight)
+{
+  if (m_samples.size() < BANDWIDTH_MAX_SAMPLES)
+  {
+    m_samples.append(kbps);
+  }
+  else
+  {
+    m_samples[m_samplePos] = kbps;
+    m_samplePos = (m_samplePos + 1) % BANDWIDTH_MAX_SAMPLES;
+  }
+
+  HostEstimate& e = m_hosts[m_host];
+  e.average = e.average > 0 ? e.average * (1 - weight) + kbps * weight : kbps;
+  e.samples++;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void BandwidthEstimator::update()
+{
+  HostEstimate& e = m_hosts[m_host];
+  e.updated = QDateTime::currentMSecsSinceEpoch();
+
+  if (m_samples.size() >= BANDWIDTH_MIN_SAMPLES)
+  {
+    QVector<double> sorted = m_samples;
+    std::sort(sorted.begin(), sorted.end());
+    double p10 = sorted[sorted.size() / 10];
+    // Drops are taken at once, but increases (e.g. after a rebuffer lowered it) only gradually.
+    e.p10 = (e.p10 <= 0 || p10 < e.p10) ? p10 : e.p10 * (1 - BANDWIDTH_ALPHA) + p10 * BANDWIDTH_ALPHA;
+    e.p50 = sorted[sorted.size() / 2];
+    e.p90 = sorted[(sorted.size() * 9) / 10];
+  }
+
+  QVariantMap current = toVariant(e);
+  double recommended = current["recommended"].toDouble();
+  if (recommended <= 0)
+    return;
+  if (m_lastReported > 0 && qAbs(recommended - m_lastReported) < m_lastReported / 10)
+    return;
+
+  m_lastReported = recommended;
+  QLOG_DEBUG() << "Bandwidth estimate for" << m_host << ":" << (int)recommended << "kbit/s recommended";
+  emit estimateChanged(current);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+QVariantMap BandwidthEstimator::toVariant(const HostEstimate& e)
+{
+  QVariantMap res;
+  if (e.samples == 0 && e.p10 <= 0)
+    return res;
+
+  // Before there are enough samples for percentiles, the average is all there is.
+  double base = e.p10 > 0 ? qMin(e.p10, e.average) : e.average;
+  res.insert("average", (int)e.average);
+  res.insert("p10", (int)e.p10);
+  res.insert("p50", (int)e.p50);
+  res.insert("p90", (int)e.p90);
+  res.insert("recommended", (int)(base * BANDWIDTH_HEADROOM));
+  res.insert("samples", e.samples);
+  res.insert("rebuffers", e.rebuffers);
+  res.insert("updated", e.updated);
+  return res;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+QVariantMap BandwidthEstimator::estimate(const QString& host)
+{
+  load();
+
+  QString key = host.isEmpty() ? m_host : host;
+  auto it = m_hosts.constFind(key);
+  if (key.isEmpty() || it == m_hosts.constEnd())
+    return QVariantMap();
+
+  QVariantMap res = toVariant(it.value());
+  if (!res.isEmpty())
+    res.insert("host", key);
+  return res;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void BandwidthEstimator::load()
+{
+  if (m_loaded)
+    return;
+  m_loaded = true;
+
+  QFile file(Paths::dataDir("bandwidth.json"));
+  if (!file.open(QIODevice::ReadOnly))
+    return;
+
+  QJsonObject hosts = QJsonDocument::fromJson(file.readAll()).object();
+  for (auto it = hosts.constBegin(); it != hosts.constEnd(); ++it)
+  {
+    QJsonObject obj = it.value().toObject();
+    HostEstimate e;
+    e.average = obj["average"].toDouble();
+    e.p10 = obj["p10"].toDouble();
+    e.p50 = obj["p50"].toDouble();
+    e.p90 = obj["p90"].toDouble();
+    e.samples = obj["samples"].toInt();
+    e.rebuffers = obj["rebuffers"].toInt();
+    e.updated = (qint64)obj["updated"].toDouble();
+    m_hosts.insert(it.key(), e);
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void BandwidthEstimator::save()
+{
+  while (m_hosts.size() > BANDWIDTH_MAX_HOSTS)
+  {
+    auto oldest = m_hosts.begin();
+    for (auto it = m_hosts.begin(); it != m_hosts.end(); ++it)
+    {
+      if (it->updated < oldest->updated)
+        oldest = it;
+    }
+    m_hosts.erase(oldest);
+  }
+
+  QJsonObject hosts;
+  for (auto it = m_hosts.constBegin(); it != m_hosts.constEnd(); ++it)
+  {
+    const HostEstimate& e = it.value();
+    QJsonObject obj;
+    obj["average"] = e.average;
+    obj["p10"] = e.p10;
+    obj["p50"] = e.p50;
+    obj["p90"] = e.p90;
+    obj["samples"] = e.samples;
+    obj["rebuffers"] = e.rebuffers;
+    obj["updated"] = (double)e.updated;
+    hosts[it.key()] = obj;
+  }
+
+  if (!Utils::safelyWriteFile(Paths::dataDir("bandwidth.json"), QJsonDocument(hosts).toJson(QJsonDocument::Compact)))
+    QLOG_WARN() << "Could not write the bandwidth estimates.";
+}
@@ -0,0 +1,74 @@
+#ifndef PLAYERBANDWIDTH_H
+#define PLAYERBANDWIDTH_H
+
+#include <QObject>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QVariant>
+#include <QVector>
+#include <QHash>
+
+#include <mpv/client.h>
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Estimates the bandwidth to the server of the current item from how fast the player fills its
+// cache. Only samples taken while the cache is actually filling say anything about the network;
+// refills after seeks and rebuffering are the most telling ones. Estimates are kept per server
+// host across sessions, so a new item starts with what was learned before.
+class BandwidthEstimator : public QObject
+{
+  Q_OBJECT
+public:
+  explicit BandwidthEstimator(QObject* parent = nullptr);
+
+  void setPlayer(mpv_handle* mpv) { m_mpv = mpv; }
+
+  // Start sampling for an item streamed from the given host.
+  void start(const QString& host);
+  // Stop sampling, and persist what was learned.
+  void stop();
+
+  // The cache is being refilled after a seek.
+  void seekStarted();
+  // Playback stalled to buffer.
+  void rebuffered();
+
+  // The estimate for the given host, or for the current one if it's empty. All rates are in
+  // kbit/s: "average" is smoothed over recent samples, p10/p50/p90 are percentiles, and
+  // "recommended" is a bitrate that should play without stalling. Empty if nothing is known.
+  QVariantMap estimate(const QString& host = QString());
+
+Q_SIGNALS:
+  // The estimate for the current host changed noticeably.
+  void estimateChanged(const QVariantMap& estimate);
+
+private:
+  struct HostEstimate
+  {
+    HostEstimate() : average(0), p10(0), p50(0), p90(0), samples(0), rebuffers(0), updated(0) {}
+    double average, p10, p50, p90; // kbit/s
+    int samples;
+    int rebuffers;
+    qint64 updated; // ms since the epoch
+  };
+
+  Q_SLOT void sample();
+  void addSample(double kbps, double weight);
+  void update();
+  static QVariantMap toVariant(const HostEstimate& estimate);
+  void load();
+  void save();
+
+  mpv_handle* m_mpv;
+  QTimer m_timer;
+  QString m_host;
+  // Samples of the current session for the current host, in kbit/s.
+  QVector<double> m_samples;
+  int m_samplePos;
+  QElapsedTimer m_refill;
+  double m_lastReported;
+  bool m_loaded;
+  QHash<QString, HostEstimate> m_hosts;
+};
+
+#endif // PLAYERBANDWIDTH_H
@@ -0,0 +1,933 @@
+#include "PlayerCacheProxy.h"
+
+#include <QCryptographicHash>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QHostAddress>
+#include <QNetworkRequest>
+#include <QTcpServer>
+
+#include <algorithm>
+
+#include "qhttpserverresponse.hpp"
+#include "qhttpserverrequest.hpp"
+
+#include "settings/SettingsComponent.h"
+#include "settings/SettingsSection.h"
+#include "shared/Paths.h"
+#include "utils/Utils.h"
+#include "QsLog.h"
+
+using namespace qhttp::server;
+
+// Data buffered by the upstream connection of a passthrough request before it stops reading
+// from the server, so a client that isn't reading doesn't make it buffer the whole file.
+#define PROXY_PASSTHROUGH_BUFFER (4 * 1024 * 1024)
+
+// Length of the random looking part of proxy URLs.
+#define PROXY_TOKEN_LENGTH 24
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static QByteArray hashHex(const QByteArray& data)
+{
+  return QCryptographicHash::hash(data, QCryptographicHash::Sha1).toHex();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void SegmentCache::open(const QString& dir, qint64 maxBytes)
+{
+  m_dir = dir;
+  m_maxBytes = maxBytes;
+  m_bytes = 0;
+  m_entries.clear();
+  m_lengths.clear();
+
+  QDir().mkpath(m_dir);
+
+  // Older files are evicted first; the modification times are all there is to go by.
+  QList<QPair<qint64, Key>> found;
+  for (const QFileInfo& resourceDir : QDir(m_dir).entryInfoList(QDir::Dirs | QDir::NoDotAndDotDot))
+  {
+    QByteArray resource = resourceDir.fileName().toLatin1();
+
+    QFile lengthFile(resourceDir.filePath() + "/length");
+    bool ok = false;
+    qint64 length = -1;
+    if (lengthFile.open(QIODevice::ReadOnly))
+      length = lengthFile.readAll().trimmed().toLongLong(&ok);
+    if (!ok || length < 0)
+    {
+      QDir(resourceDir.filePath()).removeRecursively();
+      continue;
+    }
+    m_lengths.insert(resource, length);
+
+    for (const QFileInfo& segment : QDir(resourceDir.filePath()).entryInfoList(QDir::Files))
+    {
+      qint64 index = segment.fileName().toLongLong(&ok);
+      if (!ok)
+      {
+        // Left over from a download that didn't finish.
+        QFile::remove(segment.filePath());
+        continue;
+      }
+      m_entries.insert(Key(resource, index), Entry{segment.size(), 0});
+      m_bytes += segment.size();
+      found << qMakePair(segment.lastModified().toMSecsSinceEpoch(), Key(resource, index));
+    }
+  }
+
+  std::sort(found.begin(), found.end(), [](const QPair<qint64, Key>& a, const QPair<qint64, Key>& b)
+  {
+    return a.first < b.first;
+  });
+  for (const auto& item : found)
+    m_entries[item.second].lastUsed = ++m_clock;
+
+  QLOG_DEBUG() << "Proxy cache has" << m_entries.size() << "segments," << m_bytes / (1024 * 1024) << "MB";
+  evict();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+QString SegmentCache::segmentPath(const QByteArray& resource, qint64 index) const
+{
+  return m_dir + "/" + QString::fromLatin1(resource) + "/" + QString::number(index);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool SegmentCache::contains(const QByteArray& resource, qint64 index) const
+{
+  return m_entries.contains(Key(resource, index));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool SegmentCache::read(const QByteArray& resource, qint64 index, qint64 offset, qint64 length,
+                        const std::function<void(const QByteArray&)>& sink)
+{
+  auto it = m_entries.find(Key(resource, index));
+  if (it == m_entries.end())
+    return false;
+
+  if (offset < 0 || length <= 0 || offset + length > it->size)
+    return false;
+
+  QFile file(segmentPath(resource, index));
+  if (!file.open(QIODevice::ReadOnly) || file.size() != it->size)
+  {
+    QLOG_WARN() << "Proxy cache segment" << file.fileName() << "went missing";
+    m_bytes -= it->size;
+    m_entries.erase(it);
+    return false;
+  }
+  it->lastUsed = ++m_clock;
+
+  uchar* map = file.map(offset, length);
+  if (map)
+  {
+    // No copy here; the socket copies into its own buffer when written to.
+    sink(QByteArray::fromRawData((const char*)map, (int)length));
+    file.unmap(map);
+    return true;
+  }
+
+  file.seek(offset);
+  QByteArray data = file.read(length);
+  if (data.size() != length)
+    return false;
+  sink(data);
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+QString SegmentCache::partialPath(const QByteArray& resource, qint64 index)
+{
+  QDir().mkpath(m_dir + "/" + QString::fromLatin1(resource));
+  return segmentPath(resource, index) + ".part";
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void SegmentCache::commit(const QByteArray& resource, qint64 index, qint64 size)
+{
+  QString partial = segmentPath(resource, index) + ".part";
+  if (m_maxBytes <= 0 || size <= 0 || contains(resource, index))
+  {
+    QFile::remove(partial);
+    return;
+  }
+
+  QFile::remove(segmentPath(resource, index));
+  if (!QFile::rename(partial, segmentPath(resource, index)))
+  {
+    QLOG_WARN() << "Could not write proxy cache segment" << segmentPath(resource, index);
+    QFile::remove(partial);
+    return;
+  }
+
+  m_entries.insert(Key(resource, index), Entry{size, ++m_clock});
+  m_bytes += size;
+  evict();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void SegmentCache::setLength(const QByteArray& resource, qint64 length)
+{
+  qint64 previous = this->length(resource);
+  if (previous == length)
+    return;
+
+  if (previous >= 0)
+  {
+    QLOG_INFO() << "Remote file" << resource << "changed size, dropping its cached segments";
+    drop(resource);
+  }
+
+  QDir().mkpath(m_dir + "/" + QString::fromLatin1(resource));
+  Utils::safelyWriteFile(m_dir + "/" + QString::fromLatin1(resource) + "/length", QByteArray::number(length));
+  m_lengths.insert(resource, length);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void SegmentCache::drop(const QByteArray& resource)
+{
+  for (auto it = m_entries.begin(); it != m_entries.end();)
+  {
+    if (it.key().first == resource)
+    {
+      m_bytes -= it->size;
+      it = m_entries.erase(it);
+    }
+    else
+    {
+      ++it;
+    }
+  }
+
+  m_lengths.remove(resource);
+  QDir(m_dir + "/" + QString::fromLatin1(resource)).removeRecursively();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void SegmentCache::evict()
+{
+  while (m_bytes > m_maxBytes && !m_entries.isEmpty())
+  {
+    auto oldest = m_entries.begin();
+    for (auto it = m_entries.begin(); it != m_entries.end(); ++it)
+    {
+      if (it->lastUsed < oldest->lastUsed)
+        oldest = it;
+    }
+
+    QFile::remove(segmentPath(oldest.key().first, oldest.key().second));
+    m_bytes -= oldest->size;
+    m_entries.erase(oldest);
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+SegmentFetch::SegmentFetch(QNetworkAccessManager* manager, const QUrl& url, const QByteArray& userAgent,
+                           qint64 index, const QString& file, bool ignoreSslErrors, QObject* parent)
+  : QObject(parent), m_index(index), m_fileError(false), m_finished(false), m_success(false),
+    m_noRanges(false), m_total(-1)
+{
+  qint64 start = index * SegmentCache::SegmentSize;
+
+  if (!file.isEmpty())
+  {
+    m_file.setFileName(file);
+    if (!m_file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+      QLOG_WARN() << "Could not open proxy cache segment" << file;
+  }
+
+  QNetworkRequest request(url);
+  request.setAttribute(QNetworkRequest::FollowRedirectsAttribute, true);
+  if (!userAgent.isEmpty())
+    request.setRawHeader("User-Agent", userAgent);
+  request.setRawHeader("Range", "bytes=" + QByteArray::number(start) + "-" +
+                                QByteArray::number(start + SegmentCache::SegmentSize - 1));
+
+  m_reply = manager->get(request);
+  m_reply->setParent(this);
+  if (ignoreSslErrors)
+    connect(m_reply, &QNetworkReply::sslErrors, m_reply, [=]() { m_reply->ignoreSslErrors(); });
+  connect(m_reply, &QNetworkReply::metaDataChanged, this, &SegmentFetch::metaDataChanged);
+  connect(m_reply, &QNetworkReply::readyRead, this, &SegmentFetch::readyRead);
+  connect(m_reply, &QNetworkReply::finished, this, &SegmentFetch::replyFinished);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void SegmentFetch::metaDataChanged()
+{
+  int status = m_reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+  m_contentType = m_reply->rawHeader("Content-Type");
+
+  // "bytes 0-2097151/1234567", or "bytes */1234567" with a 416. Known before any data arrives,
+  // so streams can send their headers with the first bytes.
+  QByteArray range = m_reply->rawHeader("Content-Range");
+  int slash = range.lastIndexOf('/');
+  if (slash >= 0)
+  {
+    bool ok = false;
+    qint64 total = range.mid(slash + 1).toLongLong(&ok);
+    if (ok)
+      m_total = total;
+  }
+
+  if (status == 200)
+  {
+    // The server sent the whole file. That's fine if the whole file is this first segment,
+    // otherwise there's no point in downloading all of it for one segment.
+    bool ok = false;
+    qint64 length = m_reply->rawHeader("Content-Length").toLongLong(&ok);
+    if (m_index == 0 && ok && length <= SegmentCache::SegmentSize)
+    {
+      m_total = length;
+      return;
+    }
+
+    m_noRanges = true;
+    m_reply->abort();
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void SegmentFetch::readyRead()
+{
+  // Error pages are not part of the file.
+  int status = m_reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+  if (m_noRanges || (status != 200 && status != 206))
+  {
+    m_reply->readAll();
+    return;
+  }
+
+  QByteArray data = m_reply->readAll();
+  if (data.isEmpty())
+    return;
+  m_data.append(data);
+
+  if (m_file.isOpen() && !m_fileError && m_file.write(data) != data.size())
+  {
+    QLOG_WARN() << "Could not write proxy cache segment" << m_file.fileName();
+    m_fileError = true;
+  }
+
+  emit progress(this);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void SegmentFetch::replyFinished()
+{
+  readyRead();
+
+  int status = m_reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+
+  if (m_noRanges)
+  {
+    m_success = false;
+  }
+  else if (status == 416)
+  {
+    // The segment starts past the end of the file.
+    m_success = true;
+  }
+  else if (m_reply->error() != QNetworkReply::NoError || (status != 200 && status != 206))
+  {
+    QLOG_WARN() << "Proxy fetch of" << m_reply->url().toString(QUrl::RemoveQuery) << "segment" << m_index
+                << "failed:" << status << m_reply->errorString();
+    m_success = false;
+  }
+  else
+  {
+    m_success = true;
+  }
+
+  if (m_file.isOpen())
+    m_file.close();
+  m_finished = true;
+  emit done(this);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+ProxyStream::ProxyStream(CacheProxyWorker* worker, const QByteArray& resource, const QUrl& url,
+                         const QByteArray& userAgent, const QByteArray& range, QHttpResponse* response)
+  : QObject(response), m_worker(worker), m_resource(resource), m_url(url), m_userAgent(userAgent),
+    m_range(range), m_response(response), m_pos(0), m_end(-1), m_hasRange(false), m_headersWritten(false),
+    m_waitingFor(-1), m_draining(false), m_segmentIndex(-1), m_passthrough(nullptr)
+{
+  connect(response, &QHttpResponse::allBytesWritten, this, [=]()
+  {
+    if (!m_draining)
+      return;
+    m_draining = false;
+    if (m_passthrough)
+    {
+      if (m_passthrough->bytesAvailable() > 0)
+      {
+        m_draining = true;
+        write(m_passthrough->readAll());
+      }
+      else if (m_passthrough->isFinished())
+      {
+        m_response->end();
+      }
+    }
+    else
+    {
+      next();
+    }
+  });
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void ProxyStream::start()
+{
+  if (!m_range.isEmpty())
+  {
+    // Only single "bytes=first-[last]" ranges are served from the cache, which is all the player
+    // asks for.
+    QByteArray spec = m_range.trimmed();
+    if (spec.startsWith("bytes=") && !spec.contains(','))
+    {
+      QList<QByteArray> parts = spec.mid(6).split('-');
+      bool firstOk = false, lastOk = true;
+      if (parts.size() == 2)
+      {
+        m_pos = parts[0].trimmed().toLongLong(&firstOk);
+        if (!parts[1].trimmed().isEmpty())
+          m_end = parts[1].trimmed().toLongLong(&lastOk) + 1;
+      }
+      m_hasRange = firstOk && lastOk && (m_end < 0 || m_end > m_pos);
+    }
+
+    if (!m_hasRange)
+    {
+      m_pos = 0;
+      m_end = -1;
+      startPassthrough();
+      return;
+    }
+  }
+
+  if (m_worker->noRanges(m_resource))
+    startPassthrough();
+  else
+    next();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void ProxyStream::next()
+{
+  if (!m_response)
+    return;
+
+  SegmentCache& cache = m_worker->cache();
+  qint64 total = cache.length(m_resource);
+  if (total >= 0 && !m_headersWritten && !writeHeaders(total))
+    return;
+
+  if (m_headersWritten && m_pos >= m_end)
+  {
+    m_response->end();
+    return;
+  }
+
+  qint64 index = m_pos / SegmentCache::SegmentSize;
+  qint64 offset = m_pos - index * SegmentCache::SegmentSize;
+
+  if (m_headersWritten)
+  {
+    qint64 length = qMin(SegmentCache::SegmentSize - offset, m_end - m_pos);
+    if (cache.read(m_resource, index, offset, length, [=](const QByteArray& data) { write(data); }))
+    {
+      m_worker->countHit(length);
+      m_pos += length;
+      m_draining = true;
+      return;
+    }
+  }
+
+  // The rest of a segment whose fetch finished while the client was still reading.
+  if (index == m_segmentIndex && m_headersWritten)
+  {
+    qint64 length = qMin((qint64)m_segment.size() - offset, m_end - m_pos);
+    if (length <= 0)
+    {
+      // A short segment is the end of the file.
+      m_response->end();
+      return;
+    }
+    write(m_segment.mid((int)offset, (int)length));
+    m_worker->countMiss(length);
+    m_pos += length;
+    m_draining = true;
+    return;
+  }
+  m_segment.clear();
+  m_segmentIndex = -1;
+
+  SegmentFetch* fetch = m_worker->fetch(m_resource, m_url, m_userAgent, index);
+  m_waitingFor = index;
+  connect(fetch, &SegmentFetch::progress, this, &ProxyStream::segmentProgress, Qt::UniqueConnection);
+  connect(fetch, &SegmentFetch::done, this, &ProxyStream::segmentProgress, Qt::UniqueConnection);
+
+  // Get the segment after this one at the same time; the player is going to read on.
+  qint64 nextStart = (index + 1) * SegmentCache::SegmentSize;
+  if ((total < 0 || nextStart < (m_headersWritten ? m_end : total)) && !cache.contains(m_resource, index + 1))
+    m_worker->fetch(m_resource, m_url, m_userAgent, index + 1);
+
+  // The fetch may have been running for a while already.
+  segmentProgress(fetch);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void ProxyStream::segmentProgress(SegmentFetch* fetch)
+{
+  if (fetch->index() != m_waitingFor || !m_response)
+    return;
+
+  if (fetch->isFinished())
+  {
+    m_waitingFor = -1;
+    disconnect(fetch, nullptr, this, nullptr);
+
+    if (fetch->noRanges())
+    {
+      if (m_headersWritten)
+        fail(qhttp::ESTATUS_BAD_GATEWAY);
+      else
+        startPassthrough();
+      return;
+    }
+
+    if (!fetch->success())
+    {
+      fail(qhttp::ESTATUS_BAD_GATEWAY);
+      return;
+    }
+
+    // Without the size, there's nothing but passing the request through.
+    qint64 total = fetch->total() >= 0 ? fetch->total() : m_worker->cache().length(m_resource);
+    if (!m_headersWritten && !writeHeaders(total))
+      return;
+
+    // The fetch goes away now; next() serves the rest of the segment from this.
+    m_segment = fetch->data();
+    m_segmentIndex = fetch->index();
+    if (!m_draining)
+      next();
+    return;
+  }
+
+  // Whatever arrives while the client is busy goes out with the next write.
+  if (m_draining)
+    return;
+
+  if (!m_headersWritten)
+  {
+    qint64 total = fetch->total() >= 0 ? fetch->total() : m_worker->cache().length(m_resource);
+    if (total < 0)
+      return;
+    if (!writeHeaders(total))
+      return;
+  }
+
+  qint64 offset = m_pos - fetch->index() * SegmentCache::SegmentSize;
+  qint64 length = qMin((qint64)fetch->data().size() - offset, m_end - m_pos);
+  if (length <= 0)
+    return;
+
+  write(fetch->data().mid((int)offset, (int)length));
+  m_worker->countMiss(length);
+  m_pos += length;
+  m_draining = true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool ProxyStream::writeHeaders(qint64 total)
+{
+  if (total < 0)
+  {
+    // Without the size there are no valid Content-Range headers to send.
+    startPassthrough();
+    return false;
+  }
+
+  if (m_pos >= total && (m_pos > 0 || m_hasRange))
+  {
+    m_response->addHeader("content-range", "bytes */" + QByteArray::number(total));
+    fail(qhttp::ESTATUS_REQUESTED_RANGE_NOT_SATISFIABLE);
+    return false;
+  }
+
+  m_end = m_end >= 0 ? qMin(m_end, total) : total;
+
+  if (m_hasRange)
+  {
+    m_response->setStatusCode(qhttp::ESTATUS_PARTIAL_CONTENT);
+    m_response->addHeader("content-range", "bytes " + QByteArray::number(m_pos) + "-" +
+                                           QByteArray::number(m_end - 1) + "/" + QByteArray::number(total));
+  }
+  else
+  {
+    m_response->setStatusCode(qhttp::ESTATUS_OK);
+  }
+  m_response->addHeader("content-length", QByteArray::number(m_end - m_pos));
+  m_response->addHeader("accept-ranges", "bytes");
+
+  QByteArray contentType = m_worker->contentType(m_resource);
+  if (!contentType.isEmpty())
+    m_response->addHeader("content-type", contentType);
+
+  m_headersWritten = true;
+  if (m_end == m_pos)
+    m_response->end();
+  return m_end > m_pos;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void ProxyStream::write(const QByteArray& data)
+{
+  if (m_response)
+    m_response->write(data);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void ProxyStream::fail(int status)
+{
+  if (!m_response)
+    return;
+
+  // Once the headers are out, all that can be done is cutting the response short; the player
+  // reconnects from where it got to.
+  if (!m_headersWritten)
+    m_response->setStatusCode(qhttp::TStatusCode(status));
+  m_headersWritten = true;
+  m_response->end();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void ProxyStream::startPassthrough()
+{
+  QLOG_DEBUG() << "Proxy passing" << m_url.toString(QUrl::RemoveQuery) << "through uncached";
+
+  QNetworkRequest request(m_url);
+  request.setAttribute(QNetworkRequest::FollowRedirectsAttribute, true);
+  if (!m_userAgent.isEmpty())
+    request.setRawHeader("User-Agent", m_userAgent);
+  if (!m_range.isEmpty())
+    request.setRawHeader("Range", m_range);
+
+  m_passthrough = m_worker->network()->get(request);
+  m_passthrough->setParent(this);
+  m_passthrough->setReadBufferSize(PROXY_PASSTHROUGH_BUFFER);
+  if (m_worker->ignoreSslErrors())
+    connect(m_passthrough, &QNetworkReply::sslErrors, m_passthrough, [=]() { m_passthrough->ignoreSslErrors(); });
+
+  connect(m_passthrough, &QNetworkReply::metaDataChanged, this, [=]()
+  {
+    if (!m_response || m_headersWritten)
+      return;
+    m_headersWritten = true;
+
+    int status = m_passthrough->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    m_response->setStatusCode(qhttp::TStatusCode(status > 0 ? status : 502));
+    for (const char* name : {"Content-Length", "Content-Range", "Content-Type", "Accept-Ranges"})
+    {
+      if (m_passthrough->hasRawHeader(name))
+        m_response->addHeader(QByteArray(name).toLower(), m_passthrough->rawHeader(name));
+    }
+  });
+
+  connect(m_passthrough, &QNetworkReply::readyRead, this, [=]()
+  {
+    if (!m_response || m_draining)
+      return;
+    m_draining = true;
+    write(m_passthrough->readAll());
+  });
+
+  connect(m_passthrough, &QNetworkReply::finished, this, [=]()
+  {
+    if (!m_response)
+      return;
+
+    if (!m_headersWritten)
+    {
+      fail(qhttp::ESTATUS_BAD_GATEWAY);
+      return;
+    }
+
+    // Whatever is still buffered goes out once the client took the previous write.
+    if (!m_draining)
+    {
+      if (m_passthrough->bytesAvailable() > 0)
+        write(m_passthrough->readAll());
+      m_response->end();
+    }
+  });
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// QHttpServer keeps its socket to itself, but with port 0 the bound port has to be read back.
+class ProxyHttpServer : public QHttpServer
+{
+public:
+  explicit ProxyHttpServer(QObject* parent) : QHttpServer(parent) {}
+
+  quint16 port() const { return tcpServer() ? tcpServer()->serverPort() : 0; }
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+CacheProxyWorker::CacheProxyWorker(const QSharedPointer<ProxyRoutes>& routes)
+  : m_routes(routes), m_server(nullptr), m_network(nullptr), m_ignoreSslErrors(false), m_hitBytes(0),
+    m_missBytes(0)
+{
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+quint16 CacheProxyWorker::start(qint64 maxBytes, bool ignoreSslErrors)
+{
+  m_ignoreSslErrors = ignoreSslErrors;
+  m_network = new QNetworkAccessManager(this);
+  m_cache.open(Paths::cacheDir("proxy"), maxBytes);
+
+  ProxyHttpServer* server = new ProxyHttpServer(this);
+  if (!server->listen(QHostAddress::LocalHost, 0))
+  {
+    QLOG_WARN() << "Could not start the caching proxy";
+    delete server;
+    return 0;
+  }
+  connect(server, &QHttpServer::newRequest, this, &CacheProxyWorker::handleRequest);
+  m_server = server;
+
+  QLOG_INFO() << "Caching proxy listening on port" << server->port() << "with" << maxBytes / (1024 * 1024) << "MB of cache";
+  return server->port();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void CacheProxyWorker::stop()
+{
+  // Deleting the server closes the connections, and with them the streams and their upstream
+  // requests.
+  delete m_server;
+  m_server = nullptr;
+
+  qDeleteAll(m_fetches);
+  m_fetches.clear();
+
+  delete m_network;
+  m_network = nullptr;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+QVariantMap CacheProxyWorker::stats()
+{
+  QVariantMap res;
+  res.insert("hitBytes", m_hitBytes);
+  res.insert("missBytes", m_missBytes);
+  qint64 served = m_hitBytes + m_missBytes;
+  res.insert("hitRate", served > 0 ? (double)m_hitBytes / served : 0.0);
+  res.insert("cacheBytes", m_cache.bytes());
+  res.insert("fetching", m_fetches.size());
+  return res;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void CacheProxyWorker::handleRequest(QHttpRequest* request, QHttpResponse* response)
+{
+  // /<token>/<file name>; the name is only there for the player to guess the format from.
+  QByteArray token = request->url().path().section('/', 1, 1).toLatin1();
+
+  QUrl url;
+  {
+    QMutexLocker lock(&m_routes->lock);
+    url = m_routes->urls.value(token);
+  }
+
+  if (!url.isValid())
+  {
+    response->setStatusCode(qhttp::ESTATUS_NOT_FOUND);
+    response->end();
+    return;
+  }
+
+  if (request->method() != qhttp::EHTTP_GET)
+  {
+    response->setStatusCode(qhttp::ESTATUS_METHOD_NOT_ALLOWED);
+    response->end();
+    return;
+  }
+
+  // The query usually carries a session token that changes between plays of the same file.
+  QByteArray resource = hashHex(url.toString(QUrl::RemoveQuery | QUrl::RemoveFragment).toUtf8());
+
+  ProxyStream* stream = new ProxyStream(this, resource, url, request->headers().value("user-agent"),
+                                        request->headers().value("range"), response);
+  stream->start();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+SegmentFetch* CacheProxyWorker::fetch(const QByteArray& resource, const QUrl& url, const QByteArray& userAgent, qint64 index)
+{
+  QPair<QByteArray, qint64> key(resource, index);
+  SegmentFetch* fetch = m_fetches.value(key);
+  if (fetch)
+    return fetch;
+
+  // Connected before any stream connects, so the cache is updated when the streams get it.
+  QString file = m_cache.enabled() ? m_cache.partialPath(resource, index) : QString();
+  fetch = new SegmentFetch(m_network, url, userAgent, index, file, m_ignoreSslErrors, this);
+  connect(fetch, &SegmentFetch::done, this, [=]() { fetchDone(resource, fetch); });
+  m_fetches.insert(key, fetch);
+  return fetch;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void CacheProxyWorker::fetchDone(const QByteArray& resource, SegmentFetch* fetch)
+{
+  m_fetches.remove(QPair<QByteArray, qint64>(resource, fetch->index()));
+  fetch->deleteLater();
+
+  if (fetch->noRanges())
+  {
+    QLOG_INFO() << "Server doesn't do range requests for" << resource << "- passing it through uncached";
+    m_noRanges.insert(resource);
+  }
+
+  if (fetch->success() && !fetch->contentType().isEmpty())
+    m_contentTypes.insert(resource, fetch->contentType());
+
+  qint64 total = fetch->success() ? fetch->total() : -1;
+  if (total >= 0)
+    m_cache.setLength(resource, total);
+
+  // Only whole segments are kept, and the last one, which is shorter. The file was written while
+  // the segment downloaded.
+  qint64 size = fetch->data().size();
+  qint64 start = fetch->index() * SegmentCache::SegmentSize;
+  bool whole = size == SegmentCache::SegmentSize || (size > 0 && start + size == total);
+  if (fetch->fileComplete() && total >= 0 && whole)
+    m_cache.commit(resource, fetch->index(), size);
+  else if (!fetch->fileName().isEmpty())
+    QFile::remove(fetch->fileName());
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+CacheProxy::CacheProxy(QObject* parent)
+  : QObject(parent), m_routes(new ProxyRoutes), m_port(0)
+{
+  m_thread = new QThread(this);
+  m_thread->setObjectName("CacheProxy");
+
+  m_worker = new CacheProxyWorker(m_routes);
+  m_worker->moveToThread(m_thread);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+CacheProxy::~CacheProxy()
+{
+  if (m_thread->isRunning())
+  {
+    QMetaObject::invokeMethod(m_worker, "stop", Qt::BlockingQueuedConnection);
+    m_thread->exit(0);
+    m_thread->wait();
+  }
+
+  delete m_worker;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool CacheProxy::ensureStarted()
+{
+  if (m_port)
+    return true;
+
+  // Only try once; if the port couldn't be bound, it's not going to work later either.
+  if (m_thread->isRunning())
+    return false;
+
+  m_thread->start();
+
+  qint64 maxBytes = SettingsComponent::Get().value(SETTINGS_SECTION_VIDEO, "proxy.cache_size").toLongLong() * 1024 * 1024;
+  bool ignoreSslErrors = SettingsComponent::Get().ignoreSSLErrors();
+  QMetaObject::invokeMethod(m_worker, "start", Qt::BlockingQueuedConnection, Q_RETURN_ARG(quint16, m_port),
+                            Q_ARG(qint64, maxBytes), Q_ARG(bool, ignoreSslErrors));
+  return m_port != 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+QString CacheProxy::rewrite(const QString& url)
+{
+  if (!SettingsComponent::Get().value(SETTINGS_SECTION_VIDEO, "proxy.enabled").toBool())
+    return url;
+
+  // Only plain files: HLS playlists and their segments, and transcodes, which are generated
+  // while they play and go away with the session, are not worth keeping.
+  QUrl remote(url);
+  QString path = remote.path().toLower();
+  if ((remote.scheme() != "http" && remote.scheme() != "https") || remote.host().isEmpty() ||
+      path.endsWith(".m3u8") || path.contains("/transcode/"))
+    return url;
+
+  if (!ensureStarted())
+    return url;
+
+  // Anything but the proxy itself. Local servers go through it like any other, which is also
+  // how it's checked end to end (scripts/check-cache-proxy.py).
+  QHostAddress address(remote.host());
+  if ((remote.host() == "localhost" || (!address.isNull() && address.isLoopback())) && remote.port() == m_port)
+    return url;
+
+  QByteArray token = hashHex(url.toUtf8()).left(PROXY_TOKEN_LENGTH);
+  {
+    QMutexLocker lock(&m_routes->lock);
+    m_routes->urls.insert(token, remote);
+    m_routes->users[token]++;
+  }
+
+  QString name = QFileInfo(remote.path()).fileName();
+  if (name.isEmpty())
+    name = "file";
+
+  return QString("http://127.0.0.1:%1/%2/%3").arg(m_port).arg(QString::fromLatin1(token))
+                                              .arg(QString::fromLatin1(QUrl::toPercentEncoding(name)));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void CacheProxy::release(const QString& proxyUrl)
+{
+  if (proxyUrl.isEmpty())
+    return;
+
+  QByteArray token = QUrl(proxyUrl).path().section('/', 1, 1).toLatin1();
+
+  QMutexLocker lock(&m_routes->lock);
+  auto it = m_routes->users.find(token);
+  if (it == m_routes->users.end())
+    return;
+  if (--it.value() <= 0)
+  {
+    m_routes->users.erase(it);
+    m_routes->urls.remove(token);
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+QVariantMap CacheProxy::stats()
+{
+  QVariantMap res;
+  res.insert("enabled", SettingsComponent::Get().value(SETTINGS_SECTION_VIDEO, "proxy.enabled").toBool());
+  if (!m_port)
+    return res;
+
+  QVariantMap worker;
+  QMetaObject::invokeMethod(m_worker, "stats", Qt::BlockingQueuedConnection, Q_RETURN_ARG(QVariantMap, worker));
+  for (auto it = worker.constBegin(); it != worker.constEnd(); ++it)
+    res.insert(it.key(), it.value());
+  res.insert("port", m_port);
+  return res;
+}
@@ -0,0 +1,241 @@
+#ifndef PLAYERCACHEPROXY_H
+#define PLAYERCACHEPROXY_H
+
+#include <QObject>
+#include <QThread>
+#include <QMutex>
+#include <QFile>
+#include <QHash>
+#include <QSet>
+#include <QUrl>
+#include <QPointer>
+#include <QVariant>
+#include <QSharedPointer>
+#include <QNetworkAccessManager>
+#include <QNetworkReply>
+
+#include <functional>
+
+#include "qhttpserver.hpp"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Remote files cut into fixed-size segments, stored as one file per segment on disk. Segments
+// are served straight from a memory mapping of their file, and the least recently used ones are
+// dropped once the cache is over its size. Only used from the proxy thread.
+class SegmentCache
+{
+public:
+  static const qint64 SegmentSize = 2 * 1024 * 1024;
+
+  SegmentCache() : m_maxBytes(0), m_bytes(0), m_clock(0) {}
+
+  // Index what's already in dir.
+  void open(const QString& dir, qint64 maxBytes);
+
+  bool enabled() const { return m_maxBytes > 0; }
+  bool contains(const QByteArray& resource, qint64 index) const;
+  // Pass length bytes of the segment starting at offset (within the segment) to sink. Returns
+  // false if the segment isn't cached or can't be read.
+  bool read(const QByteArray& resource, qint64 index, qint64 offset, qint64 length,
+            const std::function<void(const QByteArray&)>& sink);
+  // Where a segment is written while it's downloaded, and adding it once it's complete.
+  QString partialPath(const QByteArray& resource, qint64 index);
+  void commit(const QByteArray& resource, qint64 index, qint64 size);
+
+  // Total size of the remote file, -1 if unknown. Setting a different size than before drops
+  // the cached segments, since the file must have changed.
+  qint64 length(const QByteArray& resource) const { return m_lengths.value(resource, -1); }
+  void setLength(const QByteArray& resource, qint64 length);
+
+  qint64 bytes() const { return m_bytes; }
+
+private:
+  typedef QPair<QByteArray, qint64> Key;
+  struct Entry
+  {
+    qint64 size;
+    quint64 lastUsed;
+  };
+
+  QString segmentPath(const QByteArray& resource, qint64 index) const;
+  void drop(const QByteArray& resource);
+  void evict();
+
+  QString m_dir;
+  qint64 m_maxBytes;
+  qint64 m_bytes;
+  quint64 m_clock;
+  QHash<Key, Entry> m_entries;
+  QHash<QByteArray, qint64> m_lengths;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// The proxy URL path -> remote URL mapping, shared between the GUI and the proxy thread. A route
+// stays as long as some item loaded through it is queued or playing.
+struct ProxyRoutes
+{
+  QMutex lock;
+  QHash<QByteArray, QUrl> urls;
+  QHash<QByteArray, int> users;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// One segment being downloaded. Every request that needs the segment reads from the same fetch,
+// so overlapping Range requests only hit the server once. Data is passed on as it arrives, and
+// written to file (if there is one) as it's received.
+class SegmentFetch : public QObject
+{
+  Q_OBJECT
+public:
+  SegmentFetch(QNetworkAccessManager* manager, const QUrl& url, const QByteArray& userAgent,
+               qint64 index, const QString& file, bool ignoreSslErrors, QObject* parent);
+
+  qint64 index() const { return m_index; }
+  bool isFinished() const { return m_finished; }
+  bool success() const { return m_success; }
+  // The whole segment was written to the file.
+  bool fileComplete() const { return m_success && m_file.isOpen() && !m_fileError; }
+  QString fileName() const { return m_file.fileName(); }
+  // The server ignored the Range header; the file can't be fetched in segments.
+  bool noRanges() const { return m_noRanges; }
+  // Total size of the remote file from Content-Range, -1 if unknown.
+  qint64 total() const { return m_total; }
+  QByteArray contentType() const { return m_contentType; }
+  // What arrived so far.
+  const QByteArray& data() const { return m_data; }
+
+Q_SIGNALS:
+  // More data arrived.
+  void progress(SegmentFetch* fetch);
+  void done(SegmentFetch* fetch);
+
+private:
+  void metaDataChanged();
+  void readyRead();
+  void replyFinished();
+
+  QNetworkReply* m_reply;
+  qint64 m_index;
+  QFile m_file;
+  bool m_fileError;
+  bool m_finished;
+  bool m_success;
+  bool m_noRanges;
+  qint64 m_total;
+  QByteArray m_contentType;
+  QByteArray m_data;
+};
+
+class CacheProxyWorker;
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Serves one client request, segment by segment, from the cache or from fetches. Lives as long
+// as the response.
+class ProxyStream : public QObject
+{
+  Q_OBJECT
+public:
+  ProxyStream(CacheProxyWorker* worker, const QByteArray& resource, const QUrl& url,
+              const QByteArray& userAgent, const QByteArray& range, qhttp::server::QHttpResponse* response);
+
+  void start();
+
+private:
+  void next();
+  // Pass on what the fetch of the segment m_pos is in has that wasn't written yet.
+  void segmentProgress(SegmentFetch* fetch);
+  bool writeHeaders(qint64 total);
+  void write(const QByteArray& data);
+  void fail(int status);
+  void startPassthrough();
+
+  CacheProxyWorker* m_worker;
+  QByteArray m_resource;
+  QUrl m_url;
+  QByteArray m_userAgent;
+  QByteArray m_range;
+  QPointer<qhttp::server::QHttpResponse> m_response;
+  qint64 m_pos;
+  qint64 m_end;        // exclusive, -1 for the end of the file
+  bool m_hasRange;
+  bool m_headersWritten;
+  qint64 m_waitingFor; // segment index, -1 if not waiting
+  bool m_draining;     // waiting for the client to take what was written
+  // A finished fetch's data, for the rest of the segment, which the cache might not have kept.
+  QByteArray m_segment;
+  qint64 m_segmentIndex;
+  QNetworkReply* m_passthrough;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Lives on the proxy thread: the HTTP server, the upstream connections and the segment cache.
+class CacheProxyWorker : public QObject
+{
+  Q_OBJECT
+public:
+  explicit CacheProxyWorker(const QSharedPointer<ProxyRoutes>& routes);
+
+  Q_INVOKABLE quint16 start(qint64 maxBytes, bool ignoreSslErrors);
+  Q_INVOKABLE void stop();
+  Q_INVOKABLE QVariantMap stats();
+
+  SegmentCache& cache() { return m_cache; }
+  QNetworkAccessManager* network() { return m_network; }
+
+  // The running fetch of the segment, or a new one.
+  SegmentFetch* fetch(const QByteArray& resource, const QUrl& url, const QByteArray& userAgent, qint64 index);
+
+  bool noRanges(const QByteArray& resource) const { return m_noRanges.contains(resource); }
+  QByteArray contentType(const QByteArray& resource) const { return m_contentTypes.value(resource); }
+  bool ignoreSslErrors() const { return m_ignoreSslErrors; }
+
+  void countHit(qint64 bytes) { m_hitBytes += bytes; }
+  void countMiss(qint64 bytes) { m_missBytes += bytes; }
+
+private:
+  void handleRequest(qhttp::server::QHttpRequest* request, qhttp::server::QHttpResponse* response);
+  void fetchDone(const QByteArray& resource, SegmentFetch* fetch);
+
+  QSharedPointer<ProxyRoutes> m_routes;
+  qhttp::server::QHttpServer* m_server;
+  QNetworkAccessManager* m_network;
+  SegmentCache m_cache;
+  QHash<QPair<QByteArray, qint64>, SegmentFetch*> m_fetches;
+  QSet<QByteArray> m_noRanges;
+  QHash<QByteArray, QByteArray> m_contentTypes;
+  bool m_ignoreSslErrors;
+  qint64 m_hitBytes;
+  qint64 m_missBytes;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Optional loopback HTTP proxy between the player and the media server. Remote files are read
+// through the segment cache, so seeks outside the demuxer cache and rewatching recently played
+// parts are served from disk.
+class CacheProxy : public QObject
+{
+  Q_OBJECT
+public:
+  explicit CacheProxy(QObject* parent = nullptr);
+  ~CacheProxy() override;
+
+  // Return the proxy URL to load instead of url, or url itself if it isn't proxied (the proxy
+  // is disabled, or the URL isn't a plain remote file). Every proxy URL returned must be passed
+  // to release() once the item using it is gone.
+  QString rewrite(const QString& url);
+  // The item loaded from proxyUrl is no longer queued or playing. Does nothing for an empty URL.
+  void release(const QString& proxyUrl);
+
+  // Hit/miss bytes and the cache size, for the web client.
+  QVariantMap stats();
+
+private:
+  bool ensureStarted();
+
+  QThread* m_thread;
+  CacheProxyWorker* m_worker;
+  QSharedPointer<ProxyRoutes> m_routes;
+  quint16 m_port;
+};
+
+#endif // PLAYERCACHEPROXY_H
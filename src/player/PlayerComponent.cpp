@@ -2,6 +2,9 @@
 #include <QString>
 #include <Qt>
 #include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QCryptographicHash>
 #include <QCoreApplication>
 #include <QGuiApplication>
 #include "display/DisplayComponent.h"
@@ -13,12 +16,14 @@
 #include "settings/SettingsSection.h"
 
 #include "PlayerQuickItem.h"
+#include "PlayerEventThread.h"
 #include "input/InputComponent.h"
 
 #include "QsLog.h"
 
 #include <math.h>
 #include <string.h>
+#include <utility>
 #include <shared/Paths.h>
 
 #if !defined(Q_OS_WIN)
@@ -42,6 +47,52 @@ static void wakeup_cb(void *context)
   emit player->onMpvEvents();
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static void standby_wakeup_cb(void *context)
+{
+  QMetaObject::invokeMethod((PlayerComponent *)context, "handleStandbyEvents", Qt::QueuedConnection);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Per-file loadfile options that matter for opening the stream and the demuxer. mpv opens the
+// next playlist entry ahead (prefetch-playlist) with the global values of these, not the per-file
+// ones; see setNextItemOptions().
+static const char* const FileOpenOptions[] = {
+  "user-agent", "demuxer", "demuxer-lavf-format", "demuxer-lavf-probe-info"
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Resident memory of this process in KB, or -1 if unknown.
+static qint64 residentMemoryKB()
+{
+#ifdef Q_OS_LINUX
+  QFile status("/proc/self/status");
+  if (!status.open(QIODevice::ReadOnly))
+    return -1;
+  for (QByteArray line = status.readLine(); !line.isEmpty(); line = status.readLine())
+  {
+    if (line.startsWith("VmRSS:"))
+      return line.mid(6).trimmed().split(' ').first().toLongLong();
+  }
+#endif
+  return -1;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Properties observed by PlayerComponent itself. The position in this table has no meaning; each
+// entry gets its own reply_userdata ID when it's registered in componentInitialize().
+const PlayerComponent::ObservedProperty PlayerComponent::ObservedProperties[] = {
+  { "pause",                 MPV_FORMAT_FLAG,   &PlayerComponent::onPauseChanged },
+  { "core-idle",             MPV_FORMAT_FLAG,   &PlayerComponent::onCoreIdleChanged },
+  { "cache-buffering-state", MPV_FORMAT_INT64,  &PlayerComponent::onBufferingStateChanged },
+  { "playback-time",         MPV_FORMAT_DOUBLE, &PlayerComponent::onPlaybackTimeChanged },
+  { "vo-configured",         MPV_FORMAT_FLAG,   &PlayerComponent::onVoConfiguredChanged },
+  { "duration",              MPV_FORMAT_DOUBLE, &PlayerComponent::onDurationChanged },
+  { "audio-device-list",     MPV_FORMAT_NODE,   &PlayerComponent::onAudioDeviceListChanged },
+  { "video-dec-params",      MPV_FORMAT_NODE,   &PlayerComponent::onVideoDecParamsChanged },
+  { "track-list",            MPV_FORMAT_NODE,   &PlayerComponent::onTrackListChanged },
+};
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 PlayerComponent::PlayerComponent(QObject* parent)
   : ComponentBase(parent), m_state(State::finished), m_paused(false), m_playbackActive(false),
@@ -50,12 +101,21 @@ PlayerComponent::PlayerComponent(QObject* parent)
   m_lastPositionUpdate(0.0), m_playbackAudioDelay(0),
   m_window(nullptr), m_mediaFrameRate(0),
   m_restoreDisplayTimer(this), m_reloadAudioTimer(this),
-  m_streamSwitchImminent(false), m_doAc3Transcoding(false),
-  m_videoRectangle(-1, -1, -1, -1)
+  m_streamSwitchImminent(false), m_doAc3Transcoding(false), m_tlsVerify(false),
+  m_videoRectangle(-1, -1, -1, -1), m_eventThread(nullptr),
+  m_scrubbing(false), m_scrubTarget(0), m_scrubEndTimer(this),
+  m_seekPending(false), m_seekInFlight(false), m_seekWatchdog(this),
+  m_useEventThread(false), m_standbyState(StandbyIdle), m_standbyTimer(this),
+  m_nextQueueReplyId(QueueReplyId), m_duration(0), m_network(nullptr), m_probeHit(false)
 {
   qmlRegisterType<PlayerQuickItem>("Konvergo", 1, 0, "MpvVideo"); // deprecated name
   qmlRegisterType<PlayerQuickItem>("Konvergo", 1, 0, "KonvergoVideo");
 
+  connect(&m_thumbnails, &PlayerThumbnails::thumbnailReady, this, [=](qint64 ms) { emit thumbnailReady(ms); });
+  connect(&m_quality, &QualityGovernor::stepApplied, this, &PlayerComponent::qualityReduced);
+  connect(&m_quality, &QualityGovernor::lowerBitrateRequested, this, &PlayerComponent::lowerBitrateRequested);
+  connect(&m_bandwidth, &BandwidthEstimator::estimateChanged, this, &PlayerComponent::bandwidthEstimateChanged);
+
   m_restoreDisplayTimer.setSingleShot(true);
   connect(&m_restoreDisplayTimer, &QTimer::timeout, this, &PlayerComponent::onRestoreDisplay);
 
@@ -63,6 +123,19 @@ PlayerComponent::PlayerComponent(QObject* parent)
 
   m_reloadAudioTimer.setSingleShot(true);
   connect(&m_reloadAudioTimer, &QTimer::timeout, this, &PlayerComponent::updateAudioDevice);
+
+  // Scrubbing ends by itself once the scrub requests (e.g. from key autorepeat) stop.
+  m_scrubEndTimer.setSingleShot(true);
+  m_scrubEndTimer.setInterval(500);
+  connect(&m_scrubEndTimer, &QTimer::timeout, this, &PlayerComponent::endScrub);
+
+  // Don't hold back further seeks forever if a seek never shows up as playback restart.
+  m_seekWatchdog.setSingleShot(true);
+  m_seekWatchdog.setInterval(2000);
+  connect(&m_seekWatchdog, &QTimer::timeout, this, &PlayerComponent::finishSeek);
+
+  m_standbyTimer.setInterval(100);
+  connect(&m_standbyTimer, &QTimer::timeout, this, &PlayerComponent::onStandbyTimer);
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////
@@ -74,63 +147,70 @@ void PlayerComponent::componentPostInitialize()
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 PlayerComponent::~PlayerComponent()
 {
+  if (m_eventThread)
+    m_eventThread->stop();
   if (m_mpv)
     mpv_set_wakeup_callback(m_mpv, nullptr, nullptr);
+  if (m_standby)
+    mpv_set_wakeup_callback(m_standby, nullptr, nullptr);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-bool PlayerComponent::componentInitialize()
+mpv::qt::Handle PlayerComponent::createMpv()
 {
-  m_mpv = mpv::qt::Handle::FromRawHandle(mpv_create());
-  if (!m_mpv)
+  mpv::qt::Handle mpv = mpv::qt::Handle::FromRawHandle(mpv_create());
+  if (!mpv)
     throw FatalException(tr("Failed to load mpv."));
 
-  mpv_request_log_messages(m_mpv, "terminal-default");
-  mpv::qt::set_property(m_mpv, "msg-level", "all=v");
+  mpv_request_log_messages(mpv, "terminal-default");
+  mpv::qt::set_property(mpv, "msg-level", "all=v");
 
   // Configuration properties defined in the mpv.conf will override our
   // hardcoded properties below.
-  mpv::qt::set_property(m_mpv, "config", "yes");
-  mpv::qt::set_property(m_mpv, "config-dir", Paths::dataDir());
-
-  mpv_set_wakeup_callback(m_mpv, wakeup_cb, this);
+  mpv::qt::set_property(mpv, "config", "yes");
+  mpv::qt::set_property(mpv, "config-dir", Paths::dataDir());
 
   // Disable native OSD if mpv_command_string() is used.
-  mpv::qt::set_property(m_mpv, "osd-level", "0");
+  mpv::qt::set_property(mpv, "osd-level", "0");
 
   // This forces the player not to rebase playback time to 0 with mkv. We
   // require this, because mkv transcoding lets files start at times other
   // than 0, and web-client expects that we return these times unchanged.
-  mpv::qt::set_property(m_mpv, "demuxer-mkv-probe-start-time", false);
+  mpv::qt::set_property(mpv, "demuxer-mkv-probe-start-time", false);
 
   // Upstream mpv sets this to "auto", which disables probing for HLS (at least),
   // in order to speed up playback start. The situation is more complex in PMP
   // due to us wanting to use system codecs, so always enable this.
-  mpv::qt::set_property(m_mpv, "demuxer-lavf-probe-info", true);
+  mpv::qt::set_property(mpv, "demuxer-lavf-probe-info", true);
 
   // Just discard audio output if no audio device could be opened. This gives
   // us better flexibility how to react to such errors (instead of just
   // aborting playback immediately).
-  mpv::qt::set_property(m_mpv, "audio-fallback-to-null", "yes");
+  mpv::qt::set_property(mpv, "audio-fallback-to-null", "yes");
 
   // Do not let the decoder downmix (better customization for us).
-  mpv::qt::set_property(m_mpv, "ad-lavc-downmix", false);
+  mpv::qt::set_property(mpv, "ad-lavc-downmix", false);
 
   // Make it load the hwdec interop, so hwdec can be enabled at runtime.
-  mpv::qt::set_property(m_mpv, "hwdec-preload", "auto");
+  mpv::qt::set_property(mpv, "hwdec-preload", "auto");
 
   // User-visible application name used by some audio APIs (at least PulseAudio).
-  mpv::qt::set_property(m_mpv, "audio-client-name", QCoreApplication::applicationName());
+  mpv::qt::set_property(mpv, "audio-client-name", QCoreApplication::applicationName());
 
   // User-visible stream title used by some audio APIs (at least PulseAudio and wasapi).
-  mpv::qt::set_property(m_mpv, "title", QCoreApplication::applicationName());
+  mpv::qt::set_property(mpv, "title", QCoreApplication::applicationName());
 
   // See: https://github.com/plexinc/plex-media-player/issues/736
-  mpv::qt::set_property(m_mpv, "cache-seek-min", 5000);
+  mpv::qt::set_property(mpv, "cache-seek-min", 5000);
+
+  // Open and demux the next playlist entry while the current one is ending. The parts mpv can't
+  // do by itself are done by prefetchNext(), and setNextItemOptions() gives it the options the
+  // entry is loaded with.
+  mpv::qt::set_property(mpv, "prefetch-playlist", true);
 
   if (SettingsComponent::Get().ignoreSSLErrors()) {
-    mpv::qt::set_property(m_mpv, "tls-ca-file", "");
-    mpv::qt::set_property(m_mpv, "tls-verify", "no");
+    mpv::qt::set_property(mpv, "tls-ca-file", "");
+    mpv::qt::set_property(mpv, "tls-verify", "no");
   } else {
 #if !defined(Q_OS_WIN) && !defined(Q_OS_MAC)
     QList<QByteArray> list;
@@ -148,8 +228,8 @@ bool PlayerComponent::componentInitialize()
     for (auto path : list)
     {
       if (access(path.data(), R_OK) == 0) {
-        mpv::qt::set_property(m_mpv, "tls-ca-file", path.data());
-        mpv::qt::set_property(m_mpv, "tls-verify", "yes");
+        mpv::qt::set_property(mpv, "tls-ca-file", path.data());
+        mpv::qt::set_property(mpv, "tls-verify", "yes");
         success = true;
         break;
       }
@@ -159,52 +239,69 @@ bool PlayerComponent::componentInitialize()
       throw FatalException(tr("Failed to locate CA bundle."));
 #else
     // We need to not use Shinchiro's personal CA file...
-    mpv::qt::set_property(m_mpv, "tls-ca-file", "");
+    mpv::qt::set_property(mpv, "tls-ca-file", "");
 #endif
   }
 
   // Apply some low-memory settings on RPI, which is relatively memory-constrained.
 #ifdef TARGET_RPI
   // The backbuffer makes seeking back faster (without having to do a HTTP-level seek)
-  mpv::qt::set_property(m_mpv, "cache-backbuffer", 10 * 1024); // KB
+  mpv::qt::set_property(mpv, "cache-backbuffer", 10 * 1024); // KB
   // The demuxer queue is used for the readahead, and also for dealing with badly
   // interlaved audio/video. Setting it too low increases sensitivity to network
   // issues, and could cause playback failure with "bad" files.
-  mpv::qt::set_property(m_mpv, "demuxer-max-bytes", 50 * 1024 * 1024); // bytes
+  mpv::qt::set_property(mpv, "demuxer-max-bytes", 50 * 1024 * 1024); // bytes
   // Specifically for enabling mpeg4.
-  mpv::qt::set_property(m_mpv, "hwdec-codecs", "all");
+  mpv::qt::set_property(mpv, "hwdec-codecs", "all");
   // Do not use exact seeks by default. (This affects the start position in the "loadfile"
   // command in particular. We override the seek mode for normal "seek" commands.)
-  mpv::qt::set_property(m_mpv, "hr-seek", "no");
+  mpv::qt::set_property(mpv, "hr-seek", "no");
   // Force vo_rpi to fullscreen.
-  mpv::qt::set_property(m_mpv, "fullscreen", true);
+  mpv::qt::set_property(mpv, "fullscreen", true);
 #endif
 
-  if (mpv_initialize(m_mpv) < 0)
+  if (mpv_initialize(mpv) < 0)
     throw FatalException(tr("Failed to initialize mpv."));
 
-  mpv_observe_property(m_mpv, 0, "pause", MPV_FORMAT_FLAG);
-  mpv_observe_property(m_mpv, 0, "core-idle", MPV_FORMAT_FLAG);
-  mpv_observe_property(m_mpv, 0, "cache-buffering-state", MPV_FORMAT_INT64);
-  mpv_observe_property(m_mpv, 0, "playback-time", MPV_FORMAT_DOUBLE);
-  mpv_observe_property(m_mpv, 0, "vo-configured", MPV_FORMAT_FLAG);
-  mpv_observe_property(m_mpv, 0, "duration", MPV_FORMAT_DOUBLE);
-  mpv_observe_property(m_mpv, 0, "audio-device-list", MPV_FORMAT_NODE);
-  mpv_observe_property(m_mpv, 0, "video-dec-params", MPV_FORMAT_NODE);
-
   // Setup a hook with the ID 1, which is run during the file is loaded.
   // Used to delay playback start for display framerate switching.
   // (See handler in handleMpvEvent() for details.)
   // Setup a hook with the ID 2, which is run at a certain stage during loading.
   // We use it to initialize stream selections and to probe the codecs.
 #if MPV_CLIENT_API_VERSION < MPV_MAKE_VERSION(1, 100)
-  mpv::qt::command(m_mpv, QStringList() << "hook-add" << "on_load" << "1" << "0");
-  mpv::qt::command(m_mpv, QStringList() << "hook-add" << "on_preloaded" << "2" << "0");
+  mpv::qt::command(mpv, QStringList() << "hook-add" << "on_load" << "1" << "0");
+  mpv::qt::command(mpv, QStringList() << "hook-add" << "on_preloaded" << "2" << "0");
 #else
-  mpv_hook_add(m_mpv, 1, "on_load", 0);
-  mpv_hook_add(m_mpv, 2, "on_preloaded", 0);
+  mpv_hook_add(mpv, 1, "on_load", 0);
+  mpv_hook_add(mpv, 2, "on_preloaded", 0);
 #endif
 
+  return mpv;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool PlayerComponent::componentInitialize()
+{
+  m_mpv = createMpv();
+  for (const char* name : FileOpenOptions)
+    m_defaultOpenOptions.insert(name, mpv::qt::get_property(m_mpv, name));
+  m_tlsCaFile = mpv::qt::get_property(m_mpv, "tls-ca-file").toString();
+  m_tlsVerify = mpv::qt::get_property(m_mpv, "tls-verify").toBool();
+  m_readahead.setPlayer(m_mpv);
+  m_quality.setPlayer(m_mpv);
+  m_bandwidth.setPlayer(m_mpv);
+
+  // In event thread mode, the thread blocks in mpv_wait_event() instead.
+  m_useEventThread = SettingsComponent::Get().value(SETTINGS_SECTION_VIDEO, "debug.event_thread").toBool();
+  if (!m_useEventThread)
+    mpv_set_wakeup_callback(m_mpv, wakeup_cb, this);
+
+  for (const ObservedProperty& prop : ObservedProperties)
+  {
+    auto handler = prop.handler;
+    observeProperty(prop.name, prop.format, [=](void* data) { (this->*handler)(data); });
+  }
+
   updateAudioDeviceList();
   setAudioConfiguration();
   updateSubtitleSettings();
@@ -236,8 +333,18 @@ bool PlayerComponent::componentInitialize()
   }
   QLOG_INFO() << "Present codecs:" << qPrintable(codecInfo);
 
-  connect(this, &PlayerComponent::onMpvEvents, this, &PlayerComponent::handleMpvEvents, Qt::QueuedConnection);
-  emit onMpvEvents();
+  if (m_useEventThread)
+  {
+    QLOG_INFO() << "Handling player events on a separate thread.";
+    m_eventThread = new PlayerEventThread(m_mpv, this);
+    connect(m_eventThread, &PlayerEventThread::eventsPending, this, &PlayerComponent::handleQueuedEvents, Qt::QueuedConnection);
+    m_eventThread->start();
+  }
+  else
+  {
+    connect(this, &PlayerComponent::onMpvEvents, this, &PlayerComponent::handleMpvEvents, Qt::QueuedConnection);
+    emit onMpvEvents();
+  }
 
   return true;
 }
@@ -284,33 +391,130 @@ void PlayerComponent::setWindow(QQuickWindow* window)
   mpv::qt::set_property(m_mpv, "vo", vo);
 
   if (vo == "libmpv")
+  {
+    // Needs a render context of its own, so it must exist before the video item is set up.
+    if (SettingsComponent::Get().value(SETTINGS_SECTION_VIDEO, "standby_player").toBool())
+      createStandby();
     setQtQuickWindow(window);
+  }
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 bool PlayerComponent::load(const QString& url, const QVariantMap& options, const QVariantMap &metadata, const QString& audioStream , const QString& subtitleStream)
 {
-  stop();
+  if (m_standby && (m_standbyState != StandbyIdle || (m_streamSwitchImminent && m_inPlayback)) &&
+      loadStandby(url, options, metadata, audioStream, subtitleStream))
+    return true;
+
+  stopPlayback();
+  m_startupStats.begin();
   queueMedia(url, options, metadata, audioStream, subtitleStream);
   return true;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 void PlayerComponent::queueMedia(const QString& url, const QVariantMap& options, const QVariantMap &metadata, const QString& audioStream, const QString& subtitleStream)
+{
+  beginQueueing();
+
+  QVariant res = mpv::qt::command(m_mpv, queueCommand(url, options, metadata, audioStream, subtitleStream));
+  if (mpv::qt::is_error(res))
+  {
+    // There won't be a START_FILE for it.
+    QLOG_ERROR() << "Could not queue" << url << ":" << mpv_error_string(mpv::qt::get_error(res));
+    m_proxy.release(m_queue.takeLast().proxyUrl);
+    return;
+  }
+  m_queue.last().entryId = res.toMap().value("playlist_entry_id").toLongLong();
+
+  setNextItemOptions();
+  emit onMetaData(metadata["metadata"].toMap(), QUrl(url).adjusted(QUrl::RemovePath | QUrl::RemoveQuery));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlayerComponent::queueMediaBatch(const QVariantList& items)
+{
+  if (items.isEmpty())
+    return;
+
+  beginQueueing();
+
+  QElapsedTimer timer;
+  timer.start();
+
+  QVariantMap first;
+  for (const QVariant& entry : items)
+  {
+    QVariantMap item = entry.toMap();
+    QString url = item["url"].toString();
+    if (url.isEmpty())
+    {
+      QLOG_WARN() << "Ignoring queued item without url.";
+      continue;
+    }
+
+    QVariantMap streams = item["streams"].toMap();
+    QVariantList command = queueCommand(url, item["options"].toMap(), item["metadata"].toMap(),
+                                        streams["audio"].toString(), streams["subtitle"].toString());
+
+    // mpv runs asynchronous commands in order, so the playlist ends up in the same order as
+    // m_queue. Each item gets its own reply ID, so that it can be dropped if its loadfile fails.
+    quint64 replyId = m_nextQueueReplyId++;
+    m_queue.last().replyId = replyId;
+    int err = mpv::qt::command_async(m_mpv, replyId, command);
+    if (err < 0)
+    {
+      QLOG_ERROR() << "Could not queue" << url << ":" << mpv_error_string(err);
+      m_proxy.release(m_queue.takeLast().proxyUrl);
+      continue;
+    }
+
+    if (first.isEmpty())
+      first = item;
+  }
+
+  QLOG_INFO() << "Queued" << items.size() << "items in" << timer.elapsed() << "ms";
+  setNextItemOptions();
+
+  // Only the first item can be the one starting to play now.
+  if (!first.isEmpty())
+    emit onMetaData(first["metadata"].toMap()["metadata"].toMap(),
+                    QUrl(first["url"].toString()).adjusted(QUrl::RemovePath | QUrl::RemoveQuery));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlayerComponent::beginQueueing()
 {
   InputComponent::Get().cancelAutoRepeat();
 
-  m_mediaFrameRate = metadata["frameRate"].toFloat(); // returns 0 on failure
-  m_serverMediaInfo = metadata["media"].toMap();
+  // If something is playing, the item is only appended, and is timed from its START_FILE.
+  if (!m_inPlayback && !m_startupStats.isActive())
+    m_startupStats.begin();
+  m_startupStats.mark(StartupStats::Queued);
 
   updateVideoSettings();
+}
 
-  QUrl qurl = url;
-  QString host = qurl.host();
+///////////////////////////////////////////////////////////////////////////////////////////////////
+QVariantList PlayerComponent::queueCommand(const QString& url, const QVariantMap& options, const QVariantMap& metadata, const QString& audioStream, const QString& subtitleStream)
+{
+  QueuedItem item;
+  // if nothing is playing, play it now, otherwise just enqueue it
+  QVariantList command = loadCommand(url, "append-play", options, metadata, audioStream, subtitleStream, &item);
+  m_queue.append(item);
+  return command;
+}
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+QVariantList PlayerComponent::loadCommand(const QString& url, const QString& mode, const QVariantMap& options, const QVariantMap& metadata, const QString& audioStream, const QString& subtitleStream, QueuedItem* item)
+{
+  // Remote files are read through the caching proxy, if it's enabled.
+  QString loadUrl = m_proxy.rewrite(url);
+  QUrl qurl = loadUrl;
+
+  QString loadPath = qurl.toString(QUrl::FullyEncoded);
   QVariantList command;
-  command << "loadfile" << qurl.toString(QUrl::FullyEncoded);
-  command << "append-play"; // if nothing is playing, play it now, otherwise just enqueue it
+  command << "loadfile" << loadPath << mode;
 
   QVariantMap extraArgs;
 
@@ -322,8 +526,25 @@ void PlayerComponent::queueMedia(const QString& url, const QVariantMap& options,
   extraArgs.insert("aid", "no");
   extraArgs.insert("sid", "no");
 
-  m_currentSubtitleStream = subtitleStream;
-  m_currentAudioStream = audioStream;
+  *item = {url, metadata, audioStream, subtitleStream, thumbnailSource(url, metadata), false,
+           QString(), false, loadUrl != url ? loadUrl : QString(), 0};
+  item->loadUrl = loadPath;
+
+  // With the results of an earlier play, the container doesn't need to be detected again, and
+  // probing the streams can be skipped if it found everything. Codecs are determined from the
+  // cached streams (see getPlaybackInfo()).
+  if (SettingsComponent::Get().value(SETTINGS_SECTION_VIDEO, "probe_cache").toBool())
+    item->probeKey = ProbeCache::key(metadata, url);
+  ProbeInfo probe = m_probeCache.find(item->probeKey);
+  item->probeHit = probe.isValid();
+  if (probe.demuxer == "lavf" && !probe.format.isEmpty())
+  {
+    // lavf reports all names of the format, but only takes one.
+    extraArgs.insert("demuxer", "lavf");
+    extraArgs.insert("demuxer-lavf-format", probe.format.section(",", 0, 0));
+    if (probe.complete)
+      extraArgs.insert("demuxer-lavf-probe-info", "nostreams");
+  }
 
   if (metadata["type"] == "music")
     extraArgs.insert("vid", "no");
@@ -334,15 +555,38 @@ void PlayerComponent::queueMedia(const QString& url, const QVariantMap& options,
   if (userAgent.size())
     extraArgs.insert("user-agent", userAgent);
 
+  for (const char* name : FileOpenOptions)
+  {
+    if (extraArgs.contains(name))
+      item->openOptions.insert(name, extraArgs[name]);
+  }
+
   // Make sure the list of requested codecs is reset.
   extraArgs.insert("ad", "");
   extraArgs.insert("vd", "");
 
   command << extraArgs;
+  return command;
+}
 
-  mpv::qt::command(m_mpv, command);
-
-  emit onMetaData(metadata["metadata"].toMap(), qurl.adjusted(QUrl::RemovePath | QUrl::RemoveQuery));
+///////////////////////////////////////////////////////////////////////////////////////////////////
+ThumbnailSource PlayerComponent::thumbnailSource(const QString& url, const QVariantMap& metadata)
+{
+  ThumbnailSource thumbs;
+  if (metadata["type"] == "music")
+    return thumbs;
+
+  thumbs.url = QUrl(url).toString(QUrl::FullyEncoded);
+  QString itemId = metadata["metadata"].toMap()["Id"].toString();
+  if (!itemId.isEmpty() && SettingsComponent::Get().value(SETTINGS_SECTION_VIDEO, "thumbnails.disk_cache").toBool())
+    thumbs.itemKey = itemId + "/" + metadata["media"].toMap()["id"].toString();
+  thumbs.userAgent = metadata["headers"].toMap()["User-Agent"].toString();
+  thumbs.tlsCaFile = m_tlsCaFile;
+  thumbs.tlsVerify = m_tlsVerify;
+  thumbs.interval = qMax(1, SettingsComponent::Get().value(SETTINGS_SECTION_VIDEO, "thumbnails.interval").toInt()) * 1000;
+  thumbs.width = qBound(64, SettingsComponent::Get().value(SETTINGS_SECTION_VIDEO, "thumbnails.width").toInt(), 1920);
+  thumbs.cacheSize = qMax(1, SettingsComponent::Get().value(SETTINGS_SECTION_VIDEO, "thumbnails.cache_size").toInt()) * 1024 * 1024;
+  return thumbs;
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////
@@ -447,14 +691,21 @@ void PlayerComponent::updatePlaybackState()
     switch (newState) {
     case State::paused:
       QLOG_INFO() << "Entering state: paused";
+      // Loads without autoplay end up here; they're done loading too.
+      finishStartupStats();
       emit paused();
       break;
     case State::playing:
       QLOG_INFO() << "Entering state: playing";
+      m_startupStats.mark(StartupStats::Playing);
+      finishStartupStats();
       emit playing();
       break;
     case State::buffering:
       QLOG_INFO() << "Entering state: buffering";
+      // Running out of data, as opposed to waiting for a seek.
+      if (m_state == State::playing && !m_seekInFlight && !m_scrubbing)
+        m_bandwidth.rebuffered();
       m_lastBufferingPercentage = -1; /* force update below */
       break;
     case State::finished:
@@ -484,10 +735,383 @@ void PlayerComponent::updatePlaybackState()
   if (m_videoPlaybackActive != is_videoPlaybackActive)
   {
     m_videoPlaybackActive = is_videoPlaybackActive;
+    m_quality.setActive(m_videoPlaybackActive);
     emit videoPlaybackActive(m_videoPlaybackActive);
   }
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlayerComponent::finishStartupStats()
+{
+  if (!m_startupStats.isActive())
+    return;
+  m_startupStats.finish();
+  QLOG_INFO() << "Startup times:" << qPrintable(m_startupStats.lastLoadSummary());
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+QVariantMap PlayerComponent::getStartupStats()
+{
+  return m_startupStats.toVariant();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+QVariantMap PlayerComponent::getQualityState()
+{
+  return m_quality.state();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+QVariantMap PlayerComponent::getBandwidthEstimate(const QString& host)
+{
+  return m_bandwidth.estimate(host);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+QVariantMap PlayerComponent::getProxyStats()
+{
+  return m_proxy.stats();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+QVariantMap PlayerComponent::getRenderStats()
+{
+  PlayerQuickItem* video = m_window ? m_window->findChild<PlayerQuickItem*>("video") : nullptr;
+  return video ? video->renderStats() : QVariantMap();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+QString PlayerComponent::getThumbnail(qint64 ms)
+{
+  QByteArray jpeg = m_thumbnails.thumbnail(ms);
+  if (jpeg.isEmpty())
+    return QString();
+  return "data:image/jpeg;base64," + QString::fromLatin1(jpeg.toBase64());
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+qint64 PlayerComponent::getThumbnailInterval()
+{
+  return m_thumbnails.interval();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlayerComponent::handleStartFile(qint64 entryId, const QString& path)
+{
+  m_inPlayback = true;
+  m_tracks.invalidate();
+
+  // Items appended to the playlist, and any file after a load that never reached playback, are
+  // timed from here.
+  if (!m_startupStats.isActive() || m_startupStats.reached(StartupStats::StartFile))
+    m_startupStats.begin();
+  m_startupStats.mark(StartupStats::StartFile);
+
+  // Files start in the order they were queued, but after a stop() and load(), the START_FILE of
+  // the replaced file can still arrive, and mustn't take the new item. Entry IDs tell them apart;
+  // with an older libmpv, only the path can, which a reload of the same URL defeats. Items before
+  // the one found never started.
+  int index = -1;
+  for (int n = 0; n < m_queue.size() && index < 0; n++)
+  {
+    const QueuedItem& item = m_queue[n];
+    if ((entryId && item.entryId) ? item.entryId == entryId : item.loadUrl == path)
+      index = n;
+  }
+  for (int n = 0; n < index; n++)
+    m_proxy.release(m_queue.takeFirst().proxyUrl);
+
+  if (index >= 0)
+  {
+    QueuedItem item = m_queue.takeFirst();
+    m_mediaFrameRate = item.metadata["frameRate"].toFloat(); // returns 0 on failure
+    m_serverMediaInfo.parse(item.metadata["media"].toMap());
+    m_currentSubtitleStream = item.subtitleStream;
+    m_currentAudioStream = item.audioStream;
+    m_currentExternalUrls = QStringList() << externalStreamUrl(item.subtitleStream) << externalStreamUrl(item.audioStream);
+    m_thumbnails.setSource(item.thumbnails);
+    m_probeKey = item.probeKey;
+    m_probeHit = item.probeHit;
+    m_currentProxyUrl = item.proxyUrl;
+    m_readahead.start(item.metadata["media"].toMap()["bitrate"].toLongLong());
+    // Reads from the proxy's cache would pass for a very fast network.
+    m_bandwidth.start(item.proxyUrl.isEmpty() ? QUrl(item.url).host() : QString());
+  }
+  else
+  {
+    m_probeKey.clear();
+    m_probeHit = false;
+    m_readahead.start(0);
+    m_bandwidth.start(QString());
+  }
+  m_probeInfo = m_probeCache.find(m_probeKey);
+  if (!m_probeKey.isEmpty())
+    m_startupStats.setProbeCacheHit(m_probeHit);
+  setNextItemOptions();
+  m_duration = 0;
+
+  if (m_quality.reset())
+    updateVideoSettings();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlayerComponent::handleEndFile(int reason, int error)
+{
+  m_inPlayback = false;
+  m_playbackCanceled = false;
+  m_playbackError = "";
+
+  switch (reason)
+  {
+    case MPV_END_FILE_REASON_ERROR:
+    {
+      m_playbackError = mpv_error_string(error);
+      // The demuxer options from the cache could be the reason, so probe normally next time.
+      if (m_probeHit)
+        m_probeCache.remove(m_probeKey);
+      break;
+    }
+    case MPV_END_FILE_REASON_STOP:
+    {
+      m_playbackCanceled = true;
+      break;
+    }
+  }
+
+  // A stream switch reloads the same item, so its thumbnails and prefetched files stay valid.
+  if (!m_streamSwitchImminent)
+  {
+    m_restoreDisplayTimer.start(0);
+    m_thumbnails.clear();
+    releasePrefetchedFiles(m_currentExternalUrls);
+    m_currentExternalUrls.clear();
+  }
+  m_streamSwitchImminent = false;
+
+  // A reload of the same item has a route of its own.
+  m_proxy.release(m_currentProxyUrl);
+  m_currentProxyUrl.clear();
+
+  m_readahead.stop();
+  m_bandwidth.stop();
+  resetSeekState();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlayerComponent::resetSeekState()
+{
+  // Seeks don't carry over to the next file.
+  m_scrubbing = false;
+  m_scrubEndTimer.stop();
+  m_seekPending = false;
+  m_seekInFlight = false;
+  m_seekWatchdog.stop();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+quint64 PlayerComponent::observeProperty(const char* name, mpv_format format, const PropertyHandler& handler)
+{
+  if (!m_mpv)
+    return 0;
+
+  // IDs start at 1, so that 0 (used by mpv for unobserved properties) never matches.
+  PropertyObserver observer = { QByteArray(name), format, handler };
+  m_propertyObservers.append(observer);
+  quint64 id = (quint64)m_propertyObservers.size();
+
+  if (mpv_observe_property(m_mpv, id, name, format) < 0)
+    QLOG_ERROR() << "Could not observe property" << name;
+
+  return id;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlayerComponent::dispatchPropertyChange(quint64 id, mpv_format format, void* data)
+{
+  if (id < 1 || id > (quint64)m_propertyObservers.size())
+    return;
+
+  // Node values are only change notifications (see observeProperty()).
+  if (format == MPV_FORMAT_NONE || format == MPV_FORMAT_NODE)
+    data = nullptr;
+
+  m_propertyObservers[(int)(id - 1)].handler(data);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlayerComponent::onPauseChanged(void* data)
+{
+  if (data)
+    m_paused = !!*(int *)data;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlayerComponent::onCoreIdleChanged(void* data)
+{
+  if (data)
+    m_playbackActive = !*(int *)data;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlayerComponent::onBufferingStateChanged(void* data)
+{
+  m_bufferingPercentage = data ? (int)*(int64_t *)data : 100;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlayerComponent::onPlaybackTimeChanged(void* data)
+{
+  if (!data)
+    return;
+
+  double pos = *(double*)data;
+  if (fabs(pos - m_lastPositionUpdate) > 0.015)
+  {
+    quint64 ms = (quint64)(qMax(pos * 1000.0, 0.0));
+    emit positionUpdate(ms);
+    m_lastPositionUpdate = pos;
+  }
+
+  if (m_duration > 0 && m_duration - pos < PrefetchBeforeEndSecs)
+    prefetchNext();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlayerComponent::onVoConfiguredChanged(void* data)
+{
+  m_windowVisible = data ? !!*(int *)data : false;
+  if (m_windowVisible)
+    m_startupStats.mark(StartupStats::VoConfigured);
+  emit windowVisible(m_windowVisible);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlayerComponent::onDurationChanged(void* data)
+{
+  m_duration = data ? *(double *)data : 0;
+  if (data)
+    emit updateDuration(m_duration * 1000.0);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlayerComponent::onAudioDeviceListChanged(void* data)
+{
+  Q_UNUSED(data);
+  updateAudioDeviceList();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlayerComponent::onVideoDecParamsChanged(void* data)
+{
+  Q_UNUSED(data);
+  // Aspect might be known now (or it changed during playback), so update settings
+  // dependent on the aspect ratio.
+  updateVideoAspectSettings(m_mpv);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlayerComponent::onTrackListChanged(void* data)
+{
+  Q_UNUSED(data);
+  // Parsed again on next use.
+  m_tracks.invalidate();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlayerComponent::handleHook(const char* name, const std::function<void()>& done)
+{
+  // The track-list change notification isn't guaranteed to arrive before the hook, and the
+  // hooks are where the track list matters most.
+  m_tracks.invalidate();
+
+  // Start "on_load" hook.
+  // This happens when the player is about to load the file, but no actual loading has taken part yet.
+  // We use this to block loading until we explicitly tell it to continue.
+  if (!strcmp(name, "on_load"))
+  {
+    m_startupStats.mark(StartupStats::OnLoad);
+
+    // Calling this lambda will instruct mpv to continue loading the file.
+    auto resume = [=] {
+      m_startupStats.mark(StartupStats::OnLoadResumed);
+      QLOG_INFO() << "checking codecs";
+      startCodecsLoading([=] {
+        QLOG_INFO() << "resuming loading";
+        done();
+      });
+    };
+    if (switchDisplayFrameRate())
+    {
+      // Now wait for the mode change - this is needed because mode changing can take some time,
+      // during which the screen is black, and initializing hardware decoding could fail due
+      // to various strange OS-related reasons. Resume as soon as the display reports that the
+      // switch is done, but never wait longer than the configured delay, since not every
+      // platform reports it.
+      // (Better hope the user doesn't try to exit Konvergo during mode change.)
+      int pause = SettingsComponent::Get().value(SETTINGS_SECTION_VIDEO, "refreshrate.delay").toInt() * 1000;
+      QLOG_INFO() << "waiting up to" << pause << "msec for rate switch before loading";
+
+      QElapsedTimer waitTime;
+      waitTime.start();
+      auto resumed = QSharedPointer<bool>::create(false);
+      auto switched = QSharedPointer<QMetaObject::Connection>::create();
+      auto resumeOnce = [=](const char* reason) {
+        if (*resumed)
+          return;
+        *resumed = true;
+        disconnect(*switched);
+        QLOG_INFO() << "rate switch" << reason << "after" << waitTime.elapsed() << "msec";
+        resume();
+      };
+      *switched = connect(&DisplayComponent::Get(), &DisplayComponent::videoModeSwitched,
+                          this, [=] { resumeOnce("completed"); });
+      QTimer::singleShot(pause, this, [=]
+      {
+        if (!*resumed)
+          DisplayComponent::Get().cancelVideoModeSwitchWait();
+        resumeOnce("timed out");
+      });
+    }
+    else
+    {
+      resume();
+    }
+    return;
+  }
+  // Start "on_preloaded" hook.
+  // Used initialize stream selections and to probe codecs.
+  if (!strcmp(name, "on_preloaded"))
+  {
+    m_startupStats.mark(StartupStats::OnPreloaded);
+    if (!m_probeKey.isEmpty())
+    {
+      QString demuxer = mpv::qt::get_property(m_mpv, "current-demuxer").toString();
+      QString format = mpv::qt::get_property(m_mpv, "file-format").toString();
+      ProbeInfo probe = ProbeCache::fromTracks(demuxer, format, tracks(), m_serverMediaInfo);
+      // Without full probing some parameters may be missing now, which the cached entry has.
+      if (!m_probeHit || probe.complete || !m_probeInfo.complete)
+        m_probeCache.insert(m_probeKey, probe);
+    }
+    reselectStream(m_currentSubtitleStream, MediaType::Subtitle);
+    reselectStream(m_currentAudioStream, MediaType::Audio);
+    startCodecsLoading(done);
+    return;
+  }
+  // Not our hook, but don't leave the player hanging.
+  done();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Legacy hooks (client API < 1.100) are identified by the IDs we passed to "hook-add".
+static const char* legacyHookName(const char* id)
+{
+  if (!strcmp(id, "1"))
+    return "on_load";
+  if (!strcmp(id, "2"))
+    return "on_preloaded";
+  return "";
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 void PlayerComponent::handleMpvEvent(mpv_event *event)
 {
@@ -495,212 +1119,450 @@ void PlayerComponent::handleMpvEvent(mpv_event *event)
   {
     case MPV_EVENT_START_FILE:
     {
-      m_inPlayback = true;
+      handleStartFile(PlayerEventThread::playlistEntryId(event),
+                      QString::fromUtf8(PlayerEventThread::playingPath(m_mpv)));
       break;
     }
     case MPV_EVENT_END_FILE:
     {
       mpv_event_end_file *endFile = (mpv_event_end_file *)event->data;
-
-      m_inPlayback = false;
-      m_playbackCanceled = false;
-      m_playbackError = "";
-
-      switch (endFile->reason)
-      {
-        case MPV_END_FILE_REASON_ERROR:
-        {
-          m_playbackError = mpv_error_string(endFile->error);
-          break;
-        }
-        case MPV_END_FILE_REASON_STOP:
-        {
-          m_playbackCanceled = true;
-          break;
-        }
-      }
-
-      if (!m_streamSwitchImminent)
-        m_restoreDisplayTimer.start(0);
-      m_streamSwitchImminent = false;
+      handleEndFile(endFile->reason, endFile->error);
       break;
     }
     case MPV_EVENT_PROPERTY_CHANGE:
     {
       mpv_event_property *prop = (mpv_event_property *)event->data;
-      if (strcmp(prop->name, "pause") == 0 && prop->format == MPV_FORMAT_FLAG)
-      {
-        m_paused = !!*(int *)prop->data;
-      }
-      else if (strcmp(prop->name, "core-idle") == 0 && prop->format == MPV_FORMAT_FLAG)
+      dispatchPropertyChange(event->reply_userdata, prop->format, prop->data);
+      break;
+    }
+    case MPV_EVENT_LOG_MESSAGE:
+    {
+      PlayerEventThread::logMessage((mpv_event_log_message *)event->data);
+      break;
+    }
+    case MPV_EVENT_PLAYBACK_RESTART:
+    {
+      handlePlaybackRestart();
+      break;
+    }
+    case MPV_EVENT_COMMAND_REPLY:
+    {
+      handleCommandReply(event->reply_userdata, event->error, PlayerEventThread::playlistEntryId(event));
+      break;
+    }
+    case MPV_EVENT_CLIENT_MESSAGE:
+    {
+      mpv_event_client_message *msg = (mpv_event_client_message *)event->data;
+      if (msg->num_args < 3 || strcmp(msg->args[0], "hook_run") != 0)
+        break;
+      QString resumeId = QString::fromUtf8(msg->args[2]);
+      handleHook(legacyHookName(msg->args[1]), [=] {
+        mpv::qt::command(m_mpv, QStringList() << "hook-ack" << resumeId);
+      });
+      break;
+    }
+#if MPV_CLIENT_API_VERSION >= MPV_MAKE_VERSION(1, 100)
+    case MPV_EVENT_HOOK:
+    {
+      mpv_event_hook *hook = (mpv_event_hook *)event->data;
+      uint64_t id = hook->id;
+      handleHook(hook->name, [=] {
+        mpv_hook_continue(m_mpv, id);
+      });
+      break;
+    }
+#endif
+
+    default:; /* ignore */
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlayerComponent::handleMpvEvents()
+{
+  // Process all events, until the event queue is empty.
+  while (1)
+  {
+    mpv_event *event = mpv_wait_event(m_mpv, 0);
+    if (event->event_id == MPV_EVENT_NONE)
+      break;
+    handleMpvEvent(event);
+  }
+  // Once we got all status updates, determine the new canonical state.
+  updatePlaybackState();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlayerComponent::handleQueuedEvents()
+{
+  if (!m_eventThread)
+    return;
+
+  m_eventThread->beginTakeEvents();
+
+  PlayerEvent event;
+  while (m_eventThread->takeEvent(event))
+  {
+    switch (event.id)
+    {
+      case MPV_EVENT_START_FILE:
       {
-        m_playbackActive = !*(int *)prop->data;
+        handleStartFile(event.playlistEntryId, QString::fromUtf8(event.path));
+        break;
       }
-      else if (strcmp(prop->name, "cache-buffering-state") == 0)
+      case MPV_EVENT_END_FILE:
       {
-        m_bufferingPercentage = prop->format == MPV_FORMAT_INT64 ? (int)*(int64_t *)prop->data : 100;
+        handleEndFile(event.endReason, event.endError);
+        break;
       }
-      else if (strcmp(prop->name, "playback-time") == 0 && prop->format == MPV_FORMAT_DOUBLE)
+      case MPV_EVENT_PROPERTY_CHANGE:
       {
-        double pos = *(double*)prop->data;
-        if (fabs(pos - m_lastPositionUpdate) > 0.015)
-        {
-          quint64 ms = (quint64)(qMax(pos * 1000.0, 0.0));
-          emit positionUpdate(ms);
-          m_lastPositionUpdate = pos;
-        }
+        dispatchPropertyChange(event.replyUserdata, event.format, &event.value);
+        break;
       }
-      else if (strcmp(prop->name, "vo-configured") == 0)
+      case MPV_EVENT_PLAYBACK_RESTART:
       {
-        int state = prop->format == MPV_FORMAT_FLAG ? *(int *)prop->data : 0;
-        m_windowVisible = state;
-        emit windowVisible(m_windowVisible);
+        handlePlaybackRestart();
+        break;
       }
-      else if (strcmp(prop->name, "duration") == 0)
+      case MPV_EVENT_COMMAND_REPLY:
       {
-        if (prop->format == MPV_FORMAT_DOUBLE)
-          emit updateDuration(*(double *)prop->data * 1000.0);
+        handleCommandReply(event.replyUserdata, event.error, event.playlistEntryId);
+        break;
       }
-      else if (strcmp(prop->name, "audio-device-list") == 0)
+      case MPV_EVENT_CLIENT_MESSAGE:
       {
-        updateAudioDeviceList();
+        QString resumeId = QString::fromUtf8(event.resumeId);
+        handleHook(legacyHookName(event.name.constData()), [=] {
+          mpv::qt::command(m_mpv, QStringList() << "hook-ack" << resumeId);
+        });
+        break;
       }
-      else if (strcmp(prop->name, "video-dec-params") == 0)
+#if MPV_CLIENT_API_VERSION >= MPV_MAKE_VERSION(1, 100)
+      case MPV_EVENT_HOOK:
       {
-        // Aspect might be known now (or it changed during playback), so update settings
-        // dependent on the aspect ratio.
-        updateVideoAspectSettings();
+        uint64_t id = event.hookId;
+        handleHook(event.name.constData(), [=] {
+          mpv_hook_continue(m_mpv, id);
+        });
+        break;
       }
-      break;
+#endif
+      default:; /* ignore */
     }
-    case MPV_EVENT_LOG_MESSAGE:
-    {
-      mpv_event_log_message *msg = (mpv_event_log_message *)event->data;
-      // Strip the trailing '\n'
-      size_t len = strlen(msg->text);
-      if (len > 0 && msg->text[len - 1] == '\n')
-        len -= 1;
-      QString logline = QString::fromUtf8(msg->prefix) + ": " + QString::fromUtf8(msg->text, (int)len);
-      if (msg->log_level >= MPV_LOG_LEVEL_V)
-        QLOG_DEBUG() << qPrintable(logline);
-      else if (msg->log_level >= MPV_LOG_LEVEL_INFO)
-        QLOG_INFO() << qPrintable(logline);
-      else if (msg->log_level >= MPV_LOG_LEVEL_WARN)
-        QLOG_WARN() << qPrintable(logline);
-      else
-        QLOG_ERROR() << qPrintable(logline);
+  }
+
+  updatePlaybackState();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlayerComponent::createStandby()
+{
+  qint64 before = residentMemoryKB();
+  m_standby = createMpv();
+  mpv::qt::set_property(m_standby, "vo", "libmpv");
+  qint64 after = residentMemoryKB();
+  if (before >= 0 && after >= 0)
+    m_standbyStats.memoryKB = after - before;
+
+  mpv_set_wakeup_callback(m_standby, standby_wakeup_cb, this);
+  QLOG_INFO() << "Standby player created, using" << m_standbyStats.memoryKB << "KB.";
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool PlayerComponent::loadStandby(const QString& url, const QVariantMap& options, const QVariantMap& metadata, const QString& audioStream, const QString& subtitleStream)
+{
+  // Music has nothing to show while switching.
+  if (metadata["type"] == "music")
+    return false;
+
+  if (m_standbyState == StandbyIdle)
+    m_standbySwitchTime.start();
+  else if (m_standbyState != StandbyWaitingForLoad)
+    QLOG_INFO() << "Replacing the stream being loaded by the standby player.";
+
+  // Get hwdec, cache and audio output right before anything is opened.
+  applyVideoSettings(m_standby);
+  applyAudioConfiguration(m_standby);
+  applySubtitleSettings(m_standby);
+
+  // Hold the first frame until it's swapped in.
+  QVariantMap standbyOptions = options;
+  standbyOptions.insert("autoplay", false);
+  QueuedItem item;
+  QVariantList command = loadCommand(url, "replace", standbyOptions, metadata, audioStream, subtitleStream, &item);
+  m_proxy.release(m_standbyLoad.proxyUrl);
+  m_standbyLoad = {url, options, metadata, audioStream, subtitleStream, item.probeKey, item.probeHit, item.proxyUrl};
+
+  if (mpv::qt::get_error(mpv::qt::command(m_standby, command)) < 0)
+  {
+    m_proxy.release(m_standbyLoad.proxyUrl);
+    m_standbyLoad.proxyUrl.clear();
+    m_standbyState = StandbyIdle;
+    m_standbyTimer.stop();
+    return false;
+  }
+
+  m_standbyState = StandbyLoading;
+  m_standbyTimer.start();
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlayerComponent::handleStandbyEvents()
+{
+  while (m_standby)
+  {
+    mpv_event* event = mpv_wait_event(m_standby, 0);
+    if (event->event_id == MPV_EVENT_NONE)
       break;
-    }
-    case MPV_EVENT_CLIENT_MESSAGE:
+
+    switch (event->event_id)
     {
-      mpv_event_client_message *msg = (mpv_event_client_message *)event->data;
-      if (msg->num_args < 3 || strcmp(msg->args[0], "hook_run") != 0)
+      case MPV_EVENT_LOG_MESSAGE:
+      {
+        PlayerEventThread::logMessage((mpv_event_log_message *)event->data);
         break;
-      QString resumeId = QString::fromUtf8(msg->args[2]);
-      // Start "on_load" hook.
-      // This happens when the player is about to load the file, but no actual loading has taken part yet.
-      // We use this to block loading until we explicitly tell it to continue.
-      if (!strcmp(msg->args[1], "1"))
+      }
+      case MPV_EVENT_PLAYBACK_RESTART:
       {
-        // Calling this lambda will instruct mpv to continue loading the file.
-        auto resume = [=] {
-          QLOG_INFO() << "checking codecs";
-          startCodecsLoading([=] {
-            QLOG_INFO() << "resuming loading";
-            mpv::qt::command(m_mpv, QStringList() << "hook-ack" << resumeId);
-          });
-        };
-        if (switchDisplayFrameRate())
+        // The first frame is decoded; now wait for some buffer.
+        if (m_standbyState == StandbyLoading)
         {
-          // Now wait for some time for mode change - this is needed because mode changing can take some
-          // time, during which the screen is black, and initializing hardware decoding could fail due
-          // to various strange OS-related reasons.
-          // (Better hope the user doesn't try to exit Konvergo during mode change.)
-          int pause = SettingsComponent::Get().value(SETTINGS_SECTION_VIDEO, "refreshrate.delay").toInt() * 1000;
-          QLOG_INFO() << "waiting" << pause << "msec after rate switch before loading";
-          QTimer::singleShot(pause, resume);
-        }
-        else
-        {
-          resume();
+          m_standbyState = StandbyBuffering;
+          m_standbyBufferTime.start();
+          onStandbyTimer();
         }
         break;
       }
-      // Start "on_preloaded" hook.
-      // Used initialize stream selections and to probe codecs.
-      if (!strcmp(msg->args[1], "2"))
+      case MPV_EVENT_END_FILE:
       {
-        reselectStream(m_currentSubtitleStream, MediaType::Subtitle);
-        reselectStream(m_currentAudioStream, MediaType::Audio);
-        startCodecsLoading([=] {
-          mpv::qt::command(m_mpv, QStringList() << "hook-ack" << resumeId);
-        });
+        mpv_event_end_file *endFile = (mpv_event_end_file *)event->data;
+        if (endFile->reason == MPV_END_FILE_REASON_ERROR && m_standbyState != StandbyIdle)
+          fallbackFromStandby(QString("loading failed: ") + mpv_error_string(endFile->error));
+        break;
+      }
+      case MPV_EVENT_CLIENT_MESSAGE:
+      {
+        mpv_event_client_message *msg = (mpv_event_client_message *)event->data;
+        if (msg->num_args < 3 || strcmp(msg->args[0], "hook_run") != 0)
+          break;
+        if (!strcmp(legacyHookName(msg->args[1]), "on_preloaded"))
+          selectStandbyStreams();
+        mpv::qt::command(m_standby, QStringList() << "hook-ack" << QString::fromUtf8(msg->args[2]));
         break;
       }
-      break;
-    }
 #if MPV_CLIENT_API_VERSION >= MPV_MAKE_VERSION(1, 100)
-    case MPV_EVENT_HOOK:
-    {
-      mpv_event_hook *hook = (mpv_event_hook *)event->data;
-      uint64_t id = hook->id;
-
-      if (!strcmp(hook->name, "on_load"))
+      case MPV_EVENT_HOOK:
       {
-        // Calling this lambda will instruct mpv to continue loading the file.
-        auto resume = [=] {
-          QLOG_INFO() << "checking codecs";
-          startCodecsLoading([=] {
-            QLOG_INFO() << "resuming loading";
-            mpv_hook_continue(m_mpv, id);
-          });
-        };
-        if (switchDisplayFrameRate())
-        {
-          // Now wait for some time for mode change - this is needed because mode changing can take some
-          // time, during which the screen is black, and initializing hardware decoding could fail due
-          // to various strange OS-related reasons.
-          // (Better hope the user doesn't try to exit Konvergo during mode change.)
-          int pause = SettingsComponent::Get().value(SETTINGS_SECTION_VIDEO, "refreshrate.delay").toInt() * 1000;
-          QLOG_INFO() << "waiting" << pause << "msec after rate switch before loading";
-          QTimer::singleShot(pause, resume);
-        }
-        else
-        {
-          resume();
-        }
+        mpv_event_hook *hook = (mpv_event_hook *)event->data;
+        if (!strcmp(hook->name, "on_preloaded"))
+          selectStandbyStreams();
+        mpv_hook_continue(m_standby, hook->id);
         break;
       }
-      if (!strcmp(hook->name, "on_preloaded"))
+#endif
+
+      default:; /* ignore */
+    }
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlayerComponent::selectStandbyStreams()
+{
+  if (m_standbyState != StandbyLoading)
+    return;
+
+  // Same as the preloaded hook of the main player, against the standby player's track list.
+  // Codecs are not probed again: a stream switch keeps the item, so they are already present.
+  // Audio stays off until the swap: the main player still holds the audio device, and exclusive
+  // or passthrough outputs can't be opened twice.
+  TrackList standbyTracks;
+  selectStream(m_standby, standbyTracks, m_standbyLoad.subtitleStream, MediaType::Subtitle);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlayerComponent::onStandbyTimer()
+{
+  switch (m_standbyState)
+  {
+    case StandbyIdle:
+    {
+      m_standbyTimer.stop();
+      break;
+    }
+    case StandbyWaitingForLoad:
+    {
+      // The stream switch was not followed by a load(), so this was a plain stop().
+      if (m_standbySwitchTime.elapsed() > StandbyLoadWaitMs)
       {
-        reselectStream(m_currentSubtitleStream, MediaType::Subtitle);
-        reselectStream(m_currentAudioStream, MediaType::Audio);
-        startCodecsLoading([=] {
-          mpv_hook_continue(m_mpv, id);
-        });
-        break;
+        m_streamSwitchImminent = false;
+        stopPlayback();
       }
       break;
     }
-#endif
-
-    default:; /* ignore */
+    case StandbyLoading:
+    {
+      if (m_standbySwitchTime.elapsed() > StandbyLoadTimeoutMs)
+        fallbackFromStandby("loading timed out");
+      break;
+    }
+    case StandbyBuffering:
+    {
+      double buffered = mpv::qt::get_property(m_standby, "demuxer-cache-duration").toDouble();
+      bool idle = mpv::qt::get_property(m_standby, "demuxer-cache-idle").toBool();
+      if (buffered >= StandbyMinBufferSecs || idle || m_standbyBufferTime.elapsed() > StandbyBufferWaitMs)
+        swapToStandby();
+      break;
+    }
   }
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-void PlayerComponent::handleMpvEvents()
+void PlayerComponent::swapToStandby()
 {
-  // Process all events, until the event queue is empty.
-  while (1)
+  m_standbyTimer.stop();
+  m_standbyState = StandbyIdle;
+
+  bool paused = mpv::qt::get_property(m_mpv, "pause").toBool();
+  QVariantMap cacheState = mpv::qt::get_property(m_standby, "demuxer-cache-state").toMap();
+  m_standbyStats.bufferedBytes = cacheState["fw-bytes"].toLongLong();
+
+  // Detach the current player from event handling and the property observers...
+  if (m_eventThread)
   {
-    mpv_event *event = mpv_wait_event(m_mpv, 0);
-    if (event->event_id == MPV_EVENT_NONE)
-      break;
-    handleMpvEvent(event);
+    m_eventThread->stop();
+    m_eventThread->deleteLater();
+    m_eventThread = nullptr;
   }
-  // Once we got all status updates, determine the new canonical state.
-  updatePlaybackState();
+  mpv_set_wakeup_callback(m_mpv, nullptr, nullptr);
+  for (int i = 0; i < m_propertyObservers.size(); i++)
+    mpv_unobserve_property(m_mpv, (quint64)(i + 1));
+
+  std::swap(m_mpv, m_standby);
+
+  // ...and attach the new one. mpv reports the current value of every property it's asked to
+  // observe, so the player state catches up by itself.
+  for (int i = 0; i < m_propertyObservers.size(); i++)
+  {
+    const PropertyObserver& observer = m_propertyObservers[i];
+    mpv_observe_property(m_mpv, (quint64)(i + 1), observer.name.constData(), observer.format);
+  }
+  if (m_useEventThread)
+  {
+    m_eventThread = new PlayerEventThread(m_mpv, this);
+    connect(m_eventThread, &PlayerEventThread::eventsPending, this, &PlayerComponent::handleQueuedEvents, Qt::QueuedConnection);
+    m_eventThread->start();
+  }
+  else
+  {
+    mpv_set_wakeup_callback(m_mpv, wakeup_cb, this);
+    emit onMpvEvents();
+  }
+
+  mpv::qt::set_property(m_mpv, "pause", paused);
+
+  // The previous player is recycled as the next standby player. Deselecting its audio closes
+  // the audio output right away, rather than once the stop has gone through, so the new player
+  // can open the device.
+  mpv_set_wakeup_callback(m_standby, standby_wakeup_cb, this);
+  mpv::qt::set_property(m_standby, "aid", "no");
+  mpv::qt::command(m_standby, QStringList() << "stop");
+
+  // What queueMedia() and the end of the previous file would have done.
+  const QVariantMap& metadata = m_standbyLoad.metadata;
+  m_mediaFrameRate = metadata["frameRate"].toFloat();
+  m_serverMediaInfo.parse(metadata["media"].toMap());
+  m_currentSubtitleStream = m_standbyLoad.subtitleStream;
+  m_currentAudioStream = m_standbyLoad.audioStream;
+  m_inPlayback = true;
+  clearQueuedItems();
+
+  // The previous item ended without an END_FILE on this player.
+  QStringList previousUrls = m_currentExternalUrls;
+  m_currentExternalUrls = QStringList() << externalStreamUrl(m_currentSubtitleStream) << externalStreamUrl(m_currentAudioStream);
+  for (const QString& url : m_currentExternalUrls)
+    previousUrls.removeAll(url);
+  releasePrefetchedFiles(previousUrls);
+  m_probeKey = m_standbyLoad.probeKey;
+  m_probeHit = m_standbyLoad.probeHit;
+  m_probeInfo = m_probeCache.find(m_probeKey);
+  m_tracks.invalidate();
+  // Left off by selectStandbyStreams().
+  reselectStream(m_currentAudioStream, MediaType::Audio);
+  resetSeekState();
+  m_streamSwitchImminent = false;
+  m_thumbnails.setSource(thumbnailSource(m_standbyLoad.url, metadata));
+  m_readahead.setPlayer(m_mpv);
+  m_readahead.start(metadata["media"].toMap()["bitrate"].toLongLong());
+  m_quality.setActive(false);
+  m_quality.setPlayer(m_mpv);
+  m_bandwidth.setPlayer(m_mpv);
+  // Reads from the proxy's cache would pass for a very fast network.
+  m_bandwidth.start(m_standbyLoad.proxyUrl.isEmpty() ? QUrl(m_standbyLoad.url).host() : QString());
+  m_proxy.release(m_currentProxyUrl);
+  m_currentProxyUrl = m_standbyLoad.proxyUrl;
+  m_standbyLoad.proxyUrl.clear();
+  if (m_quality.reset())
+    updateVideoSettings();
+
+  // Make the renderer pick up the new player.
+  if (m_window)
+    m_window->update();
+
+  qint64 latency = m_standbySwitchTime.elapsed();
+  m_standbyStats.switches++;
+  m_standbyStats.lastSwitchMs = latency;
+  m_standbyStats.totalSwitchMs += latency;
+  m_standbyStats.maxSwitchMs = qMax(m_standbyStats.maxSwitchMs, latency);
+  QLOG_INFO() << "Switched to the standby player after" << latency << "ms," << m_standbyStats.bufferedBytes << "bytes buffered.";
+
+  QUrl qurl = m_standbyLoad.url;
+  emit onMetaData(metadata["metadata"].toMap(), qurl.adjusted(QUrl::RemovePath | QUrl::RemoveQuery));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlayerComponent::abortStandby(const QString& reason)
+{
+  if (m_standbyState == StandbyIdle)
+    return;
+
+  QLOG_INFO() << "Standby player not used:" << reason;
+  m_standbyTimer.stop();
+  if (m_standbyState != StandbyWaitingForLoad)
+    mpv::qt::command(m_standby, QStringList() << "stop");
+  m_standbyState = StandbyIdle;
+  m_proxy.release(m_standbyLoad.proxyUrl);
+  m_standbyLoad.proxyUrl.clear();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlayerComponent::fallbackFromStandby(const QString& reason)
+{
+  abortStandby(reason);
+  m_standbyStats.fallbacks++;
+
+  // Do the stream switch the old way.
+  StandbyLoad load = m_standbyLoad;
+  stopPlayback();
+  m_startupStats.begin();
+  queueMedia(load.url, load.options, load.metadata, load.audioStream, load.subtitleStream);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+QVariantMap PlayerComponent::getStandbyStats()
+{
+  QVariantMap stats;
+  stats["enabled"] = (bool)m_standby;
+  stats["switches"] = m_standbyStats.switches;
+  stats["fallbacks"] = m_standbyStats.fallbacks;
+  stats["lastSwitchMs"] = m_standbyStats.lastSwitchMs;
+  stats["averageSwitchMs"] = m_standbyStats.switches ? m_standbyStats.totalSwitchMs / m_standbyStats.switches : 0;
+  stats["maxSwitchMs"] = m_standbyStats.maxSwitchMs;
+  stats["memoryKB"] = m_standbyStats.memoryKB;
+  stats["bufferedBytes"] = m_standbyStats.bufferedBytes;
+  return stats;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -724,8 +1586,29 @@ void PlayerComponent::play()
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 void PlayerComponent::stop()
 {
+  // With a standby player, the stop() of a stream switch (streamSwitch(), stop(), load()) keeps
+  // the current stream on screen until the new one is ready.
+  if (m_standby && m_streamSwitchImminent && m_inPlayback)
+  {
+    abortStandby("superseded by a new stream switch");
+    m_standbyState = StandbyWaitingForLoad;
+    m_standbySwitchTime.start();
+    m_standbyTimer.start();
+    return;
+  }
+
+  stopPlayback();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlayerComponent::stopPlayback()
+{
+  abortStandby("playback stopped");
+
   QStringList args("stop");
   mpv::qt::command(m_mpv, args);
+  clearQueuedItems();
+  clearPrefetchedFiles();
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -733,6 +1616,27 @@ void PlayerComponent::clearQueue()
 {
   QStringList args("playlist_clear");
   mpv::qt::command(m_mpv, args);
+  clearQueuedItems();
+  setNextItemOptions();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlayerComponent::setNextItemOptions()
+{
+  // The current file is already open, and keeps its per-file values, which mpv puts back when it
+  // ends. The next item is loaded with the same values per-file, so they only matter when mpv
+  // opens it ahead.
+  QVariantMap options = m_queue.isEmpty() ? QVariantMap() : m_queue.first().openOptions;
+  for (const char* name : FileOpenOptions)
+    mpv::qt::set_property(m_mpv, name, options.value(name, m_defaultOpenOptions.value(name)));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlayerComponent::clearQueuedItems()
+{
+  for (const QueuedItem& item : m_queue)
+    m_proxy.release(item.proxyUrl);
+  m_queue.clear();
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -745,9 +1649,136 @@ void PlayerComponent::pause()
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 void PlayerComponent::seekTo(qint64 ms)
 {
-  double timeSecs = ms / 1000.0;
-  QVariantList args = (QVariantList() << "seek" << timeSecs << "absolute+exact");
-  mpv::qt::command(m_mpv, args);
+  // An explicit seek ends scrubbing; its exact seek replaces the one endScrub() would do.
+  m_scrubbing = false;
+  m_scrubEndTimer.stop();
+  queueSeek(ms, true);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlayerComponent::scrubTo(qint64 ms)
+{
+  m_scrubbing = true;
+  m_scrubTarget = ms;
+  m_scrubEndTimer.start();
+  queueSeek(ms, false);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlayerComponent::endScrub()
+{
+  if (!m_scrubbing)
+    return;
+  m_scrubbing = false;
+  m_scrubEndTimer.stop();
+  queueSeek(m_scrubTarget, true);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlayerComponent::queueSeek(qint64 ms, bool exact)
+{
+  // Only the newest target matters. It's sent once the seek in flight has been displayed.
+  m_pendingSeek.target = ms;
+  m_pendingSeek.exact = exact;
+  m_pendingSeek.requested.start();
+  m_seekPending = true;
+
+  if (!m_seekInFlight)
+    startPendingSeek();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlayerComponent::startPendingSeek()
+{
+  if (!m_seekPending || !m_mpv)
+    return;
+  m_seekPending = false;
+
+  QByteArray target = QByteArray::number(m_pendingSeek.target / 1000.0, 'f', 3);
+  const char* args[] = {
+    "seek", target.constData(), m_pendingSeek.exact ? "absolute+exact" : "absolute+keyframes", nullptr
+  };
+  int err = mpv_command_async(m_mpv, SeekReplyId, args);
+  if (err < 0)
+  {
+    QLOG_ERROR() << "Seeking failed:" << mpv_error_string(err);
+    return;
+  }
+
+  m_seekInFlight = true;
+  m_inFlightSeek = m_pendingSeek;
+  m_seekWatchdog.start();
+  m_bandwidth.seekStarted();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlayerComponent::finishSeek()
+{
+  m_seekInFlight = false;
+  m_seekWatchdog.stop();
+  startPendingSeek();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlayerComponent::handleCommandReply(quint64 id, int error, qint64 entryId)
+{
+  if (error >= 0)
+  {
+    if (id >= QueueReplyId && entryId)
+    {
+      for (QueuedItem& item : m_queue)
+      {
+        if (item.replyId == id)
+          item.entryId = entryId;
+      }
+    }
+    return;
+  }
+
+  if (id >= QueueReplyId)
+  {
+    // There won't be a START_FILE for it, so it mustn't stay in the queue.
+    for (int n = 0; n < m_queue.size(); n++)
+    {
+      if (m_queue[n].replyId == id)
+      {
+        QLOG_ERROR() << "Queuing" << m_queue[n].url << "failed:" << mpv_error_string(error);
+        m_proxy.release(m_queue.takeAt(n).proxyUrl);
+        setNextItemOptions();
+        return;
+      }
+    }
+    QLOG_ERROR() << "Queuing an item failed:" << mpv_error_string(error);
+    return;
+  }
+
+  if (id != SeekReplyId)
+    return;
+
+  // There won't be a playback restart for a failed seek.
+  QLOG_ERROR() << "Seeking failed:" << mpv_error_string(error);
+  finishSeek();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlayerComponent::handlePlaybackRestart()
+{
+  if (!m_seekInFlight)
+    return;
+
+  // The seek target is on screen now. Report the new position right away, instead of waiting
+  // for the next playback-time change to pass the update threshold.
+  qint64 latency = m_inFlightSeek.requested.elapsed();
+  double pos = mpv::qt::get_property(m_mpv, "playback-time").toDouble();
+  quint64 ms = (quint64)(qMax(pos * 1000.0, 0.0));
+  m_lastPositionUpdate = pos;
+  emit positionUpdate(ms);
+  emit seekCompleted(ms, latency);
+
+  QLOG_DEBUG() << (m_inFlightSeek.exact ? "Exact" : "Keyframe") << "seek to" << m_inFlightSeek.target
+               << "ms displayed after" << latency << "ms";
+
+  finishSeek();
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -795,28 +1826,30 @@ bool PlayerComponent::muted()
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-QVariantList PlayerComponent::findStreamsForURL(const QString &url)
+const TrackList& PlayerComponent::tracks()
 {
-  bool isExternal = !url.isEmpty();
-  QVariantList res;
+  return updatedTracks(m_mpv, m_tracks);
+}
 
-  auto tracks = mpv::qt::get_property(m_mpv, "track-list");
-  for (auto track : tracks.toList())
+///////////////////////////////////////////////////////////////////////////////////////////////////
+const TrackList& PlayerComponent::updatedTracks(mpv_handle* mpv, TrackList& tracks)
+{
+  if (!tracks.isValid())
   {
-    QVariantMap map = track.toMap();
-
-    if (map["external"].toBool() != isExternal)
-      continue;
-
-    if (!isExternal || map["external-filename"].toString() == url)
-      res += map;
+    mpv::qt::property_node trackList(mpv, "track-list");
+    tracks.update(trackList.view());
   }
-
-  return res;
+  return tracks;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 void PlayerComponent::reselectStream(const QString &streamSelection, MediaType target)
+{
+  selectStream(m_mpv, m_tracks, streamSelection, target);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlayerComponent::selectStream(mpv_handle* mpv, TrackList& trackList, const QString &streamSelection, MediaType target)
 {
   QString streamIdPropertyName;
   QString streamAddCommandName;
@@ -857,36 +1890,43 @@ void PlayerComponent::reselectStream(const QString &streamSelection, MediaType t
   }
   else if (streamSelection.isEmpty())
   {
-    mpv::qt::set_property(m_mpv, streamIdPropertyName, "no");
+    mpv::qt::set_property(mpv, streamIdPropertyName, "no");
     return;
   }
 
-  if (!streamName.isEmpty())
+  // Use the local copy if the external file was prefetched. Downloads still running have no
+  // local copy yet, so the URL is used for those.
+  QString local = m_prefetchedFiles.value(streamName);
+  if (!local.isEmpty())
+    streamName = local;
+
+  if (!streamName.isEmpty() && updatedTracks(mpv, trackList).forFile(streamName).isEmpty())
   {
-    auto streams = findStreamsForURL(streamName);
-    if (streams.isEmpty())
-    {
-      QStringList args = (QStringList() << streamAddCommandName << streamName);
-      mpv::qt::command(m_mpv, args);
-    }
+    QStringList args = (QStringList() << streamAddCommandName << streamName);
+    mpv::qt::command(mpv, args);
+    // Don't wait for the track-list change notification.
+    trackList.invalidate();
   }
 
   QString selection = "no";
 
-  for (auto stream : findStreamsForURL(streamName))
+  if (!streamID.isEmpty())
   {
-    auto map = stream.toMap();
-
-    if (map["type"].toString() != mpvStreamTypeName)
-      continue;
-
-    if (!streamID.isEmpty() && map["ff-index"].toString() == streamID)
+    bool ok = false;
+    int ffIndex = streamID.toInt(&ok);
+    const TrackInfo* track = ok ? updatedTracks(mpv, trackList).find(mpvStreamTypeName, ffIndex, streamName) : nullptr;
+    if (track)
+      selection = QString::number(track->id);
+  }
+  else
+  {
+    for (const TrackInfo* track : updatedTracks(mpv, trackList).forFile(streamName))
     {
-      selection = map["id"].toString();
-      break;
-    } else if (streamID.isEmpty() && map["external-filename"].toString() == streamName) {
-      selection = map["id"].toString();
-      break;
+      if (track->type == mpvStreamTypeName)
+      {
+        selection = QString::number(track->id);
+        break;
+      }
     }
   }
 
@@ -895,7 +1935,7 @@ void PlayerComponent::reselectStream(const QString &streamSelection, MediaType t
   if ((target == MediaType::Audio || !streamID.isEmpty()) && selection == "no")
     selection = "1";
 
-  mpv::qt::set_property(m_mpv, streamIdPropertyName, selection);
+  mpv::qt::set_property(mpv, streamIdPropertyName, selection);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -916,7 +1956,12 @@ void PlayerComponent::setAudioStream(const QString &audioStream)
 void PlayerComponent::setAudioDelay(qint64 milliseconds)
 {
   m_playbackAudioDelay = milliseconds;
+  applyAudioDelay(m_mpv);
+}
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlayerComponent::applyAudioDelay(mpv_handle* mpv)
+{
   double displayFps = DisplayComponent::Get().currentRefreshRate();
   const char *audioDelaySetting = "audio_delay.normal";
   if (fabs(displayFps - 24) < 0.5) // cover 24Hz, 23.976Hz, and values very close
@@ -927,7 +1972,7 @@ void PlayerComponent::setAudioDelay(qint64 milliseconds)
     audioDelaySetting = "audio_delay.50hz";
 
   double fixedDelay = SettingsComponent::Get().value(SETTINGS_SECTION_VIDEO, audioDelaySetting).toFloat();
-  mpv::qt::set_property(m_mpv, "audio-delay", (fixedDelay + m_playbackAudioDelay) / 1000.0);
+  mpv::qt::set_property(mpv, "audio-delay", (fixedDelay + m_playbackAudioDelay) / 1000.0);
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////
@@ -1034,6 +2079,12 @@ void PlayerComponent::updateAudioDeviceList()
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 void PlayerComponent::updateAudioDevice()
+{
+  applyAudioDevice(m_mpv);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlayerComponent::applyAudioDevice(mpv_handle* mpv)
 {
   QString device = SettingsComponent::Get().value(SETTINGS_SECTION_AUDIO, "device").toString();
 
@@ -1043,17 +2094,27 @@ void PlayerComponent::updateAudioDevice()
     device = "auto";
   }
 
-  mpv::qt::set_property(m_mpv, "audio-device", device);
+  mpv::qt::set_property(mpv, "audio-device", device);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 void PlayerComponent::setAudioConfiguration()
+{
+  applyAudioConfiguration(m_mpv);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlayerComponent::applyAudioConfiguration(mpv_handle* mpv)
 {
   QString deviceType = SettingsComponent::Get().value(SETTINGS_SECTION_AUDIO, "devicetype").toString();
 
-  mpv::qt::set_property(m_mpv, "audio-exclusive", SettingsComponent::Get().value(SETTINGS_SECTION_AUDIO, "exclusive").toBool());
+  mpv::qt::set_property(mpv, "audio-exclusive", SettingsComponent::Get().value(SETTINGS_SECTION_AUDIO, "exclusive").toBool());
+
+  applyAudioDevice(mpv);
 
-  updateAudioDevice();
+  // The remaining options only take effect when audio is reinitialized, so there's no need to
+  // wait for each of them. The batch is sent before the af commands below.
+  mpv::qt::property_batch props(mpv);
 
   QString resampleOpts = "";
   bool normalize = SettingsComponent::Get().value(SETTINGS_SECTION_AUDIO, "normalize").toBool();
@@ -1062,8 +2123,9 @@ void PlayerComponent::setAudioConfiguration()
   // Make downmix more similar to PHT.
   resampleOpts += ":o=[surround_mix_level=1]";
 
-  mpv::qt::set_property(m_mpv, "af-defaults", "lavrresample" + resampleOpts);
+  props.set("af-defaults", "lavrresample" + resampleOpts);
 
+  // Both players get the same configuration, so these describe either of them.
   m_passthroughCodecs.clear();
 
   // passthrough doesn't make sense with basic type
@@ -1089,7 +2151,7 @@ void PlayerComponent::setAudioConfiguration()
   }
 
   QString passthroughCodecs = m_passthroughCodecs.join(",");
-  mpv::qt::set_property(m_mpv, "audio-spdif", passthroughCodecs);
+  props.set("audio-spdif", passthroughCodecs);
 
   // set the channel layout
   QVariant layout = SettingsComponent::Get().value(SETTINGS_SECTION_AUDIO, "channels");
@@ -1098,7 +2160,8 @@ void PlayerComponent::setAudioConfiguration()
   if (deviceType == AUDIO_DEVICE_TYPE_SPDIF)
     layout = "2.0";
 
-  mpv::qt::set_property(m_mpv, "audio-channels", layout);
+  props.set("audio-channels", layout.toString());
+  props.apply();
 
   // if the user has indicated that PCM only works for stereo, and that
   // the receiver supports AC3, set this extra option that allows us to transcode
@@ -1111,12 +2174,12 @@ void PlayerComponent::setAudioConfiguration()
       SettingsComponent::Get().value(SETTINGS_SECTION_AUDIO, "passthrough.ac3").toBool())
   {
     QString filterArgs = "";
-    mpv::qt::command(m_mpv, QStringList() << "af" << "add" << ("@ac3:lavcac3enc" + filterArgs));
+    mpv::qt::command(mpv, QStringList() << "af" << "add" << ("@ac3:lavcac3enc" + filterArgs));
     m_doAc3Transcoding = true;
   }
   else
   {
-    mpv::qt::command(m_mpv, QStringList() << "af" << "del" << "@ac3");
+    mpv::qt::command(mpv, QStringList() << "af" << "del" << "@ac3");
   }
 
   QVariant device = SettingsComponent::Get().value(SETTINGS_SECTION_AUDIO, "device");
@@ -1134,29 +2197,35 @@ void PlayerComponent::setAudioConfiguration()
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 void PlayerComponent::updateSubtitleSettings()
+{
+  applySubtitleSettings(m_mpv);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlayerComponent::applySubtitleSettings(mpv_handle* mpv)
 {
   QVariant size = SettingsComponent::Get().value(SETTINGS_SECTION_SUBTITLES, "size");
-  mpv::qt::set_property(m_mpv, "sub-scale", size.toInt() / 32.0);
+  mpv::qt::set_property(mpv, "sub-scale", size.toInt() / 32.0);
 
   QVariant colorsString = SettingsComponent::Get().value(SETTINGS_SECTION_SUBTITLES, "color");
   auto colors = colorsString.toString().split(",");
   if (colors.length() == 2)
   {
-    mpv::qt::set_property(m_mpv, "sub-color", colors[0]);
-    mpv::qt::set_property(m_mpv, "sub-border-color", colors[1]);
+    mpv::qt::set_property(mpv, "sub-color", colors[0]);
+    mpv::qt::set_property(mpv, "sub-border-color", colors[1]);
   }
 
   QVariant subposString = SettingsComponent::Get().value(SETTINGS_SECTION_SUBTITLES, "placement");
   auto subpos = subposString.toString().split(",");
   if (subpos.length() == 2)
   {
-    mpv::qt::set_property(m_mpv, "sub-align-x", subpos[0]);
-    mpv::qt::set_property(m_mpv, "sub-pos", subpos[1] == "bottom" ? 100 : 10);
+    mpv::qt::set_property(mpv, "sub-align-x", subpos[0]);
+    mpv::qt::set_property(mpv, "sub-pos", subpos[1] == "bottom" ? 100 : 10);
   }
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-void PlayerComponent::updateVideoAspectSettings()
+void PlayerComponent::updateVideoAspectSettings(mpv_handle* mpv)
 {
   QVariant mode = SettingsComponent::Get().value(SETTINGS_SECTION_VIDEO, "aspect").toString();
   bool disableScaling = false;
@@ -1182,7 +2251,7 @@ void PlayerComponent::updateVideoAspectSettings()
   }
   else if (mode == "force_16_9_if_4_3")
   {
-    auto params = mpv::qt::get_property(m_mpv, "video-dec-params").toMap();
+    auto params = mpv::qt::get_property(mpv, "video-dec-params").toMap();
     auto aspect = params["aspect"].toFloat();
     if (fabs(aspect - 4.0/3.0) < 0.1)
       forceAspect = "16:9";
@@ -1196,20 +2265,32 @@ void PlayerComponent::updateVideoAspectSettings()
     disableScaling = true;
   }
 
-  mpv::qt::set_property(m_mpv, "video-unscaled", disableScaling);
-  mpv::qt::set_property(m_mpv, "video-aspect", forceAspect);
-  mpv::qt::set_property(m_mpv, "keepaspect", keepAspect);
-  mpv::qt::set_property(m_mpv, "panscan", panScan);
+  mpv::qt::property_batch(mpv)
+    .set("video-unscaled", disableScaling)
+    .set("video-aspect", forceAspect)
+    .set("keepaspect", keepAspect)
+    .set("panscan", panScan)
+    .apply();
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 void PlayerComponent::updateVideoSettings()
 {
-  if (!m_mpv)
+  applyVideoSettings(m_mpv);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlayerComponent::applyVideoSettings(mpv_handle* mpv)
+{
+  if (!mpv)
     return;
 
-  QVariant syncMode = SettingsComponent::Get().value(SETTINGS_SECTION_VIDEO, "sync_mode");
-  mpv::qt::set_property(m_mpv, "video-sync", syncMode);
+  // None of these need to be read back right away, so they are sent without waiting for the
+  // player core. They are applied in order before any later command, such as loadfile.
+  mpv::qt::property_batch props(mpv);
+
+  QString syncMode = SettingsComponent::Get().value(SETTINGS_SECTION_VIDEO, "sync_mode").toString();
+  props.set("video-sync", syncMode);
 
   QString hardwareDecodingMode = SettingsComponent::Get().value(SETTINGS_SECTION_VIDEO, "hardwareDecoding").toString();
   QString hwdecMode = "no";
@@ -1225,23 +2306,28 @@ void PlayerComponent::updateVideoSettings()
   {
     hwdecMode = "auto-copy";
   }
-  mpv::qt::set_property(m_mpv, "hwdec", hwdecMode);
-  mpv::qt::set_property(m_mpv, "videotoolbox-format", hwdecVTFormat);
+  props.set("hwdec", hwdecMode);
+  props.set("videotoolbox-format", hwdecVTFormat);
 
   QVariant deinterlace = SettingsComponent::Get().value(SETTINGS_SECTION_VIDEO, "deinterlace");
-  mpv::qt::set_property(m_mpv, "deinterlace", deinterlace.toBool() ? "yes" : "no");
+  props.set("deinterlace", deinterlace.toBool() ? "yes" : "no");
 
 #ifndef TARGET_RPI
   double displayFps = DisplayComponent::Get().currentRefreshRate();
-  mpv::qt::set_property(m_mpv, "display-fps", displayFps);
+  props.set("display-fps", displayFps);
 #endif
 
-  setAudioDelay(m_playbackAudioDelay);
-
   QVariant cache = SettingsComponent::Get().value(SETTINGS_SECTION_VIDEO, "cache");
-  mpv::qt::set_property(m_mpv, "cache", cache.toInt() * 1024);
+  props.set("cache", cache.toInt() * 1024);
+  props.apply();
+
+  // Keep what the quality governor turned down for the current item.
+  if (mpv == m_mpv)
+    m_quality.reapply();
 
-  updateVideoAspectSettings();
+  applyAudioDelay(mpv);
+
+  updateVideoAspectSettings(mpv);
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////
@@ -1344,7 +2430,7 @@ QStringList PlayerComponent::installedDecoderCodecs()
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////
-PlaybackInfo PlayerComponent::getPlaybackInfo()
+PlaybackInfo PlayerComponent::basePlaybackInfo() const
 {
   PlaybackInfo info = {};
 
@@ -1357,67 +2443,202 @@ PlaybackInfo PlayerComponent::getPlaybackInfo()
   }
 
   info.enableAC3Transcoding = m_doAc3Transcoding;
+  return info;
+}
 
-  auto tracks = mpv::qt::get_property(m_mpv, "track-list");
-  for (auto track : tracks.toList())
-  {
-    QVariantMap map = track.toMap();
-    QString type = map["type"].toString();
+/////////////////////////////////////////////////////////////////////////////////////////
+PlaybackInfo PlayerComponent::getPlaybackInfo()
+{
+  PlaybackInfo info = basePlaybackInfo();
 
+  for (const TrackInfo& track : tracks().tracks())
+  {
     StreamInfo stream = {};
-    stream.isVideo = type == "video";
-    stream.isAudio = type == "audio";
-    stream.codec = map["codec"].toString();
-    stream.audioChannels = map["demux-channel-count"].toInt();
-    stream.audioSampleRate = map["demux-samplerate"].toInt();
-    stream.videoResolution = QSize(map["demux-w"].toInt(), map["demux-h"].toInt());
+    stream.isVideo = track.type == "video";
+    stream.isAudio = track.type == "audio";
+    stream.codec = track.codec;
+    stream.audioChannels = track.demuxChannelCount;
+    stream.audioSampleRate = track.demuxSampleRate;
+    stream.videoResolution = QSize(track.demuxWidth, track.demuxHeight);
+
+    // Fill in what wasn't probed this time from an earlier play.
+    const StreamInfo* probed = track.external ? nullptr : m_probeInfo.findByIndex(track.ffIndex);
+    if (probed && probed->codec == stream.codec)
+    {
+      if (stream.audioChannels <= 0)
+        stream.audioChannels = probed->audioChannels;
+      if (stream.audioSampleRate <= 0)
+        stream.audioSampleRate = probed->audioSampleRate;
+      if (stream.videoResolution.isEmpty())
+        stream.videoResolution = probed->videoResolution;
+    }
 
     // Get the profile from the server, because mpv can't determine it yet.
     if (stream.isVideo)
     {
-      int index = map["ff-index"].toInt();
-      for (auto partInfo : m_serverMediaInfo["Part"].toList())
+      const StreamInfo* serverStream = m_serverMediaInfo.findByIndex(track.ffIndex);
+      if (serverStream)
       {
-        for (auto streamInfo : partInfo.toMap()["Stream"].toList())
-        {
-          auto streamInfoMap = streamInfo.toMap();
-          bool ok = false;
-          if (streamInfoMap["index"].toInt(&ok) == index && ok)
-          {
-            stream.profile = streamInfoMap["profile"].toString();
-            QLOG_DEBUG() << "h264profile:" << stream.profile;
-          }
-        }
+        stream.profile = serverStream->profile;
+        QLOG_DEBUG() << "h264profile:" << stream.profile;
       }
     }
 
     info.streams.append(stream);
   }
 
-  // If we're in an early stage where we don't have streams yet, try to get the
-  // info from the PMS metadata.
+  // If we're in an early stage where we don't have streams yet, use what an earlier
+  // play of the item found, or try to get the info from the PMS metadata.
   if (!info.streams.size())
+    info.streams = m_probeInfo.isValid() ? m_probeInfo.streams : m_serverMediaInfo.streams();
+
+  return info;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+void PlayerComponent::prefetchNext()
+{
+  if (m_queue.isEmpty() || m_queue.first().prefetched)
+    return;
+
+  QueuedItem& item = m_queue.first();
+  item.prefetched = true;
+  QLOG_INFO() << "Prefetching the next item.";
+
+  // mpv has not opened the file yet, so there are only the results of an earlier play and the
+  // server metadata. That's also what getPlaybackInfo() falls back to at this stage.
+  ServerMediaInfo serverInfo;
+  serverInfo.parse(item.metadata["media"].toMap());
+  PlaybackInfo info = basePlaybackInfo();
+  ProbeInfo probe = m_probeCache.find(item.probeKey);
+  info.streams = probe.isValid() ? probe.streams : serverInfo.streams();
+
+  if (!m_prefetchFetcher)
   {
-    for (auto partInfo : m_serverMediaInfo["Part"].toList())
+    m_prefetchFetcher = new CodecsFetcher();
+    connect(m_prefetchFetcher.data(), &CodecsFetcher::done, this, [=](CodecsFetcher* sender)
     {
-      for (auto streamInfo : partInfo.toMap()["Stream"].toList())
-      {
-        auto streamInfoMap = streamInfo.toMap();
+      sender->deleteLater();
+      m_prefetchFetcher.clear();
+    });
+    m_prefetchFetcher->installCodecs(Codecs::determineRequiredCodecs(info));
+  }
 
-        StreamInfo stream = {};
-        stream.isVideo = streamInfoMap["width"].isValid();
-        stream.isAudio = streamInfoMap["channels"].isValid();
-        stream.codec = Codecs::plexNameToFF(streamInfoMap["codec"].toString());
-        stream.audioChannels = streamInfoMap["channels"].toInt();
-        stream.videoResolution = QSize(streamInfoMap["width"].toInt(), streamInfoMap["height"].toInt());
-        stream.profile = streamInfoMap["profile"].toString();
+  Downloader::HeaderList headers;
+  QString userAgent = item.metadata["headers"].toMap()["User-Agent"].toString();
+  if (userAgent.size())
+    headers << Downloader::Header("User-Agent", userAgent);
 
-        info.streams.append(stream);
-      }
-    }
+  for (const QString& stream : {item.subtitleStream, item.audioStream})
+  {
+    QString url = externalStreamUrl(stream);
+    if (url.size())
+      prefetchFile(url, headers);
   }
+}
 
-  return info;
+/////////////////////////////////////////////////////////////////////////////////////////
+QString PlayerComponent::externalStreamUrl(const QString& streamSelection)
+{
+  // External streams are selected as "#<id>,<url>".
+  int splitPos = streamSelection.indexOf(",");
+  if (streamSelection.startsWith("#") && splitPos > 0)
+    return streamSelection.mid(splitPos + 1);
+  return QString();
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+void PlayerComponent::prefetchFile(const QString& url, const Downloader::HeaderList& headers)
+{
+  QUrl qurl(url);
+  if (m_prefetchedFiles.contains(url) || (qurl.scheme() != "http" && qurl.scheme() != "https"))
+    return;
+
+  if (!m_network)
+    m_network = new QNetworkAccessManager(this);
+
+  // Keep the extension, mpv uses it to guess the subtitle format.
+  QString name = QCryptographicHash::hash(url.toUtf8(), QCryptographicHash::Sha1).toHex();
+  QString suffix = QFileInfo(qurl.path()).suffix();
+  if (suffix.size())
+    name += "." + suffix;
+  QDir().mkpath(Paths::cacheDir("prefetch"));
+  QString dest = Paths::cacheDir("prefetch/" + name);
+
+  // Empty until the download is done, so reselectStream() keeps using the URL until then.
+  m_prefetchedFiles.insert(url, QString());
+
+  QVariantList context = {url, dest};
+  auto downloader = new FileDownloader(m_network, context, qurl, headers, dest, this);
+  connect(downloader, &FileDownloader::done, this, &PlayerComponent::onPrefetchFileDone);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+void PlayerComponent::onPrefetchFileDone(QVariant userData, bool success, const QString& partialFile,
+                                         const QByteArray& sha1)
+{
+  Q_UNUSED(sha1);
+  QString url = userData.toList().value(0).toString();
+  QString dest = userData.toList().value(1).toString();
+
+  // Playback was stopped in the meantime.
+  if (!m_prefetchedFiles.contains(url))
+  {
+    if (!partialFile.isEmpty())
+      QFile::remove(partialFile);
+    return;
+  }
+
+  // An earlier download of the same URL, still running when this one was started, put it there.
+  if (success && partialFile.isEmpty())
+  {
+    m_prefetchedFiles.insert(url, dest);
+    return;
+  }
+
+  QFile::remove(dest);
+  if (!success || !QFile::rename(partialFile, dest))
+  {
+    QLOG_WARN() << "Could not prefetch" << url;
+    QFile::remove(partialFile);
+    m_prefetchedFiles.remove(url);
+    return;
+  }
+
+  m_prefetchedFiles.insert(url, dest);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+void PlayerComponent::releasePrefetchedFiles(const QStringList& urls)
+{
+  for (const QString& url : urls)
+  {
+    if (url.isEmpty() || !m_prefetchedFiles.contains(url))
+      continue;
+
+    // A later item could use the same file.
+    bool used = false;
+    for (const QueuedItem& item : m_queue)
+      used = used || externalStreamUrl(item.subtitleStream) == url || externalStreamUrl(item.audioStream) == url;
+    if (used)
+      continue;
+
+    // Downloads still running are discarded when they're done.
+    QString file = m_prefetchedFiles.take(url);
+    if (file.size())
+      QFile::remove(file);
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+void PlayerComponent::clearPrefetchedFiles()
+{
+  for (const QString& file : m_prefetchedFiles)
+  {
+    if (file.size())
+      QFile::remove(file);
+  }
+  m_prefetchedFiles.clear();
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////
@@ -1444,10 +2665,19 @@ Q_DECLARE_METATYPE(std::function<void()>);
 /////////////////////////////////////////////////////////////////////////////////////////
 void PlayerComponent::startCodecsLoading(std::function<void()> resume)
 {
+  m_startupStats.mark(StartupStats::CodecsStart);
+
+  // Let a prefetch finish first, instead of downloading the same codecs twice.
+  if (m_prefetchFetcher)
+  {
+    QLOG_INFO() << "Waiting for prefetched codecs.";
+    connect(m_prefetchFetcher.data(), &CodecsFetcher::done, this, [=] { startCodecsLoading(resume); });
+    return;
+  }
+
   auto fetcher = new CodecsFetcher();
   fetcher->userData = QVariant::fromValue(resume);
   connect(fetcher, &CodecsFetcher::done, this, &PlayerComponent::onCodecsLoadingDone);
-  Codecs::updateCachedCodecList();
   QList<CodecDriver> codecs = Codecs::determineRequiredCodecs(getPlaybackInfo());
   setPreferredCodecs(codecs);
   fetcher->installCodecs(codecs);
@@ -1457,6 +2687,7 @@ void PlayerComponent::startCodecsLoading(std::function<void()> resume)
 void PlayerComponent::onCodecsLoadingDone(CodecsFetcher* sender)
 {
   sender->deleteLater();
+  m_startupStats.mark(StartupStats::CodecsDone, true);
   sender->userData.value<std::function<void()>>()();
 }
 
@@ -1563,6 +2794,7 @@ QString PlayerComponent::videoInformation() const
   info << "Extra readahead: " << MPV_PROPERTY("cache-used") << "\n";
   info << "Buffering: " << MPV_PROPERTY("cache-buffering-state") << "\n";
   info << "Speed: " << MPV_PROPERTY("cache-speed") << "\n";
+  info << "Readahead: " << m_readahead.summary() << "\n";
   info << "\n";
   info << "Misc:\n";
   info << "Time: " << MPV_PROPERTY("playback-time") << " / "
@@ -1573,6 +2805,7 @@ QString PlayerComponent::videoInformation() const
                     << (MPV_PROPERTY_BOOL("core-idle") ? "waiting " : "playing ")
                     << (MPV_PROPERTY_BOOL("seeking") ? "seeking " : "")
                     << "\n";
+  info << "Startup: " << m_startupStats.lastLoadSummary() << "\n";
 
   info.flush();
   return infoStr;
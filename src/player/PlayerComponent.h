@@ -5,8 +5,11 @@
 #include <QtCore/qglobal.h>
 #include <QVariant>
 #include <QSet>
+#include <QVector>
 #include <QQuickWindow>
 #include <QTimer>
+#include <QElapsedTimer>
+#include <QPointer>
 #include <QTextStream>
 
 #include <functional>
@@ -14,9 +17,18 @@
 #include "ComponentManager.h"
 #include "CodecsComponent.h"
 #include "QtHelper.h"
+#include "PlayerTracks.h"
+#include "PlayerStartupStats.h"
+#include "PlayerThumbnails.h"
+#include "PlayerProbeCache.h"
+#include "PlayerReadahead.h"
+#include "PlayerQualityGovernor.h"
+#include "PlayerBandwidth.h"
+#include "PlayerCacheProxy.h"
 
 #include <mpv/client.h>
 
+class PlayerEventThread;
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 class PlayerComponent : public ComponentBase
@@ -43,14 +55,27 @@ public:
   //  - autoplay: if false, start playback paused; if true, start normally
   Q_INVOKABLE void queueMedia(const QString& url, const QVariantMap& options, const QVariantMap &metadata, const QString& audioStream, const QString& subtitleStream);
 
+  // Append many items at once, e.g. an album. Each entry is a map with the queueMedia()
+  // arguments: url, options, metadata, and streams (a map with audio and subtitle). Settings are
+  // applied once, and the items are sent to mpv without waiting for it.
+  Q_INVOKABLE void queueMediaBatch(const QVariantList& items);
+
   // This clears all items queued with queueMedia().
   // It explicitly excludes the currently playing item. The main use of this function
   // is updating the next item that should be played (for the purpose of gapless audio).
   // If you want to wipe everything, use stop().
   Q_INVOKABLE void clearQueue();
 
+  // Exact seek. Seeks issued while a previous seek is still running are coalesced, so only the
+  // newest target is sent to the player once the running seek has finished.
   Q_INVOKABLE virtual void seekTo(qint64 ms);
 
+  // Scrubbing, e.g. while a seek bar is dragged: intermediate targets use fast keyframe seeks
+  // (coalesced like seekTo()), and one exact seek to the last target is done when scrubbing ends.
+  // Scrubbing ends with endScrub(), seekTo(), or 500ms after the last scrubTo() call.
+  Q_INVOKABLE virtual void scrubTo(qint64 ms);
+  Q_INVOKABLE virtual void endScrub();
+
   // Stop playback and clear all queued items.
   Q_INVOKABLE virtual void stop();
 
@@ -122,9 +147,50 @@ public:
   Q_INVOKABLE qint64 getPosition();
   Q_INVOKABLE qint64 getDuration();
 
+  // Time-to-first-frame breakdown: per-stage times of the last load, and rolling histograms of
+  // the recent loads. See StartupStats.
+  Q_INVOKABLE QVariantMap getStartupStats();
+
+  // Return a thumbnail of the current item at the given position, as JPEG data URL. Thumbnails
+  // are generated in the background at getThumbnailInterval() steps; if the one containing ms is
+  // not ready yet, this returns an empty string, and thumbnailReady() follows once it is.
+  Q_INVOKABLE QString getThumbnail(qint64 ms);
+  Q_INVOKABLE qint64 getThumbnailInterval();
+
   QRect videoRectangle() { return m_videoRectangle; }
 
   const mpv::qt::Handle getMpvHandle() const { return m_mpv; }
+  // Null unless the standby player is enabled. The two handles trade places on every stream
+  // switch done through the standby player, so only getMpvHandle() is the one playing.
+  const mpv::qt::Handle getStandbyMpvHandle() const { return m_standby; }
+
+  // Stream switches done through the standby player: count, latency from stop()/load() to the
+  // new stream being shown, fallbacks to a normal reload, and memory cost of the second player.
+  Q_INVOKABLE QVariantMap getStandbyStats();
+
+  // Settings turned down for the current item because playback kept falling behind. See
+  // QualityGovernor.
+  Q_INVOKABLE QVariantMap getQualityState();
+
+  // Bandwidth to the given server host (the current item's if empty), estimated from how fast
+  // the player fills its cache. See BandwidthEstimator.
+  Q_INVOKABLE QVariantMap getBandwidthEstimate(const QString& host = QString());
+
+  // Bytes served by the caching proxy from its disk cache and from the server. See CacheProxy.
+  Q_INVOKABLE QVariantMap getProxyStats();
+
+  // Video repaints and frame pacing of the render thread. See RenderTiming.
+  Q_INVOKABLE QVariantMap getRenderStats();
+
+  // Called on the GUI thread whenever an observed property changes. data points to the value in
+  // the format requested with observeProperty() (int for MPV_FORMAT_FLAG, int64_t, double), or
+  // is null if the property is unavailable. For MPV_FORMAT_NODE, data is always null, and the
+  // handler is a change notification only.
+  typedef std::function<void(void* data)> PropertyHandler;
+
+  // Observe an mpv property without having to touch the event handling code. Returns the
+  // reply_userdata ID assigned to the property. Handlers can't be removed.
+  quint64 observeProperty(const char* name, mpv_format format, const PropertyHandler& handler);
 
   virtual void setWindow(QQuickWindow* window);
 
@@ -155,10 +221,14 @@ public Q_SLOTS:
 
 private Q_SLOTS:
   void handleMpvEvents();
+  void handleQueuedEvents();
   void onRestoreDisplay();
   void onRefreshRateChange();
   void onCodecsLoadingDone(CodecsFetcher* sender);
   void updateAudioDevice();
+  void finishSeek();
+  void handleStandbyEvents();
+  void onStandbyTimer();
 
 Q_SIGNALS:
   // The following signals correspond to the State enum above.
@@ -183,6 +253,22 @@ Q_SIGNALS:
   // when position updates
   void positionUpdate(quint64);
 
+  // A seek (or scrub) has finished and the new position is displayed. latency is the time from
+  // the seek request to the first frame at the new position, including time spent coalesced.
+  void seekCompleted(quint64 ms, quint64 latency);
+
+  // The thumbnail for the interval starting at ms can be fetched with getThumbnail().
+  void thumbnailReady(quint64 ms);
+
+  // Playback kept falling behind, so a setting was turned down (see getQualityState()).
+  void qualityReduced(const QString& step, const QString& reason);
+  // Playback keeps falling behind with everything turned down. The client should switch to a
+  // lower transcode bitrate.
+  void lowerBitrateRequested();
+
+  // The bandwidth estimate for the current item's host changed (see getBandwidthEstimate()).
+  void bandwidthEstimateChanged(const QVariantMap& estimate);
+
   void onVideoRecangleChanged();
 
   void onMpvEvents();
@@ -202,6 +288,54 @@ private:
   void setQtQuickWindow(QQuickWindow* window);
   void updatePlaybackState();
   void handleMpvEvent(mpv_event *event);
+  // entryId and path identify the file (see PlayerEventThread::playlistEntryId()).
+  void handleStartFile(qint64 entryId, const QString& path);
+  void handleEndFile(int reason, int error);
+  void handlePlaybackRestart();
+  void handleCommandReply(quint64 id, int error, qint64 entryId);
+  void queueSeek(qint64 ms, bool exact);
+  void startPendingSeek();
+  // What every queueMedia() call does once, no matter how many items are queued.
+  void beginQueueing();
+  // Remember the item's state for its START_FILE, and return its loadfile command.
+  QVariantList queueCommand(const QString& url, const QVariantMap& options, const QVariantMap& metadata, const QString& audioStream, const QString& subtitleStream);
+  // Get the next queued item ready while the current one is ending: codecs are downloaded and
+  // external streams fetched ahead, so that its hooks don't have to wait for the network.
+  void prefetchNext();
+  void prefetchFile(const QString& url, const Downloader::HeaderList& headers);
+  void onPrefetchFileDone(QVariant userData, bool success, const QString& partialFile,
+                          const QByteArray& sha1);
+  // Delete the prefetched copies of these external stream URLs, unless a queued item uses them.
+  void releasePrefetchedFiles(const QStringList& urls);
+  void clearPrefetchedFiles();
+  // The URL of an external stream selection ("#<id>,<url>"), empty for anything else.
+  static QString externalStreamUrl(const QString& streamSelection);
+  // Codec related playback info that doesn't depend on the file.
+  PlaybackInfo basePlaybackInfo() const;
+  void resetSeekState();
+  void stopPlayback();
+  // Create an mpv instance with our configuration and hooks, but no event handling.
+  mpv::qt::Handle createMpv();
+  ThumbnailSource thumbnailSource(const QString& url, const QVariantMap& metadata);
+  void createStandby();
+  bool loadStandby(const QString& url, const QVariantMap& options, const QVariantMap& metadata, const QString& audioStream, const QString& subtitleStream);
+  void selectStandbyStreams();
+  void swapToStandby();
+  void abortStandby(const QString& reason);
+  void fallbackFromStandby(const QString& reason);
+  void finishStartupStats();
+  void dispatchPropertyChange(quint64 id, mpv_format format, void* data);
+  void onPauseChanged(void* data);
+  void onCoreIdleChanged(void* data);
+  void onBufferingStateChanged(void* data);
+  void onPlaybackTimeChanged(void* data);
+  void onVoConfiguredChanged(void* data);
+  void onDurationChanged(void* data);
+  void onAudioDeviceListChanged(void* data);
+  void onVideoDecParamsChanged(void* data);
+  void onTrackListChanged(void* data);
+  // Run our part of the named mpv hook, then call done() to let mpv continue.
+  void handleHook(const char* name, const std::function<void()>& done);
   // Potentially switch the display refresh rate, and return true if the refresh rate
   // was actually changed.
   bool switchDisplayFrameRate();
@@ -214,11 +348,96 @@ private:
   // Determine the required codecs and possibly download them.
   // Call resume() when done.
   void startCodecsLoading(std::function<void()> resume);
-  void updateVideoAspectSettings();
-  QVariantList findStreamsForURL(const QString &url);
+  void updateVideoAspectSettings(mpv_handle* mpv);
+  // What the settings slots apply to the current player, for any player (e.g. the standby one).
+  void applyVideoSettings(mpv_handle* mpv);
+  void applyAudioConfiguration(mpv_handle* mpv);
+  void applyAudioDevice(mpv_handle* mpv);
+  void applyAudioDelay(mpv_handle* mpv);
+  void applySubtitleSettings(mpv_handle* mpv);
+  // Return the cached track list, fetching it from mpv first if it changed.
+  const TrackList& tracks();
+  static const TrackList& updatedTracks(mpv_handle* mpv, TrackList& tracks);
   void reselectStream(const QString &streamSelection, MediaType target);
+  // reselectStream() for any player, with its own cached track list.
+  void selectStream(mpv_handle* mpv, TrackList& trackList, const QString &streamSelection, MediaType target);
+
+  struct ObservedProperty
+  {
+    const char* name;
+    mpv_format format;
+    void (PlayerComponent::*handler)(void* data);
+  };
+  static const ObservedProperty ObservedProperties[];
+
+  // reply_userdata of asynchronous mpv commands.
+  enum
+  {
+    SeekReplyId = 1,
+    QueueReplyId = 2, // and up, one per item queued by queueMediaBatch()
+  };
+
+  struct SeekRequest
+  {
+    SeekRequest() : target(0), exact(true) {}
+    qint64 target;
+    bool exact;
+    QElapsedTimer requested;
+  };
+
+  enum StandbyState
+  {
+    StandbyIdle,
+    StandbyWaitingForLoad, // stop() of a stream switch was deferred
+    StandbyLoading,
+    StandbyBuffering,      // first frame is ready
+  };
+
+  // Give up on the standby player after this, and reload the normal way.
+  static const int StandbyLoadTimeoutMs = 10000;
+  // A stop() not followed by load() within this time was not part of a stream switch after all.
+  static const int StandbyLoadWaitMs = 1000;
+  // Swap once this much is buffered, or after waiting StandbyBufferWaitMs for it.
+  static constexpr double StandbyMinBufferSecs = 1.0;
+  static const int StandbyBufferWaitMs = 2000;
+
+  struct StandbyLoad
+  {
+    QString url;
+    QVariantMap options;
+    QVariantMap metadata;
+    QString audioStream;
+    QString subtitleStream;
+    // As for a queued item (see QueuedItem).
+    QString probeKey;
+    bool probeHit;
+    QString proxyUrl;
+  };
+
+  struct StandbyStats
+  {
+    StandbyStats()
+      : switches(0), fallbacks(0), lastSwitchMs(0), totalSwitchMs(0), maxSwitchMs(0), memoryKB(-1),
+        bufferedBytes(0) {}
+    int switches;
+    int fallbacks;
+    qint64 lastSwitchMs;
+    qint64 totalSwitchMs;
+    qint64 maxSwitchMs;
+    qint64 memoryKB;
+    qint64 bufferedBytes;
+  };
+
+  struct PropertyObserver
+  {
+    QByteArray name;
+    mpv_format format;
+    PropertyHandler handler;
+  };
 
   mpv::qt::Handle m_mpv;
+  // Indexed by the reply_userdata ID - 1.
+  QVector<PropertyObserver> m_propertyObservers;
 
   State m_state;
   bool m_paused;
@@ -241,10 +460,86 @@ private:
   QMap<QString, bool> m_codecSupport;
   bool m_doAc3Transcoding;
   QStringList m_passthroughCodecs;
-  QVariantMap m_serverMediaInfo;
+  ServerMediaInfo m_serverMediaInfo;
+  TrackList m_tracks;
+  StartupStats m_startupStats;
+  PlayerThumbnails m_thumbnails;
+  // The TLS options createMpv() came up with, for the thumbnail player.
+  QString m_tlsCaFile;
+  bool m_tlsVerify;
+  ReadaheadController m_readahead;
+  QualityGovernor m_quality;
+  BandwidthEstimator m_bandwidth;
+  CacheProxy m_proxy;
+
+  // An item passed to queueMedia() that mpv has not started yet. Its state is applied when it
+  // starts, so that the current item keeps its own while the next ones are queued.
+  struct QueuedItem
+  {
+    QString url;
+    QVariantMap metadata;
+    QString audioStream;
+    QString subtitleStream;
+    ThumbnailSource thumbnails;
+    bool prefetched;
+    QString probeKey;
+    bool probeHit;
+    QString proxyUrl; // what it was loaded from, if it goes through the proxy; see CacheProxy::release()
+    quint64 replyId; // of its asynchronous loadfile, 0 if it was loaded synchronously
+    QVariantMap openOptions; // its per-file options among FileOpenOptions
+    // Which START_FILE is its: the mpv playlist entry, if libmpv tells, otherwise the path.
+    qint64 entryId;
+    QString loadUrl;
+  };
+  // The loadfile command for an item in the given mode ("append-play", "replace"), with the
+  // proxy and probe cache applied. Fills in item, but doesn't queue it.
+  QVariantList loadCommand(const QString& url, const QString& mode, const QVariantMap& options, const QVariantMap& metadata, const QString& audioStream, const QString& subtitleStream, QueuedItem* item);
+  QList<QueuedItem> m_queue;
+  // Empty m_queue, releasing what its items hold.
+  void clearQueuedItems();
+  // Make the global FileOpenOptions those of the next queued item, so that prefetch-playlist
+  // opens it the way loadfile would. The defaults are restored when nothing is queued.
+  void setNextItemOptions();
+  QVariantMap m_defaultOpenOptions;
+  quint64 m_nextQueueReplyId;
+  double m_duration;
+  // Start prefetching the next item this long before the current one ends.
+  static const int PrefetchBeforeEndSecs = 15;
+  QPointer<CodecsFetcher> m_prefetchFetcher;
+  QNetworkAccessManager* m_network;
+  // Remote external stream URL -> downloaded local file.
+  QHash<QString, QString> m_prefetchedFiles;
+
+  ProbeCache m_probeCache;
+  // Probe cache state of the current item. m_probeInfo is what the cache had when it started.
+  QString m_probeKey;
+  ProbeInfo m_probeInfo;
+  bool m_probeHit;
   QString m_currentSubtitleStream;
   QString m_currentAudioStream;
+  // External stream URLs of the current item, whose prefetched files go when it ends.
+  QStringList m_currentExternalUrls;
+  // Proxy URL of the current item, released when it ends.
+  QString m_currentProxyUrl;
   QRect m_videoRectangle;
+  PlayerEventThread* m_eventThread;
+  bool m_scrubbing;
+  qint64 m_scrubTarget;
+  QTimer m_scrubEndTimer;
+  // The newest seek not sent to mpv yet, and the one mpv is working on.
+  SeekRequest m_pendingSeek;
+  bool m_seekPending;
+  SeekRequest m_inFlightSeek;
+  bool m_seekInFlight;
+  QTimer m_seekWatchdog;
+  bool m_useEventThread;
+  mpv::qt::Handle m_standby;
+  StandbyState m_standbyState;
+  StandbyLoad m_standbyLoad;
+  QElapsedTimer m_standbySwitchTime;
+  QElapsedTimer m_standbyBufferTime;
+  QTimer m_standbyTimer;
+  StandbyStats m_standbyStats;
 };
 
 #endif // PLAYERCOMPONENT_H
@@ -0,0 +1,240 @@
+#include "PlayerEventThread.h"
+
+#include <string.h>
+
+#include "QsLog.h"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+PlayerEventThread::PlayerEventThread(mpv::qt::Handle mpv, QObject* parent)
+  : QThread(parent), m_mpv(mpv), m_quit(false), m_notified(false)
+{
+  setObjectName("PlayerEvents");
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+PlayerEventThread::~PlayerEventThread()
+{
+  stop();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlayerEventThread::stop()
+{
+  if (!isRunning())
+    return;
+
+  m_quit = true;
+  // Makes the blocking mpv_wait_event() call return.
+  mpv_wakeup(m_mpv);
+  wait();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlayerEventThread::logMessage(const mpv_event_log_message* msg)
+{
+  // Strip the trailing '\n'
+  size_t len = strlen(msg->text);
+  if (len > 0 && msg->text[len - 1] == '\n')
+    len -= 1;
+  QString logline = QString::fromUtf8(msg->prefix) + ": " + QString::fromUtf8(msg->text, (int)len);
+  if (msg->log_level >= MPV_LOG_LEVEL_V)
+    QLOG_DEBUG() << qPrintable(logline);
+  else if (msg->log_level >= MPV_LOG_LEVEL_INFO)
+    QLOG_INFO() << qPrintable(logline);
+  else if (msg->log_level >= MPV_LOG_LEVEL_WARN)
+    QLOG_WARN() << qPrintable(logline);
+  else
+    QLOG_ERROR() << qPrintable(logline);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+int64_t PlayerEventThread::playlistEntryId(const mpv_event* event)
+{
+#if MPV_CLIENT_API_VERSION >= MPV_MAKE_VERSION(1, 108)
+  if (event->event_id == MPV_EVENT_START_FILE && event->data)
+    return ((mpv_event_start_file *)event->data)->playlist_entry_id;
+
+  if (event->event_id == MPV_EVENT_COMMAND_REPLY && event->data)
+  {
+    const mpv_node& result = ((mpv_event_command *)event->data)->result;
+    if (result.format != MPV_FORMAT_NODE_MAP)
+      return 0;
+    for (int n = 0; n < result.u.list->num; n++)
+    {
+      const mpv_node& value = result.u.list->values[n];
+      if (!strcmp(result.u.list->keys[n], "playlist_entry_id") && value.format == MPV_FORMAT_INT64)
+        return value.u.int64;
+    }
+  }
+#else
+  Q_UNUSED(event);
+#endif
+  return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+QByteArray PlayerEventThread::playingPath(mpv_handle* mpv)
+{
+  char* path = mpv_get_property_string(mpv, "path");
+  QByteArray res(path);
+  mpv_free(path);
+  return res;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlayerEventThread::run()
+{
+  while (!m_quit)
+  {
+    // Block until something happens, then drain everything that is available right now, so
+    // that property changes from the same burst can be coalesced.
+    double timeout = -1;
+    while (!m_quit)
+    {
+      mpv_event* event = mpv_wait_event(m_mpv, timeout);
+      timeout = 0;
+      if (event->event_id == MPV_EVENT_NONE)
+        break;
+      if (event->event_id == MPV_EVENT_SHUTDOWN)
+      {
+        m_quit = true;
+        break;
+      }
+      handleEvent(event);
+    }
+    flushProperties();
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlayerEventThread::handleEvent(mpv_event* event)
+{
+  switch (event->event_id)
+  {
+    case MPV_EVENT_LOG_MESSAGE:
+    {
+      logMessage((mpv_event_log_message *)event->data);
+      break;
+    }
+    case MPV_EVENT_PROPERTY_CHANGE:
+    {
+      mpv_event_property *prop = (mpv_event_property *)event->data;
+
+      // Only the latest value of each observed property is of interest.
+      PlayerEvent& pending = m_pendingProperties[event->reply_userdata];
+      pending.id = MPV_EVENT_PROPERTY_CHANGE;
+      pending.replyUserdata = event->reply_userdata;
+      pending.format = prop->format;
+      switch (prop->format)
+      {
+        case MPV_FORMAT_FLAG:
+          pending.value.flag = *(int *)prop->data;
+          break;
+        case MPV_FORMAT_INT64:
+          pending.value.int64 = *(int64_t *)prop->data;
+          break;
+        case MPV_FORMAT_DOUBLE:
+          pending.value.double_ = *(double *)prop->data;
+          break;
+        default:
+          pending.value.int64 = 0;
+      }
+      break;
+    }
+    case MPV_EVENT_START_FILE:
+    {
+      flushProperties();
+      PlayerEvent ev;
+      ev.id = MPV_EVENT_START_FILE;
+      // Read right away, so it's the path of this file rather than of a later one.
+      ev.playlistEntryId = playlistEntryId(event);
+      ev.path = playingPath(m_mpv);
+      queueEvent(std::move(ev));
+      break;
+    }
+    case MPV_EVENT_PLAYBACK_RESTART:
+    {
+      flushProperties();
+      PlayerEvent ev;
+      ev.id = event->event_id;
+      queueEvent(std::move(ev));
+      break;
+    }
+    case MPV_EVENT_COMMAND_REPLY:
+    {
+      flushProperties();
+      PlayerEvent ev;
+      ev.id = MPV_EVENT_COMMAND_REPLY;
+      ev.replyUserdata = event->reply_userdata;
+      ev.error = event->error;
+      ev.playlistEntryId = playlistEntryId(event);
+      queueEvent(std::move(ev));
+      break;
+    }
+    case MPV_EVENT_END_FILE:
+    {
+      flushProperties();
+      mpv_event_end_file *endFile = (mpv_event_end_file *)event->data;
+      PlayerEvent ev;
+      ev.id = MPV_EVENT_END_FILE;
+      ev.endReason = endFile->reason;
+      ev.endError = endFile->error;
+      queueEvent(std::move(ev));
+      break;
+    }
+    case MPV_EVENT_CLIENT_MESSAGE:
+    {
+      mpv_event_client_message *msg = (mpv_event_client_message *)event->data;
+      if (msg->num_args < 3 || strcmp(msg->args[0], "hook_run") != 0)
+        break;
+      flushProperties();
+      PlayerEvent ev;
+      ev.id = MPV_EVENT_CLIENT_MESSAGE;
+      ev.name = msg->args[1];
+      ev.resumeId = msg->args[2];
+      queueEvent(std::move(ev));
+      break;
+    }
+#if MPV_CLIENT_API_VERSION >= MPV_MAKE_VERSION(1, 100)
+    case MPV_EVENT_HOOK:
+    {
+      flushProperties();
+      mpv_event_hook *hook = (mpv_event_hook *)event->data;
+      PlayerEvent ev;
+      ev.id = MPV_EVENT_HOOK;
+      ev.name = hook->name;
+      ev.hookId = hook->id;
+      queueEvent(std::move(ev));
+      break;
+    }
+#endif
+
+    default:; /* ignore */
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlayerEventThread::flushProperties()
+{
+  for (auto it = m_pendingProperties.begin(); it != m_pendingProperties.end(); ++it)
+    queueEvent(std::move(it.value()));
+  m_pendingProperties.clear();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlayerEventThread::queueEvent(PlayerEvent&& event)
+{
+  // The queue can only fill up if the GUI thread is stalled for a long time, since property
+  // changes are coalesced. Wait for it to catch up rather than dropping state changes.
+  while (!m_queue.push(std::move(event)))
+  {
+    if (m_quit)
+      return;
+    if (!m_notified.exchange(true))
+      emit eventsPending();
+    QThread::msleep(1);
+  }
+
+  if (!m_notified.exchange(true))
+    emit eventsPending();
+}
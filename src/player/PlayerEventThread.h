@@ -0,0 +1,108 @@
+#ifndef PLAYEREVENTTHREAD_H
+#define PLAYEREVENTTHREAD_H
+
+#include <QThread>
+#include <QByteArray>
+#include <QHash>
+
+#include <atomic>
+
+#include <mpv/client.h>
+
+#include "QtHelper.h"
+#include "utils/SpscQueue.h"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// A player state change, as handed from the event thread to the GUI thread. This is a flat copy
+// of the parts of mpv_event that PlayerComponent cares about, because the mpv_event itself is
+// only valid until the next mpv_wait_event() call.
+struct PlayerEvent
+{
+  PlayerEvent()
+    : id(MPV_EVENT_NONE), replyUserdata(0), format(MPV_FORMAT_NONE), endReason(0), endError(0), hookId(0),
+      error(0), playlistEntryId(0)
+  {
+    value.int64 = 0;
+  }
+
+  mpv_event_id id;
+
+  // MPV_EVENT_PROPERTY_CHANGE: observer ID and value. Node values are not copied, since
+  // observers treat them as change notifications only.
+  uint64_t replyUserdata;
+  mpv_format format;
+  union
+  {
+    int flag;
+    int64_t int64;
+    double double_;
+  } value;
+
+  // MPV_EVENT_END_FILE
+  int endReason;
+  int endError;
+
+  // MPV_EVENT_HOOK (name, hookId) and the legacy client message hooks (name, resumeId).
+  QByteArray name;
+  uint64_t hookId;
+  QByteArray resumeId;
+
+  // MPV_EVENT_COMMAND_REPLY (replyUserdata, error)
+  int error;
+
+  // MPV_EVENT_START_FILE: the playlist entry and the path of the file. MPV_EVENT_COMMAND_REPLY:
+  // the entry a loadfile added. See PlayerEventThread::playlistEntryId().
+  int64_t playlistEntryId;
+  QByteArray path;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Owns the mpv_wait_event() loop when PlayerComponent runs in event thread mode. Log messages are
+// handled directly on this thread. Property changes are coalesced, so that a burst of e.g.
+// playback-time updates turns into one update. Everything else is forwarded to the GUI thread
+// via a lock-free queue, with a single eventsPending() notification per batch.
+class PlayerEventThread : public QThread
+{
+  Q_OBJECT
+public:
+  explicit PlayerEventThread(mpv::qt::Handle mpv, QObject* parent = nullptr);
+  ~PlayerEventThread() override;
+
+  // Stop the event loop and wait for the thread to exit.
+  void stop();
+
+  // Consumer side, to be called from the GUI thread only. Call beginTakeEvents() before draining
+  // the queue with takeEvent(), so that new events arriving during draining raise a new
+  // eventsPending() signal.
+  void beginTakeEvents() { m_notified.store(false, std::memory_order_release); }
+  bool takeEvent(PlayerEvent& event) { return m_queue.pop(event); }
+
+  // Write an mpv log message to our log. Thread-safe.
+  static void logMessage(const mpv_event_log_message* msg);
+  // The playlist entry a START_FILE is for, or the one a loadfile command reply added. 0 if there
+  // is none, or the client API is too old to tell.
+  static int64_t playlistEntryId(const mpv_event* event);
+  // The path of the file being played. Thread-safe.
+  static QByteArray playingPath(mpv_handle* mpv);
+
+Q_SIGNALS:
+  void eventsPending();
+
+protected:
+  void run() override;
+
+private:
+  void handleEvent(mpv_event* event);
+  void flushProperties();
+  void queueEvent(PlayerEvent&& event);
+
+  mpv::qt::Handle m_mpv;
+  std::atomic<bool> m_quit;
+  std::atomic<bool> m_notified;
+  SpscQueue<PlayerEvent, 256> m_queue;
+
+  // Only accessed by the event thread.
+  QHash<uint64_t, PlayerEvent> m_pendingProperties;
+};
+
+#endif // PLAYEREVENTTHREAD_H
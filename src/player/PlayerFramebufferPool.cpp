@@ -0,0 +1,93 @@
+#include "PlayerFramebufferPool.h"
+
+#include "QsLog.h"
+
+// Framebuffer sizes are rounded up to multiples of this.
+#define FBO_BUCKET_STEP 128
+
+// A framebuffer is still used for a smaller rectangle as long as neither side is more than this
+// many times what's needed.
+#define FBO_MAX_OVERSIZE 1.5
+
+// Framebuffers kept; the least recently used ones are deleted first.
+#define FBO_POOL_SIZE 3
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+QSize FramebufferPool::bucket(const QSize& size)
+{
+  auto roundUp = [](int value) { return ((value + FBO_BUCKET_STEP - 1) / FBO_BUCKET_STEP) * FBO_BUCKET_STEP; };
+  return QSize(roundUp(size.width()), roundUp(size.height()));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool FramebufferPool::suits(const QOpenGLFramebufferObject* fbo, const QSize& size)
+{
+  QSize fboSize = fbo->size();
+  QSize largest = bucket(QSize((int)(size.width() * FBO_MAX_OVERSIZE), (int)(size.height() * FBO_MAX_OVERSIZE)));
+  return fboSize.width() >= size.width() && fboSize.height() >= size.height() &&
+         fboSize.width() <= largest.width() && fboSize.height() <= largest.height();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+QOpenGLFramebufferObject* FramebufferPool::acquire(const QSize& size)
+{
+  if (size.isEmpty())
+    return nullptr;
+
+  // Stay with the current one while it suits, so rectangle animations don't switch back and
+  // forth between buckets.
+  Entry* best = nullptr;
+  for (Entry& entry : m_entries)
+  {
+    if (!suits(entry.fbo, size))
+      continue;
+    if (entry.fbo == m_current)
+    {
+      best = &entry;
+      break;
+    }
+    QSize entrySize = entry.fbo->size();
+    if (!best || entrySize.width() * entrySize.height() < best->fbo->size().width() * best->fbo->size().height())
+      best = &entry;
+  }
+
+  if (!best)
+  {
+    QOpenGLFramebufferObject* fbo = new QOpenGLFramebufferObject(bucket(size));
+    if (!fbo->isValid())
+    {
+      QLOG_WARN() << "Could not create a framebuffer of" << bucket(size);
+      delete fbo;
+      return nullptr;
+    }
+    m_allocations++;
+
+    if (m_entries.size() >= FBO_POOL_SIZE)
+    {
+      int oldest = 0;
+      for (int n = 1; n < m_entries.size(); n++)
+      {
+        if (m_entries[n].lastUsed < m_entries[oldest].lastUsed)
+          oldest = n;
+      }
+      delete m_entries[oldest].fbo;
+      m_entries.removeAt(oldest);
+    }
+
+    m_entries.append(Entry{fbo, 0});
+    best = &m_entries.last();
+  }
+
+  best->lastUsed = ++m_clock;
+  m_current = best->fbo;
+  return m_current;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void FramebufferPool::clear()
+{
+  for (const Entry& entry : m_entries)
+    delete entry.fbo;
+  m_entries.clear();
+  m_current = nullptr;
+}
@@ -0,0 +1,45 @@
+#ifndef PLAYERFRAMEBUFFERPOOL_H
+#define PLAYERFRAMEBUFFERPOOL_H
+
+#include <QList>
+#include <QSize>
+#include <QOpenGLFramebufferObject>
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// A few framebuffers for rendering the video into, in sizes rounded up to buckets. Video
+// rectangle animations pass through many sizes; the current framebuffer is kept as long as the
+// rectangle fits and doesn't shrink too far below it, and earlier ones are kept around for
+// when the animation goes back. All of it must be used with the render thread's GL context
+// current.
+class FramebufferPool
+{
+public:
+  FramebufferPool() : m_current(nullptr), m_clock(0), m_allocations(0) {}
+  ~FramebufferPool() { clear(); }
+
+  // A framebuffer at least size large. The video should only be rendered into its size x size
+  // bottom left corner.
+  QOpenGLFramebufferObject* acquire(const QSize& size);
+  void clear();
+
+  // Framebuffers created so far.
+  int allocations() const { return m_allocations; }
+
+private:
+  struct Entry
+  {
+    QOpenGLFramebufferObject* fbo;
+    quint64 lastUsed;
+  };
+
+  static QSize bucket(const QSize& size);
+  // Whether fbo is large enough for size, without wasting too much of it.
+  static bool suits(const QOpenGLFramebufferObject* fbo, const QSize& size);
+
+  QList<Entry> m_entries;
+  QOpenGLFramebufferObject* m_current;
+  quint64 m_clock;
+  int m_allocations;
+};
+
+#endif // PLAYERFRAMEBUFFERPOOL_H
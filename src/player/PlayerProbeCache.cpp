@@ -0,0 +1,249 @@
+#include "PlayerProbeCache.h"
+
+#include <QCoreApplication>
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDateTime>
+#include <QFile>
+#include <QUrl>
+
+#include "shared/Paths.h"
+#include "utils/Utils.h"
+#include "QsLog.h"
+
+// Number of items kept; the least recently used ones are dropped first.
+#define PROBE_CACHE_ITEMS 500
+
+// Bump when the file layout changes; files with another version are ignored.
+#define PROBE_CACHE_VERSION 1
+
+// Changes are written this long after the first one, so a load doesn't wait for the disk.
+#define PROBE_CACHE_SAVE_DELAY_MS 10000
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static QDataStream& operator<<(QDataStream& out, const StreamInfo& stream)
+{
+  return out << stream.isVideo << stream.isAudio << stream.codec << stream.profile
+             << (qint32)stream.audioChannels << (qint32)stream.audioSampleRate << stream.videoResolution;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static QDataStream& operator>>(QDataStream& in, StreamInfo& stream)
+{
+  qint32 channels = 0, sampleRate = 0;
+  in >> stream.isVideo >> stream.isAudio >> stream.codec >> stream.profile
+     >> channels >> sampleRate >> stream.videoResolution;
+  stream.audioChannels = channels;
+  stream.audioSampleRate = sampleRate;
+  return in;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+const StreamInfo* ProbeInfo::findByIndex(int ffIndex) const
+{
+  int pos = ffIndexes.indexOf(ffIndex);
+  return pos >= 0 ? &streams[pos] : nullptr;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool ProbeInfo::sameAs(const ProbeInfo& other) const
+{
+  if (demuxer != other.demuxer || format != other.format || complete != other.complete ||
+      ffIndexes != other.ffIndexes || streams.size() != other.streams.size())
+    return false;
+
+  for (int n = 0; n < streams.size(); n++)
+  {
+    const StreamInfo& a = streams[n];
+    const StreamInfo& b = other.streams[n];
+    if (a.isVideo != b.isVideo || a.isAudio != b.isAudio || a.codec != b.codec || a.profile != b.profile ||
+        a.audioChannels != b.audioChannels || a.audioSampleRate != b.audioSampleRate ||
+        a.videoResolution != b.videoResolution)
+      return false;
+  }
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+ProbeCache::ProbeCache() : m_loaded(false)
+{
+  m_saveTimer.setSingleShot(true);
+  m_saveTimer.setInterval(PROBE_CACHE_SAVE_DELAY_MS);
+  QObject::connect(&m_saveTimer, &QTimer::timeout, [this]() { save(); });
+  if (qApp)
+    QObject::connect(qApp, &QCoreApplication::aboutToQuit, &m_saveTimer, [this]() { flush(); });
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+ProbeCache::~ProbeCache()
+{
+  flush();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+QString ProbeCache::key(const QVariantMap& metadata, const QString& url)
+{
+  QString itemId = metadata["metadata"].toMap()["Id"].toString();
+  if (itemId.isEmpty())
+    return QString();
+
+  QString signature = QUrl(url).adjusted(QUrl::RemoveQuery | QUrl::RemoveFragment).toString(QUrl::FullyEncoded);
+  QByteArray hash = QCryptographicHash::hash(signature.toUtf8(), QCryptographicHash::Sha1).toHex();
+  return itemId + "/" + metadata["media"].toMap()["id"].toString() + "/" + QString(hash);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+ProbeInfo ProbeCache::fromTracks(const QString& demuxer, const QString& format, const TrackList& tracks,
+                                 const ServerMediaInfo& serverInfo)
+{
+  ProbeInfo info;
+  info.demuxer = demuxer;
+  info.format = format;
+  info.complete = true;
+
+  for (const TrackInfo* track : tracks.forFile(QString()))
+  {
+    StreamInfo stream = {};
+    stream.isVideo = track->type == "video";
+    stream.isAudio = track->type == "audio";
+    stream.codec = track->codec;
+    stream.audioChannels = track->demuxChannelCount;
+    stream.audioSampleRate = track->demuxSampleRate;
+    stream.videoResolution = QSize(track->demuxWidth, track->demuxHeight);
+
+    // mpv doesn't report the profile.
+    const StreamInfo* serverStream = serverInfo.findByIndex(track->ffIndex);
+    if (serverStream)
+      stream.profile = serverStream->profile;
+
+    if ((stream.isAudio && (stream.audioChannels <= 0 || stream.audioSampleRate <= 0)) ||
+        (stream.isVideo && stream.videoResolution.isEmpty()) || stream.codec.isEmpty())
+      info.complete = false;
+
+    info.ffIndexes << track->ffIndex;
+    info.streams << stream;
+  }
+
+  if (info.streams.isEmpty())
+    info.complete = false;
+
+  return info;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+ProbeInfo ProbeCache::find(const QString& key)
+{
+  load();
+
+  auto it = m_entries.find(key);
+  if (key.isEmpty() || it == m_entries.end())
+    return ProbeInfo();
+
+  // Persisted with the next change.
+  it->lastUsed = QDateTime::currentMSecsSinceEpoch() / 1000;
+  return *it;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void ProbeCache::insert(const QString& key, const ProbeInfo& info)
+{
+  if (key.isEmpty() || !info.isValid())
+    return;
+
+  load();
+
+  // Nothing new; find() already marked it as used.
+  auto existing = m_entries.constFind(key);
+  if (existing != m_entries.constEnd() && existing->sameAs(info))
+    return;
+
+  ProbeInfo entry = info;
+  entry.lastUsed = QDateTime::currentMSecsSinceEpoch() / 1000;
+  m_entries.insert(key, entry);
+
+  while (m_entries.size() > PROBE_CACHE_ITEMS)
+  {
+    auto oldest = m_entries.begin();
+    for (auto it = m_entries.begin(); it != m_entries.end(); ++it)
+    {
+      if (it->lastUsed < oldest->lastUsed)
+        oldest = it;
+    }
+    m_entries.erase(oldest);
+  }
+
+  if (!m_saveTimer.isActive())
+    m_saveTimer.start();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void ProbeCache::remove(const QString& key)
+{
+  load();
+  if (m_entries.remove(key) && !m_saveTimer.isActive())
+    m_saveTimer.start();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void ProbeCache::flush()
+{
+  if (!m_saveTimer.isActive())
+    return;
+  m_saveTimer.stop();
+  save();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void ProbeCache::load()
+{
+  if (m_loaded)
+    return;
+  m_loaded = true;
+
+  QFile file(Paths::cacheDir("probecache.bin"));
+  if (!file.open(QIODevice::ReadOnly))
+    return;
+
+  QDataStream in(&file);
+  in.setVersion(QDataStream::Qt_5_6);
+
+  qint32 version = 0;
+  in >> version;
+  if (version != PROBE_CACHE_VERSION)
+    return;
+
+  qint32 count = 0;
+  in >> count;
+  for (int n = 0; n < count && in.status() == QDataStream::Ok; n++)
+  {
+    QString key;
+    ProbeInfo info;
+    in >> key >> info.demuxer >> info.format >> info.complete >> info.ffIndexes >> info.streams >> info.lastUsed;
+    if (in.status() == QDataStream::Ok && info.ffIndexes.size() == info.streams.size())
+      m_entries.insert(key, info);
+  }
+
+  if (in.status() != QDataStream::Ok)
+  {
+    QLOG_WARN() << "Discarding corrupted probe cache.";
+    m_entries.clear();
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void ProbeCache::save()
+{
+  QByteArray data;
+  QDataStream out(&data, QIODevice::WriteOnly);
+  out.setVersion(QDataStream::Qt_5_6);
+
+  out << (qint32)PROBE_CACHE_VERSION << (qint32)m_entries.size();
+  for (auto it = m_entries.constBegin(); it != m_entries.constEnd(); ++it)
+  {
+    const ProbeInfo& info = it.value();
+    out << it.key() << info.demuxer << info.format << info.complete << info.ffIndexes << info.streams << info.lastUsed;
+  }
+
+  if (!Utils::safelyWriteFile(Paths::cacheDir("probecache.bin"), data))
+    QLOG_WARN() << "Could not write the probe cache.";
+}
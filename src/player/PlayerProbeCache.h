@@ -0,0 +1,68 @@
+#ifndef PLAYERPROBECACHE_H
+#define PLAYERPROBECACHE_H
+
+#include <QString>
+#include <QList>
+#include <QHash>
+#include <QTimer>
+
+#include "CodecsComponent.h"
+#include "PlayerTracks.h"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// What opening an item found out about it: the demuxer, the container format, and the streams
+// of the main file with their codec parameters.
+struct ProbeInfo
+{
+  ProbeInfo() : complete(false), lastUsed(0) {}
+
+  bool isValid() const { return !demuxer.isEmpty(); }
+  // The stream with the given ff-index, or null.
+  const StreamInfo* findByIndex(int ffIndex) const;
+  // Whether both describe the same, not counting when they were used.
+  bool sameAs(const ProbeInfo& other) const;
+
+  QString demuxer; // mpv's current-demuxer, e.g. "lavf" or "mkv"
+  QString format;  // mpv's file-format
+  // Set if every stream had its codec parameters, i.e. probing the streams again adds nothing.
+  bool complete;
+  QList<int> ffIndexes; // parallel to streams
+  QList<StreamInfo> streams;
+  qint64 lastUsed; // seconds since the epoch
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Probe results of recently played items, persisted as one small file in the cache directory.
+// Changes are written a while later, off the loading path, and when the application quits.
+// Only used from the GUI thread.
+class ProbeCache
+{
+public:
+  ProbeCache();
+  ~ProbeCache();
+
+  // Identifies an item and the way it's played: the server's item and media IDs, and the URL
+  // without its query (which carries session tokens). Empty if the item has no ID.
+  static QString key(const QVariantMap& metadata, const QString& url);
+
+  // Build an entry from the open file's track list.
+  static ProbeInfo fromTracks(const QString& demuxer, const QString& format, const TrackList& tracks,
+                              const ServerMediaInfo& serverInfo);
+
+  ProbeInfo find(const QString& key);
+  void insert(const QString& key, const ProbeInfo& info);
+  void remove(const QString& key);
+
+  // Write pending changes now.
+  void flush();
+
+private:
+  void load();
+  void save();
+
+  bool m_loaded;
+  QHash<QString, ProbeInfo> m_entries;
+  QTimer m_saveTimer;
+};
+
+#endif // PLAYERPROBECACHE_H
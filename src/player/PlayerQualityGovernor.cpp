@@ -0,0 +1,237 @@
+#include "PlayerQualityGovernor.h"
+
+#include <QDateTime>
+
+#include <math.h>
+
+#include "settings/SettingsComponent.h"
+#include "settings/SettingsSection.h"
+#include "QtHelper.h"
+#include "QsLog.h"
+
+// Interval at which the drop counters are sampled.
+#define QUALITY_SAMPLE_MS 2000
+
+// Consecutive bad samples before stepping down.
+#define QUALITY_BAD_SAMPLES 2
+
+// Samples ignored after a step, while the player settles.
+#define QUALITY_COOLDOWN_SAMPLES 3
+
+// A sample is bad if more than this share of the frames was dropped or mistimed...
+#define QUALITY_MAX_DROP_RATIO 0.05
+// ...or audio and video are further apart than this (seconds).
+#define QUALITY_MAX_AVSYNC 0.2
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static QByteArray getPropertyString(mpv_handle* mpv, const char* name)
+{
+  char* value = mpv_get_property_string(mpv, name);
+  QByteArray res(value ? value : "");
+  mpv_free(value);
+  return res;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+QualityGovernor::QualityGovernor(QObject* parent)
+  : QObject(parent), m_mpv(nullptr), m_timer(this), m_enabled(false), m_level(0), m_lastDrops(0),
+    m_badSamples(0), m_cooldown(0)
+{
+  m_timer.setInterval(QUALITY_SAMPLE_MS);
+  connect(&m_timer, &QTimer::timeout, this, &QualityGovernor::sample);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool QualityGovernor::reset()
+{
+  m_enabled = SettingsComponent::Get().value(SETTINGS_SECTION_VIDEO, "quality.governor").toBool();
+  m_ladder.clear();
+  for (const QString& step : SettingsComponent::Get().value(SETTINGS_SECTION_VIDEO, "quality.ladder").toString().split(","))
+  {
+    if (!step.trimmed().isEmpty())
+      m_ladder << step.trimmed();
+  }
+
+  bool restored = !m_original.isEmpty();
+  if (m_mpv)
+  {
+    for (int n = m_original.size() - 1; n >= 0; n--)
+      mpv_set_property_string(m_mpv, m_original[n].first.constData(), m_original[n].second.constData());
+  }
+  if (restored)
+    QLOG_INFO() << "Restoring playback quality settings.";
+
+  m_original.clear();
+  m_applied.clear();
+  m_taken.clear();
+  m_level = 0;
+  m_badSamples = 0;
+  m_cooldown = 0;
+  return restored;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void QualityGovernor::setActive(bool active)
+{
+  if (active && m_enabled && m_mpv && m_level < m_ladder.size())
+  {
+    if (m_timer.isActive())
+      return;
+    readCounters();
+    m_badSamples = 0;
+    m_timer.start();
+  }
+  else
+  {
+    m_timer.stop();
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void QualityGovernor::reapply()
+{
+  if (!m_mpv)
+    return;
+  for (auto it = m_applied.constBegin(); it != m_applied.constEnd(); ++it)
+    mpv_set_property_string(m_mpv, it.key().constData(), it.value().constData());
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void QualityGovernor::readCounters()
+{
+  m_lastDrops = mpv::qt::get_property(m_mpv, "vo-drop-frame-count").toLongLong() +
+                mpv::qt::get_property(m_mpv, "decoder-frame-drop-count").toLongLong() +
+                mpv::qt::get_property(m_mpv, "mistimed-frame-count").toLongLong();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void QualityGovernor::sample()
+{
+  qint64 previous = m_lastDrops;
+  readCounters();
+
+  if (m_cooldown > 0)
+  {
+    m_cooldown--;
+    return;
+  }
+
+  qint64 drops = m_lastDrops - previous;
+  double avsync = fabs(mpv::qt::get_property(m_mpv, "avsync").toDouble());
+  double fps = mpv::qt::get_property(m_mpv, "container-fps").toDouble();
+  if (fps <= 0)
+    fps = 24;
+  double maxDrops = qMax(2.0, fps * QUALITY_SAMPLE_MS / 1000 * QUALITY_MAX_DROP_RATIO);
+
+  if (drops <= maxDrops && avsync <= QUALITY_MAX_AVSYNC)
+  {
+    m_badSamples = 0;
+    return;
+  }
+
+  if (++m_badSamples < QUALITY_BAD_SAMPLES)
+    return;
+
+  QString reason = QString("%1 frames dropped in %2 ms, avsync %3 s").arg(drops).arg(QUALITY_SAMPLE_MS).arg(avsync, 0, 'f', 3);
+  m_badSamples = 0;
+  m_cooldown = QUALITY_COOLDOWN_SAMPLES;
+  if (!stepDown(reason))
+  {
+    QLOG_INFO() << "Playback is falling behind (" << reason << "), but nothing is left to turn down.";
+    m_timer.stop();
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+QList<QPair<QByteArray, QByteArray>> QualityGovernor::stepProperties(const QString& step) const
+{
+  QList<QPair<QByteArray, QByteArray>> props;
+  if (step == "hwdec")
+  {
+    QByteArray hwdec = getPropertyString(m_mpv, "hwdec");
+    if (hwdec.isEmpty() || hwdec == "no" || hwdec.endsWith("-copy"))
+      props << qMakePair(QByteArray("hwdec"), QByteArray("auto"));
+  }
+  else if (step == "deinterlace")
+  {
+    props << qMakePair(QByteArray("deinterlace"), QByteArray("no"));
+  }
+  else if (step == "scalers")
+  {
+    props << qMakePair(QByteArray("scale"), QByteArray("bilinear"))
+          << qMakePair(QByteArray("cscale"), QByteArray("bilinear"))
+          << qMakePair(QByteArray("dscale"), QByteArray("bilinear"))
+          << qMakePair(QByteArray("sigmoid-upscaling"), QByteArray("no"))
+          << qMakePair(QByteArray("correct-downscaling"), QByteArray("no"))
+          << qMakePair(QByteArray("deband"), QByteArray("no"));
+  }
+  else if (step == "video-sync")
+  {
+    props << qMakePair(QByteArray("video-sync"), QByteArray("audio"))
+          << qMakePair(QByteArray("framedrop"), QByteArray("decoder+vo"));
+  }
+  return props;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool QualityGovernor::stepDown(const QString& reason)
+{
+  while (m_level < m_ladder.size())
+  {
+    QString step = m_ladder[m_level++];
+    bool changed = false;
+
+    if (step == "bitrate")
+    {
+      emit lowerBitrateRequested();
+      changed = true;
+    }
+    else
+    {
+      for (auto prop : stepProperties(step))
+      {
+        QByteArray current = getPropertyString(m_mpv, prop.first.constData());
+        if (current == prop.second)
+          continue;
+
+        bool saved = false;
+        for (auto original : m_original)
+          saved = saved || original.first == prop.first;
+        if (!saved)
+          m_original << qMakePair(prop.first, current);
+
+        if (mpv_set_property_string(m_mpv, prop.first.constData(), prop.second.constData()) >= 0)
+        {
+          m_applied.insert(prop.first, prop.second);
+          changed = true;
+        }
+      }
+    }
+
+    if (!changed)
+      continue;
+
+    QLOG_WARN() << "Playback is falling behind (" << reason << "), quality step:" << step;
+
+    QVariantMap taken;
+    taken.insert("step", step);
+    taken.insert("reason", reason);
+    taken.insert("time", QDateTime::currentMSecsSinceEpoch());
+    m_taken << taken;
+
+    emit stepApplied(step, reason);
+    return true;
+  }
+  return false;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+QVariantMap QualityGovernor::state() const
+{
+  QVariantMap res;
+  res.insert("enabled", m_enabled);
+  res.insert("ladder", m_ladder);
+  res.insert("level", m_taken.size());
+  res.insert("steps", m_taken);
+  return res;
+}
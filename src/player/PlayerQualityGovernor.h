@@ -0,0 +1,70 @@
+#ifndef PLAYERQUALITYGOVERNOR_H
+#define PLAYERQUALITYGOVERNOR_H
+
+#include <QObject>
+#include <QTimer>
+#include <QVariant>
+#include <QStringList>
+#include <QHash>
+
+#include <mpv/client.h>
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Watches frame drops and A/V desync while video is playing, and if the player keeps falling
+// behind, works down a ladder of cheaper settings, one step at a time. The ladder is the hidden
+// video setting quality.ladder, a comma separated list of:
+//  - hwdec:       hardware decoding, or direct instead of copy-back mode
+//  - deinterlace: no deinterlacing
+//  - scalers:     bilinear scaling, no debanding
+//  - video-sync:  audio sync, with decoder frame dropping
+//  - bitrate:     ask the client for a lower transcode bitrate (see lowerBitrateRequested())
+// Steps only last for the current item.
+class QualityGovernor : public QObject
+{
+  Q_OBJECT
+public:
+  explicit QualityGovernor(QObject* parent = nullptr);
+
+  // The player whose settings are governed.
+  void setPlayer(mpv_handle* mpv) { m_mpv = mpv; }
+
+  // Start over for a new item. Returns true if settings taken down for the previous item were
+  // restored, in which case the user settings should be applied again.
+  bool reset();
+
+  // Only sample while video is actually playing: drops during seeks and loading are expected.
+  void setActive(bool active);
+
+  // Set the properties of the steps taken again, after the user settings were applied.
+  void reapply();
+
+  // Level and steps taken for the current item, for the web client.
+  QVariantMap state() const;
+
+Q_SIGNALS:
+  void stepApplied(const QString& step, const QString& reason);
+  void lowerBitrateRequested();
+
+private:
+  Q_SLOT void sample();
+  // Apply the next step of the ladder that changes anything. Returns false if none is left.
+  bool stepDown(const QString& reason);
+  QList<QPair<QByteArray, QByteArray>> stepProperties(const QString& step) const;
+  void readCounters();
+
+  mpv_handle* m_mpv;
+  QTimer m_timer;
+  bool m_enabled;
+  QStringList m_ladder;
+  int m_level;                    // next position in m_ladder
+  QVariantList m_taken;
+  // Property values from before the first change, to restore on reset().
+  QList<QPair<QByteArray, QByteArray>> m_original;
+  QHash<QByteArray, QByteArray> m_applied;
+
+  qint64 m_lastDrops;
+  int m_badSamples;
+  int m_cooldown;                 // samples to skip after a change
+};
+
+#endif // PLAYERQUALITYGOVERNOR_H
@@ -6,16 +6,25 @@
 #include <QGuiApplication>
 #include <QOpenGLContext>
 #include <QRunnable>
+#include <QScreen>
+#include <QTimer>
+#include <QOffscreenSurface>
+#include <QOpenGLExtraFunctions>
 
 #include <QtGui/QOpenGLFramebufferObject>
 
 #include <QtQuick/QQuickWindow>
+#include <QtQuick/QSGRendererInterface>
+#include <QtQuick/QSGSimpleTextureNode>
+#include <QtQuick/QSGTexture>
 #include <QOpenGLFunctions>
 
 #include <mpv/render_gl.h>
 
 #include "QsLog.h"
 #include "utils/Utils.h"
+#include "settings/SettingsComponent.h"
+#include "settings/SettingsSection.h"
 
 
 #if defined(Q_OS_WIN32)
@@ -29,6 +38,22 @@
 #include <qpa/qplatformnativeinterface.h>
 #endif
 
+#ifndef GL_READ_FRAMEBUFFER
+#define GL_READ_FRAMEBUFFER 0x8CA8
+#endif
+#ifndef GL_DRAW_FRAMEBUFFER
+#define GL_DRAW_FRAMEBUFFER 0x8CA9
+#endif
+#ifndef GL_BGRA
+#define GL_BGRA 0x80E1
+#endif
+#ifndef GL_UNSIGNED_INT_8_8_8_8_REV
+#define GL_UNSIGNED_INT_8_8_8_8_REV 0x8367
+#endif
+#ifndef GL_UNPACK_ROW_LENGTH
+#define GL_UNPACK_ROW_LENGTH 0x0CF2
+#endif
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 static void* get_proc_address(void* ctx, const char* name)
 {
@@ -54,6 +79,59 @@ static void* get_proc_address(void* ctx, const char* name)
   return res;
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Create an OpenGL render context for the player, in the current GL context.
+static int createRenderContext(mpv_handle* mpv, mpv_render_context** ctx)
+{
+  mpv_opengl_init_params opengl_params = {
+#ifdef Q_OS_WIN32
+      get_proc_address,
+      NULL,
+#else
+      .get_proc_address = get_proc_address,
+      .get_proc_address_ctx = NULL,
+#endif
+  };
+
+  const QString platformName = QGuiApplication::platformName();
+
+  mpv_render_param params[] = {
+    {MPV_RENDER_PARAM_API_TYPE, (void*)MPV_RENDER_API_TYPE_OPENGL},
+    {MPV_RENDER_PARAM_OPENGL_INIT_PARAMS, &opengl_params},
+    {MPV_RENDER_PARAM_INVALID},
+    {MPV_RENDER_PARAM_INVALID},
+  };
+#ifdef USE_X11EXTRAS
+  if (platformName.contains("xcb")) {
+    params[2].type = MPV_RENDER_PARAM_X11_DISPLAY;
+    params[2].data = QX11Info::display();
+  } else if (platformName.contains("wayland")) {
+    QPlatformNativeInterface *native = QGuiApplication::platformNativeInterface();
+    params[2].type = MPV_RENDER_PARAM_WL_DISPLAY;
+    params[2].data = native->nativeResourceForWindow("display", NULL);
+  }
+#endif
+  return mpv_render_context_create(ctx, mpv, params);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// mpv's target time of the next frame (mpv_get_time_us() clock), 0 if there is none or it has no
+// timing.
+static int64_t nextFrameTarget(mpv_render_context* ctx, bool* redraw = nullptr)
+{
+  mpv_render_frame_info info = {};
+  mpv_render_param params[] = {
+    {MPV_RENDER_PARAM_NEXT_FRAME_INFO, &info},
+    {MPV_RENDER_PARAM_INVALID}
+  };
+  if (mpv_render_context_get_info(ctx, params) < 0 || !(info.flags & MPV_RENDER_FRAME_INFO_PRESENT))
+    return 0;
+
+  if (redraw)
+    *redraw = info.flags & MPV_RENDER_FRAME_INFO_REDRAW;
+  return info.target_time > 0 ? info.target_time : 0;
+}
+
 namespace {
 
 /////////////////////////////////////////////////////////////////////////////////////////
@@ -80,9 +158,273 @@ private:
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-PlayerRenderer::PlayerRenderer(mpv::qt::Handle mpv, QQuickWindow* window)
-: m_mpv(mpv), m_mpvGL(nullptr), m_window(window), m_size(), m_hAvrtHandle(nullptr), m_videoRectangle(-1, -1, -1, -1), m_fbo(0)
+static void requestRepaint(QQuickWindow* window, bool threadedLoop)
+{
+  // QQuickWindow::scheduleRenderJob is expected to be called from the GUI thread but
+  // is thread-safe when using the QSGThreadedRenderLoop. We can detect a non-threaded render
+  // loop by checking if QQuickWindow::beforeSynchronizing was called from the GUI thread
+  // (which affects the QObject::thread() of the PlayerRenderer).
+  //
+  if (!threadedLoop)
+    QMetaObject::invokeMethod(window, "update", Qt::QueuedConnection);
+  else
+    window->scheduleRenderJob(new RequestRepaintJob(window), QQuickWindow::NoStage);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+VideoRenderThread::VideoRenderThread(mpv::qt::Handle mpv, mpv::qt::Handle standby, QQuickWindow* window, QOffscreenSurface* surface)
+  : m_mpv(mpv), m_standby(standby), m_window(window), m_surface(surface), m_context(nullptr), m_threadedLoop(false),
+    m_stats(nullptr), m_timing(nullptr), m_initState(0), m_quit(false), m_updatePending(true), m_active(mpv),
+    m_displayed(-1), m_newest(-1)
+{
+  setObjectName("VideoRender");
+  for (int n = 0; n < RingSize; n++)
+    m_slots[n] = nullptr;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+VideoRenderThread::~VideoRenderThread()
+{
+  stopRendering();
+  delete m_context;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool VideoRenderThread::init(bool threadedLoop, RenderStats* stats, RenderTiming* timing)
+{
+  m_threadedLoop = threadedLoop;
+  m_stats = stats;
+  m_timing = timing;
+
+  QOpenGLContext* shareContext = QOpenGLContext::currentContext();
+  if (!shareContext)
+    return false;
+
+  m_context = new QOpenGLContext();
+  m_context->setFormat(shareContext->format());
+  m_context->setShareContext(shareContext);
+  if (!m_context->create())
+  {
+    delete m_context;
+    m_context = nullptr;
+    return false;
+  }
+  m_context->moveToThread(this);
+
+  start(QThread::HighestPriority);
+
+  QMutexLocker lock(&m_lock);
+  while (m_initState == 0)
+    m_wake.wait(&m_lock);
+  return m_initState > 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void VideoRenderThread::stopRendering()
 {
+  {
+    QMutexLocker lock(&m_lock);
+    m_quit = true;
+    m_wake.wakeAll();
+  }
+  wait();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void VideoRenderThread::setActive(mpv_handle* mpv)
+{
+  QMutexLocker lock(&m_lock);
+  if (mpv != m_active)
+  {
+    m_active = mpv;
+    m_updatePending = true;
+    m_wake.wakeAll();
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void VideoRenderThread::setSize(const QSize& size)
+{
+  QMutexLocker lock(&m_lock);
+  if (size != m_size)
+  {
+    m_size = size;
+    m_updatePending = true;
+    m_wake.wakeAll();
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+GLuint VideoRenderThread::acquireFrame(QSize* size, bool* isNew)
+{
+  QMutexLocker lock(&m_lock);
+  *isNew = m_newest >= 0 && m_newest != m_displayed;
+  m_displayed = m_newest;
+  if (m_displayed < 0)
+    return 0;
+
+  *size = m_slots[m_displayed]->size();
+  return m_slots[m_displayed]->texture();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void VideoRenderThread::on_update(void *ctx)
+{
+  VideoRenderThread *self = (VideoRenderThread *)ctx;
+  QMutexLocker lock(&self->m_lock);
+  self->m_updatePending = true;
+  self->m_wake.wakeAll();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void VideoRenderThread::run()
+{
+  mpv_render_context* mpvGL = nullptr;
+  mpv_render_context* standbyGL = nullptr;
+
+  bool ok = m_context->makeCurrent(m_surface) && createRenderContext(m_mpv, &mpvGL) >= 0;
+  if (ok)
+  {
+    mpv_render_context_set_update_callback(mpvGL, on_update, (void *)this);
+    if (m_standby)
+    {
+      if (createRenderContext(m_standby, &standbyGL) >= 0)
+        mpv_render_context_set_update_callback(standbyGL, on_update, (void *)this);
+      else
+        QLOG_WARN() << "Could not create a render context for the standby player.";
+    }
+  }
+
+  {
+    QMutexLocker lock(&m_lock);
+    m_initState = ok ? 1 : -1;
+    m_wake.wakeAll();
+  }
+  if (!ok)
+  {
+    m_context->doneCurrent();
+    return;
+  }
+
+  QLOG_INFO() << "Rendering video on its own thread.";
+
+  QElapsedTimer clock;
+  clock.start();
+  qint64 lastPresentUs = -1;
+  mpv_render_context* renderedGL = nullptr;
+  QSize renderedSize;
+
+  while (true)
+  {
+    QSize size;
+    mpv_handle* active;
+    {
+      QMutexLocker lock(&m_lock);
+      while (!m_quit && !m_updatePending)
+        m_wake.wait(&m_lock);
+      if (m_quit)
+        break;
+      m_updatePending = false;
+      size = m_size;
+      active = m_active;
+    }
+
+    mpv_render_context* activeGL = (standbyGL && active == (mpv_handle *)m_standby) ? standbyGL : mpvGL;
+    mpv_handle* activeMpv = activeGL == standbyGL ? (mpv_handle *)m_standby : (mpv_handle *)m_mpv;
+
+    bool newFrame = mpv_render_context_update(activeGL) & MPV_RENDER_UPDATE_FRAME;
+    if (size.isEmpty() || (!newFrame && activeGL == renderedGL && size == renderedSize))
+      continue;
+
+    // With three slots, one is always neither shown nor the newest.
+    int slot = 0;
+    {
+      QMutexLocker lock(&m_lock);
+      while (slot == m_displayed || slot == m_newest)
+        slot++;
+    }
+
+    if (!m_slots[slot] || m_slots[slot]->size() != size)
+    {
+      delete m_slots[slot];
+      m_slots[slot] = new QOpenGLFramebufferObject(size);
+      if (m_stats)
+        m_stats->fboAllocations.ref();
+    }
+
+    qint64 startUs = clock.nsecsElapsed() / 1000;
+    int64_t target = m_timing ? nextFrameTarget(activeGL) : 0;
+
+    mpv_opengl_fbo mpv_fbo = {
+#ifdef Q_OS_WIN32
+      (int)m_slots[slot]->handle(),
+      size.width(),
+      size.height(),
+#else
+      .fbo = (int)m_slots[slot]->handle(),
+      .w = size.width(),
+      .h = size.height(),
+#endif
+    };
+    int mpv_flip = 0;
+    mpv_render_param params[] = {
+      {MPV_RENDER_PARAM_OPENGL_FBO, &mpv_fbo},
+      {MPV_RENDER_PARAM_FLIP_Y, &mpv_flip},
+      {MPV_RENDER_PARAM_INVALID}
+    };
+    mpv_render_context_render(activeGL, params);
+
+    // The scene graph's context reads the texture next; it has to be complete by then.
+    m_context->functions()->glFinish();
+    mpv_render_context_report_swap(activeGL);
+
+    {
+      QMutexLocker lock(&m_lock);
+      m_newest = slot;
+    }
+    renderedGL = activeGL;
+    renderedSize = size;
+
+    qint64 nowUs = clock.nsecsElapsed() / 1000;
+    if (m_stats)
+      m_stats->rendered.ref();
+    if (m_timing)
+    {
+      RenderSample sample;
+      sample.renderUs = (qint32)(nowUs - startUs);
+      sample.intervalUs = (lastPresentUs >= 0 && nowUs - lastPresentUs < 1000000) ? (qint32)(nowUs - lastPresentUs) : RenderSample::Unknown;
+      sample.lateUs = target > 0 ? (qint32)(mpv_get_time_us(activeMpv) - target) : RenderSample::Unknown;
+      m_timing->add(sample);
+    }
+    lastPresentUs = nowUs;
+
+    requestRepaint(m_window, m_threadedLoop);
+  }
+
+  // Keep in mind that the mpv handles must be held until this is done.
+  mpv_render_context_free(mpvGL);
+  if (standbyGL)
+    mpv_render_context_free(standbyGL);
+
+  {
+    QMutexLocker lock(&m_lock);
+    for (int n = 0; n < RingSize; n++)
+    {
+      delete m_slots[n];
+      m_slots[n] = nullptr;
+    }
+    m_displayed = m_newest = -1;
+  }
+  m_context->doneCurrent();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+PlayerRenderer::PlayerRenderer(mpv::qt::Handle mpv, mpv::qt::Handle standby, QQuickWindow* window)
+: m_mpv(mpv), m_standby(standby), m_mpvGL(nullptr), m_standbyGL(nullptr), m_activeGL(nullptr), m_activeMpv(nullptr), m_window(window), m_size(), m_hAvrtHandle(nullptr), m_videoRectangle(-1, -1, -1, -1),
+  m_renderedGL(nullptr), m_renderedFbo(nullptr), m_framePending(true), m_swapPending(false), m_vsyncUs(16666), m_scheduledTime(0), m_stats(nullptr),
+  m_timing(nullptr), m_lastPresentUs(-1), m_frameRenderUs(0), m_frameTarget(0), m_videoThread(nullptr), m_readFbo(0)
+{
+  m_clock.start();
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -93,56 +435,97 @@ bool PlayerRenderer::init()
   DwmEnableMMCSS(TRUE);
 #endif
 
-mpv_opengl_init_params opengl_params = {
-#ifdef Q_OS_WIN32
-      get_proc_address,
-      NULL,
-#else
-      .get_proc_address = get_proc_address,
-      .get_proc_address_ctx = NULL,
-#endif
-};
+  if (m_videoThread)
+  {
+    if (QOpenGLFramebufferObject::hasOpenGLFramebufferBlit() && m_videoThread->init(thread() != m_window->thread(), m_stats, m_timing))
+      return true;
+    QLOG_WARN() << "Could not start the video render thread, rendering on the scene graph's thread.";
+    delete m_videoThread;
+    m_videoThread = nullptr;
+  }
 
-  const QString platformName = QGuiApplication::platformName();
+  int err = createRenderContext(m_mpv, &m_mpvGL);
+  if (err < 0)
+    return false;
+  mpv_render_context_set_update_callback(m_mpvGL, on_update, (void *)this);
+  m_activeGL = m_mpvGL;
+  m_activeMpv = m_mpv;
 
-  mpv_render_param params[] = {
-    {MPV_RENDER_PARAM_API_TYPE, (void*)MPV_RENDER_API_TYPE_OPENGL},
-    {MPV_RENDER_PARAM_OPENGL_INIT_PARAMS, &opengl_params},
-    {MPV_RENDER_PARAM_INVALID},
-    {MPV_RENDER_PARAM_INVALID},
-  };
-#ifdef USE_X11EXTRAS
-  if (platformName.contains("xcb")) {
-    params[2].type = MPV_RENDER_PARAM_X11_DISPLAY;
-    params[2].data = QX11Info::display();
-  } else if (platformName.contains("wayland")) {
-    QPlatformNativeInterface *native = QGuiApplication::platformNativeInterface();
-    params[2].type = MPV_RENDER_PARAM_WL_DISPLAY;
-    params[2].data = native->nativeResourceForWindow("display", NULL);
+  // The standby player renders into the same GL context. It only needs its own render context so
+  // that it can decode the first frames before it's shown.
+  if (m_standby)
+  {
+    if (createRenderContext(m_standby, &m_standbyGL) >= 0)
+      mpv_render_context_set_update_callback(m_standbyGL, on_update, (void *)this);
+    else
+      QLOG_WARN() << "Could not create a render context for the standby player.";
   }
-#endif
-  int err = mpv_render_context_create(&m_mpvGL, m_mpv, params);
+  return true;
+}
 
-  if (err >= 0) {
-    mpv_render_context_set_update_callback(m_mpvGL, on_update, (void *)this);
-    return true;
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlayerRenderer::setActive(mpv_handle* mpv)
+{
+  if (m_videoThread)
+  {
+    m_videoThread->setActive(mpv);
+    return;
   }
-  return false;
+  m_activeGL = (m_standbyGL && mpv == (mpv_handle *)m_standby) ? m_standbyGL : m_mpvGL;
+  m_activeMpv = m_activeGL == m_standbyGL ? (mpv_handle *)m_standby : (mpv_handle *)m_mpv;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 PlayerRenderer::~PlayerRenderer()
 {
+  delete m_videoThread;
+  if (m_readFbo && QOpenGLContext::currentContext())
+    QOpenGLContext::currentContext()->functions()->glDeleteFramebuffers(1, &m_readFbo);
+
   // Keep in mind that the m_mpv handle must be held until this is done.
   if (m_mpvGL)
     mpv_render_context_free(m_mpvGL);
   m_mpvGL = nullptr;
-  delete m_fbo;
+  if (m_standbyGL)
+    mpv_render_context_free(m_standbyGL);
+  m_standbyGL = nullptr;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool PlayerRenderer::frameDueLater()
+{
+  // Redraws (e.g. of a paused frame after a seek) and frames without timing go out right away.
+  bool redraw = false;
+  int64_t target = nextFrameTarget(m_activeGL, &redraw);
+  if (target == 0 || redraw)
+    return false;
+
+  int64_t wait = target - mpv_get_time_us(m_activeMpv);
+  if (wait <= m_vsyncUs)
+    return false;
+
+  // Repaint one vsync ahead, so mpv_render_context_render() doesn't block the render thread
+  // for long waiting for the frame's time.
+  if (target != m_scheduledTime)
+  {
+    m_scheduledTime = target;
+    emit frameScheduled((int)((wait - m_vsyncUs) / 1000));
+  }
+  return true;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 void PlayerRenderer::render()
 {
+  if (m_videoThread)
+  {
+    renderFromThread();
+    return;
+  }
+
+  qint64 startUs = m_clock.nsecsElapsed() / 1000;
+  bool rendered = false;
+
   QOpenGLContext *context = QOpenGLContext::currentContext();
 
   GLint fbo = 0;
@@ -158,62 +541,170 @@ void PlayerRenderer::render()
   m_window->resetOpenGLState();
 
   QRect fullWindow(0, 0, m_size.width(), m_size.height());
-  if (m_videoRectangle.width() > 0 && m_videoRectangle.height() > 0 && m_videoRectangle != fullWindow && QOpenGLFramebufferObject::hasOpenGLFramebufferBlit() && QOpenGLFramebufferObject::hasOpenGLFramebufferObjects())
+  QRect videoRect = fullWindow;
+  if (m_videoRectangle.width() > 0 && m_videoRectangle.height() > 0)
+    videoRect = m_videoRectangle;
+
+  // Render through an FBO even if the video fills the window: when the window is repainted
+  // because the web UI changed, but there's no new video frame, the last one is blitted again
+  // instead of having mpv render it. When the video rectangle only moves, that's all it takes
+  // too. The FBOs come from a pool, so that rectangle animations don't allocate one per size.
+  if (!videoRect.isEmpty() && QOpenGLFramebufferObject::hasOpenGLFramebufferBlit() && QOpenGLFramebufferObject::hasOpenGLFramebufferObjects())
   {
-    if (!m_fbo || !m_fbo->isValid() || m_fbo->size() != m_videoRectangle.size())
-    {
-      delete m_fbo;
-      m_fbo = new QOpenGLFramebufferObject(m_videoRectangle.size());
-    }
-    if (m_fbo && m_fbo->isValid())
+    QOpenGLFramebufferObject* pooled = m_fbos.acquire(videoRect.size());
+    if (m_stats)
+      m_stats->fboAllocations.store(m_fbos.allocations());
+    if (pooled)
     {
-      blitFbo = m_fbo;
-      fboSize = m_fbo->size();
-      fbo = m_fbo->handle();
+      blitFbo = pooled;
+      fboSize = videoRect.size();
+      fbo = pooled->handle();
       flip = false;
 
       // Need to clear the background manually, since nothing else knows it has to be done.
-      context->functions()->glClearColor(0, 0, 0, 0);
-      context->functions()->glClear(GL_COLOR_BUFFER_BIT);
+      if (videoRect != fullWindow)
+      {
+        context->functions()->glClearColor(0, 0, 0, 0);
+        context->functions()->glClear(GL_COLOR_BUFFER_BIT);
+      }
     }
   }
 
-  mpv_opengl_fbo mpv_fbo = {
+  // Collect the update flags even when rendering anyway, so they don't pile up.
+  if (mpv_render_context_update(m_activeGL) & MPV_RENDER_UPDATE_FRAME)
+    m_framePending = true;
+
+  bool haveFrame = blitFbo && m_renderedGL == m_activeGL && m_renderedFbo == blitFbo && m_renderedSize == fboSize;
+  if (!haveFrame || (m_framePending && !frameDueLater()))
+  {
+    mpv_opengl_fbo mpv_fbo = {
 #ifdef Q_OS_WIN32
-    fbo,
-    fboSize.width(),
-    fboSize.height(),
+      fbo,
+      fboSize.width(),
+      fboSize.height(),
 #else
-    .fbo = fbo,
-    .w = fboSize.width(),
-    .h = fboSize.height(),
+      .fbo = fbo,
+      .w = fboSize.width(),
+      .h = fboSize.height(),
 #endif
-  };
-  int mpv_flip = flip ? -1 : 0;
-  mpv_render_param params[] = {
-    {MPV_RENDER_PARAM_OPENGL_FBO, &mpv_fbo},
-    {MPV_RENDER_PARAM_FLIP_Y, &mpv_flip},
-    {MPV_RENDER_PARAM_INVALID}
-  };
-  mpv_render_context_render(m_mpvGL, params);
+    };
+    int mpv_flip = flip ? -1 : 0;
+    mpv_render_param params[] = {
+      {MPV_RENDER_PARAM_OPENGL_FBO, &mpv_fbo},
+      {MPV_RENDER_PARAM_FLIP_Y, &mpv_flip},
+      {MPV_RENDER_PARAM_INVALID}
+    };
+    if (m_timing)
+      m_frameTarget = nextFrameTarget(m_activeGL);
+    mpv_render_context_render(m_activeGL, params);
+    rendered = true;
+
+    m_framePending = false;
+    m_swapPending = true;
+    m_renderedGL = blitFbo ? m_activeGL : nullptr;
+    m_renderedFbo = blitFbo;
+    m_renderedSize = fboSize;
+    if (m_stats)
+      m_stats->rendered.ref();
+  }
+  else if (m_stats)
+  {
+    m_stats->skipped.ref();
+  }
 
   m_window->resetOpenGLState();
 
   if (blitFbo)
   {
-    QRect dstRect = m_videoRectangle;
+    QRect dstRect = videoRect;
     if (screenFlip)
       dstRect = QRect(dstRect.x(), m_size.height() - dstRect.y(), dstRect.width(), dstRect.top() - dstRect.bottom());
 
-    QOpenGLFramebufferObject::blitFramebuffer(0, dstRect, blitFbo, QRect(QPoint(0, 0), blitFbo->size()));
+    QOpenGLFramebufferObject::blitFramebuffer(0, dstRect, blitFbo, QRect(QPoint(0, 0), fboSize));
   }
+
+  if (rendered)
+    m_frameRenderUs = (qint32)(m_clock.nsecsElapsed() / 1000 - startUs);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlayerRenderer::renderFromThread()
+{
+  QOpenGLContext *context = QOpenGLContext::currentContext();
+  QOpenGLExtraFunctions *gl = context->extraFunctions();
+
+  GLint fbo = 0;
+  gl->glGetIntegerv(GL_FRAMEBUFFER_BINDING, &fbo);
+  bool screenFlip = true;
+#if HAVE_OPTIMALORIENTATION
+  screenFlip = !(context->format().orientationFlags() & QSurfaceFormat::MirrorVertically);
+#endif
+
+  m_window->resetOpenGLState();
+
+  QRect fullWindow(0, 0, m_size.width(), m_size.height());
+  QRect videoRect = fullWindow;
+  if (m_videoRectangle.width() > 0 && m_videoRectangle.height() > 0)
+    videoRect = m_videoRectangle;
+  m_videoThread->setSize(videoRect.size());
+
+  // Whatever the video thread finished last; it may still be of the previous size, in which
+  // case it's scaled until the next frame.
+  QSize size;
+  bool isNew = false;
+  GLuint texture = m_videoThread->acquireFrame(&size, &isNew);
+  if (!isNew && m_stats)
+    m_stats->skipped.ref();
+
+  if (!texture || videoRect != fullWindow)
+  {
+    gl->glClearColor(0, 0, 0, 0);
+    gl->glClear(GL_COLOR_BUFFER_BIT);
+  }
+
+  if (texture)
+  {
+    QRect dstRect = videoRect;
+    if (screenFlip)
+      dstRect = QRect(dstRect.x(), m_size.height() - dstRect.y(), dstRect.width(), dstRect.top() - dstRect.bottom());
+
+    // Textures are shared between the contexts, framebuffers aren't.
+    if (!m_readFbo)
+      gl->glGenFramebuffers(1, &m_readFbo);
+    gl->glBindFramebuffer(GL_READ_FRAMEBUFFER, m_readFbo);
+    gl->glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
+    gl->glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fbo);
+    gl->glBlitFramebuffer(0, 0, size.width(), size.height(),
+                          dstRect.x(), dstRect.y(), dstRect.x() + dstRect.width(), dstRect.y() + dstRect.height(),
+                          GL_COLOR_BUFFER_BIT, GL_LINEAR);
+    gl->glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, 0, 0);
+    gl->glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+  }
+
+  m_window->resetOpenGLState();
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 void PlayerRenderer::swap()
 {
-  if (m_mpvGL)
-    mpv_render_context_report_swap(m_mpvGL);
+  // Only swaps that showed a new frame say anything about the video timing.
+  if (m_activeGL && m_swapPending)
+  {
+    mpv_render_context_report_swap(m_activeGL);
+
+    if (m_timing)
+    {
+      qint64 nowUs = m_clock.nsecsElapsed() / 1000;
+      RenderSample sample;
+      sample.renderUs = m_frameRenderUs;
+      // Longer gaps are pauses, not pacing.
+      sample.intervalUs = (m_lastPresentUs >= 0 && nowUs - m_lastPresentUs < 1000000) ? (qint32)(nowUs - m_lastPresentUs) : RenderSample::Unknown;
+      sample.lateUs = m_frameTarget > 0 ? (qint32)(mpv_get_time_us(m_activeMpv) - m_frameTarget) : RenderSample::Unknown;
+      m_timing->add(sample);
+      m_lastPresentUs = nowUs;
+    }
+  }
+  m_swapPending = false;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -237,20 +728,12 @@ void PlayerRenderer::onVideoPlaybackActive(bool active)
 void PlayerRenderer::on_update(void *ctx)
 {
   PlayerRenderer *self = (PlayerRenderer *)ctx;
-  // QQuickWindow::scheduleRenderJob is expected to be called from the GUI thread but
-  // is thread-safe when using the QSGThreadedRenderLoop. We can detect a non-threaded render
-  // loop by checking if QQuickWindow::beforeSynchronizing was called from the GUI thread
-  // (which affects the QObject::thread() of the PlayerRenderer).
-  //
-  if (self->thread() == self->m_window->thread())
-    QMetaObject::invokeMethod(self->m_window, "update", Qt::QueuedConnection);
-  else
-    self->m_window->scheduleRenderJob(new RequestRepaintJob(self->m_window), QQuickWindow::NoStage);
+  requestRepaint(self->m_window, self->thread() != self->m_window->thread());
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 PlayerQuickItem::PlayerQuickItem(QQuickItem* parent)
-: QQuickItem(parent), m_mpvGL(nullptr), m_renderer(nullptr)
+: QQuickItem(parent), m_mpvGL(nullptr), m_renderer(nullptr), m_surface(nullptr), m_software(nullptr)
 {
   connect(this, &QQuickItem::windowChanged, this, &PlayerQuickItem::onWindowChanged, Qt::DirectConnection);
   connect(this, &PlayerQuickItem::onFatalError, this, &PlayerQuickItem::onHandleFatalError, Qt::QueuedConnection);
@@ -261,6 +744,13 @@ PlayerQuickItem::~PlayerQuickItem()
 {
   if (m_mpvGL)
     mpv_render_context_set_update_callback(m_mpvGL, nullptr, nullptr);
+
+  // A video render thread still running would be using the surface.
+  if (m_renderer && m_renderer->m_videoThread)
+    m_renderer->m_videoThread->stopRendering();
+  delete m_surface;
+
+  delete m_software;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -279,12 +769,49 @@ void PlayerQuickItem::onHandleFatalError(QString message)
   throw FatalException(message);
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlayerQuickItem::onFrameScheduled(int delayMs)
+{
+  if (window())
+    QTimer::singleShot(delayMs, Qt::PreciseTimer, window(), &QQuickWindow::update);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+QString PlayerQuickItem::debugInfo()
+{
+  int rendered = m_renderStats.rendered.load();
+  int skipped = m_renderStats.skipped.load();
+  QString info = m_debugInfo;
+  info += "Video rendering:\n";
+  info += QString("  Frames rendered: %1\n").arg(rendered);
+  info += QString("  Repaints with the last frame: %1 (%2%)\n").arg(skipped)
+            .arg(rendered + skipped > 0 ? 100 * skipped / (rendered + skipped) : 0);
+  info += QString("  Framebuffers allocated: %1\n").arg(m_renderStats.fboAllocations.load());
+  info += m_renderTiming.summary();
+  info += "\n";
+  return info;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+QVariantMap PlayerQuickItem::renderStats()
+{
+  QVariantMap res = m_renderTiming.toVariant();
+  res.insert("rendered", m_renderStats.rendered.load());
+  res.insert("skipped", m_renderStats.skipped.load());
+  res.insert("fboAllocations", m_renderStats.fboAllocations.load());
+  return res;
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 void PlayerQuickItem::onSynchronize()
 {
-  if (!m_renderer && m_mpv)
+  if (!m_renderer && m_mpv && !m_software)
   {
-    m_renderer = new PlayerRenderer(m_mpv, window());
+    m_renderer = new PlayerRenderer(m_mpv, m_standby, window());
+    m_renderer->m_stats = &m_renderStats;
+    m_renderer->m_timing = &m_renderTiming;
+    if (m_surface)
+      m_renderer->m_videoThread = new VideoRenderThread(m_mpv, m_standby, window(), m_surface);
     if (!m_renderer->init())
     {
       delete m_renderer;
@@ -294,6 +821,7 @@ void PlayerQuickItem::onSynchronize()
     }
     connect(window(), &QQuickWindow::beforeRendering, m_renderer, &PlayerRenderer::render, Qt::DirectConnection);
     connect(window(), &QQuickWindow::frameSwapped, m_renderer, &PlayerRenderer::swap, Qt::DirectConnection);
+    connect(m_renderer, &PlayerRenderer::frameScheduled, this, &PlayerQuickItem::onFrameScheduled, Qt::QueuedConnection);
     connect(&PlayerComponent::Get(), &PlayerComponent::videoPlaybackActive, m_renderer, &PlayerRenderer::onVideoPlaybackActive, Qt::QueuedConnection);
     connect(&PlayerComponent::Get(), &PlayerComponent::onVideoRecangleChanged, window(), &QQuickWindow::update, Qt::QueuedConnection);
     window()->setPersistentOpenGLContext(true);
@@ -311,6 +839,8 @@ void PlayerQuickItem::onSynchronize()
         if (s)
           m_debugInfo += QString("  ") + QString::fromUtf8(s) + "\n";
       }
+      if (m_renderer->m_videoThread)
+        m_debugInfo += "  Video rendered on its own thread\n";
       m_debugInfo += "\n";
     }
   }
@@ -318,7 +848,178 @@ void PlayerQuickItem::onSynchronize()
   {
     m_renderer->m_size = window()->size() * window()->devicePixelRatio();
     m_renderer->m_videoRectangle = PlayerComponent::Get().videoRectangle();
+    m_renderer->setActive(PlayerComponent::Get().getMpvHandle());
+    QScreen* screen = window()->screen();
+    if (screen && screen->refreshRate() > 1)
+      m_renderer->m_vsyncUs = (qint64)(1000000 / screen->refreshRate());
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Software rendered frames with the OpenGL scene graph. The texture is only allocated when the
+// frame size changes; every other frame is uploaded into it in place. Only used on the scene
+// graph thread, with its context current.
+class SoftwareFrameTexture : public QSGTexture
+{
+public:
+  SoftwareFrameTexture()
+    : m_id(0), m_internalFormat(GL_RGBA), m_format(GL_RGBA), m_type(GL_UNSIGNED_BYTE), m_convert(false),
+      m_rowLength(false)
+  {
+  }
+
+  ~SoftwareFrameTexture() override
+  {
+    QOpenGLContext* context = QOpenGLContext::currentContext();
+    if (m_id && context)
+      context->functions()->glDeleteTextures(1, &m_id);
+  }
+
+  int textureId() const override { return (int)m_id; }
+  QSize textureSize() const override { return m_size; }
+  bool hasAlphaChannel() const override { return false; }
+  bool hasMipmaps() const override { return false; }
+
+  void bind() override
+  {
+    QOpenGLContext::currentContext()->functions()->glBindTexture(GL_TEXTURE_2D, m_id);
+    updateBindOptions();
+  }
+
+  void upload(const QImage& frame)
+  {
+    QOpenGLContext* context = QOpenGLContext::currentContext();
+    QOpenGLFunctions* gl = context->functions();
+
+    if (!m_id)
+    {
+      // QImage::Format_RGB32 is 0xffRRGGBB words, which desktop GL takes as they are. GLES only
+      // does with the BGRA extension, and only on little endian; anywhere else the frame has to
+      // be converted.
+      if (!context->isOpenGLES())
+      {
+        m_format = GL_BGRA;
+        m_type = GL_UNSIGNED_INT_8_8_8_8_REV;
+      }
+      else if (Q_BYTE_ORDER == Q_LITTLE_ENDIAN && context->hasExtension("GL_EXT_texture_format_BGRA8888"))
+      {
+        m_internalFormat = m_format = GL_BGRA;
+      }
+      else
+      {
+        m_convert = true;
+      }
+      m_rowLength = !context->isOpenGLES() || context->format().majorVersion() >= 3;
+
+      gl->glGenTextures(1, &m_id);
+      gl->glBindTexture(GL_TEXTURE_2D, m_id);
+      updateBindOptions(true);
+    }
+
+    QImage image = frame;
+    if (m_convert)
+      image = frame.convertToFormat(QImage::Format_RGBA8888);
+    else if (!m_rowLength && frame.bytesPerLine() != frame.width() * 4)
+      image = frame.copy(); // without the padding at the end of the lines
+
+    gl->glBindTexture(GL_TEXTURE_2D, m_id);
+    if (m_rowLength)
+      gl->glPixelStorei(GL_UNPACK_ROW_LENGTH, image.bytesPerLine() / 4);
+
+    if (image.size() != m_size)
+    {
+      m_size = image.size();
+      gl->glTexImage2D(GL_TEXTURE_2D, 0, m_internalFormat, m_size.width(), m_size.height(), 0, m_format,
+                       m_type, image.constBits());
+    }
+    else
+    {
+      gl->glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_size.width(), m_size.height(), m_format, m_type,
+                          image.constBits());
+    }
+
+    if (m_rowLength)
+      gl->glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+  }
+
+private:
+  GLuint m_id;
+  QSize m_size;
+  GLint m_internalFormat;
+  GLenum m_format;
+  GLenum m_type;
+  bool m_convert;
+  bool m_rowLength;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+QSGNode* PlayerQuickItem::updatePaintNode(QSGNode* oldNode, UpdatePaintNodeData* data)
+{
+  Q_UNUSED(data);
+
+  if (!m_software || !window())
+  {
+    delete oldNode;
+    return nullptr;
+  }
+
+  qreal dpr = window()->devicePixelRatio();
+  QRectF rect = boundingRect();
+  QRect videoRect = PlayerComponent::Get().videoRectangle();
+  if (videoRect.width() > 0 && videoRect.height() > 0)
+    rect = QRectF(videoRect.x() / dpr, videoRect.y() / dpr, videoRect.width() / dpr, videoRect.height() / dpr);
+
+  // The GUI thread is blocked while this runs, so the frame was rendered on the software
+  // renderer's thread; this only takes the newest one.
+  m_software->setActive(PlayerComponent::Get().getMpvHandle());
+  m_software->setSize((rect.size() * dpr).toSize());
+
+  bool isNew = false;
+  QImage frame = m_software->acquireFrame(&isNew);
+
+  QSGSimpleTextureNode* node = static_cast<QSGSimpleTextureNode*>(oldNode);
+  if (!node)
+  {
+    node = new QSGSimpleTextureNode();
+    node->setOwnsTexture(true);
+  }
+
+  if (isNew && window()->rendererInterface()->graphicsApi() == QSGRendererInterface::OpenGL)
+  {
+    // setTexture() deletes the texture the node owns, even if it's the same one.
+    SoftwareFrameTexture* texture = static_cast<SoftwareFrameTexture*>(node->texture());
+    if (texture)
+    {
+      texture->upload(frame);
+      node->markDirty(QSGNode::DirtyMaterial);
+    }
+    else
+    {
+      texture = new SoftwareFrameTexture();
+      texture->upload(frame);
+      node->setTexture(texture);
+    }
+  }
+  else if (isNew)
+  {
+    // The software scene graph only wraps the image, there's nothing to upload.
+    QSGTexture* texture = window()->createTextureFromImage(frame);
+    if (texture)
+      node->setTexture(texture);
+  }
+  else
+  {
+    m_renderStats.skipped.ref();
   }
+
+  if (!node->texture())
+  {
+    delete node;
+    return nullptr;
+  }
+
+  node->setRect(rect);
+  return node;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -327,12 +1028,44 @@ void PlayerQuickItem::onInvalidate()
   if (m_renderer)
     delete m_renderer;
   m_renderer = nullptr;
+
+  // The video render thread is gone with the renderer. Surfaces belong to the GUI thread, so it's
+  // deleted there. A scene graph that is initialized again renders the video itself.
+  if (m_surface)
+    m_surface->deleteLater();
+  m_surface = nullptr;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 void PlayerQuickItem::initMpv(PlayerComponent* player)
 {
   m_mpv = player->getMpvHandle();
+  m_standby = player->getStandbyMpvHandle();
+
+  if (SettingsComponent::Get().value(SETTINGS_SECTION_VIDEO, "render_api").toString() == "sw" && !m_software)
+  {
+    m_software = new SoftwareRenderer(m_mpv, m_standby);
+    if (!m_software->init(&m_renderStats, &m_renderTiming))
+    {
+      delete m_software;
+      m_software = nullptr;
+      emit onFatalError(tr("Could not initialize software rendering."));
+      return;
+    }
+    connect(m_software, &SoftwareRenderer::frameReady, this, &QQuickItem::update, Qt::QueuedConnection);
+    connect(&PlayerComponent::Get(), &PlayerComponent::onVideoRecangleChanged, this, &QQuickItem::update, Qt::QueuedConnection);
+    setFlag(ItemHasContents, true);
+    m_debugInfo = "\nRendering video in software\n\n";
+  }
+
+  // The video render thread's context needs a surface, and those can only be created on the GUI
+  // thread.
+  if (SettingsComponent::Get().value(SETTINGS_SECTION_VIDEO, "render_thread").toBool() && !m_surface && !m_software)
+  {
+    m_surface = new QOffscreenSurface();
+    m_surface->setFormat(window()->format());
+    m_surface->create();
+  }
 
   connect(player, &PlayerComponent::windowVisible, this, &QQuickItem::setVisible);
   window()->update();
@@ -4,6 +4,11 @@
 #include <Qt>
 #include <QtQuick/QQuickItem>
 #include <QOpenGLFramebufferObject>
+#include <QAtomicInt>
+#include <QElapsedTimer>
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
 
 #include <mpv/client.h>
 #include <mpv/render.h>
@@ -15,31 +20,140 @@ typedef void* HANDLE;
 #endif
 
 #include "PlayerComponent.h"
+#include "PlayerFramebufferPool.h"
+#include "PlayerRenderTiming.h"
+#include "PlayerSoftwareRenderer.h"
 #include "QtHelper.h"
 
+// Counters of the render thread, read by the GUI thread for the debug info.
+struct RenderStats
+{
+  QAtomicInt rendered; // window repaints for which mpv rendered the video
+  QAtomicInt skipped;  // window repaints that showed the last rendered frame again
+  QAtomicInt fboAllocations;
+};
+
+class QOffscreenSurface;
+class QOpenGLContext;
+
+// Renders the video on its own thread and GL context, which shares textures with the scene
+// graph's, so that slow scene graph frames (e.g. the web client stalling) don't hold up mpv.
+// Frames go into a ring of framebuffers: the one the scene graph shows, the newest finished
+// one, and the one being rendered. Enabled with the hidden video setting render_thread.
+class VideoRenderThread : public QThread
+{
+  Q_OBJECT
+public:
+  // surface must have been created on the GUI thread.
+  VideoRenderThread(mpv::qt::Handle mpv, mpv::qt::Handle standby, QQuickWindow* window, QOffscreenSurface* surface);
+  ~VideoRenderThread() override;
+
+  // Create the thread's context, sharing with the current one, and start rendering. threadedLoop
+  // tells how to ask the window for repaints (see PlayerRenderer::on_update()).
+  bool init(bool threadedLoop, RenderStats* stats, RenderTiming* timing);
+
+  // Any thread.
+  void setActive(mpv_handle* mpv);
+  void setSize(const QSize& size);
+  // Any thread. Stop rendering, and wait for the thread to finish.
+  void stopRendering();
+
+  // Scene graph thread: the texture of the newest finished frame and its size, or 0 if there is
+  // none yet. isNew is set if the frame wasn't returned before.
+  GLuint acquireFrame(QSize* size, bool* isNew);
+
+protected:
+  void run() override;
+
+private:
+  static void on_update(void *ctx);
+
+  static const int RingSize = 3;
+
+  mpv::qt::Handle m_mpv;
+  mpv::qt::Handle m_standby;
+  QQuickWindow* m_window;
+  QOffscreenSurface* m_surface;
+  QOpenGLContext* m_context;
+  bool m_threadedLoop;
+  RenderStats* m_stats;
+  RenderTiming* m_timing;
+
+  QMutex m_lock;
+  QWaitCondition m_wake;
+  int m_initState; // 0 while starting, 1 if rendering, -1 if that failed
+  bool m_quit;
+  bool m_updatePending;
+  mpv_handle* m_active;
+  QSize m_size;
+  // Only the render thread touches the slots, except for the ones at m_displayed and m_newest,
+  // which it leaves alone.
+  QOpenGLFramebufferObject* m_slots[RingSize];
+  int m_displayed; // slot the scene graph shows, -1 if none
+  int m_newest;    // newest finished slot, -1 if none
+};
+
 class PlayerRenderer : public QObject
 {
   Q_OBJECT
   friend class PlayerQuickItem;
 
-  PlayerRenderer(mpv::qt::Handle mpv, QQuickWindow* window);
+  PlayerRenderer(mpv::qt::Handle mpv, mpv::qt::Handle standby, QQuickWindow* window);
   bool init();
+  // Render the player that is currently playing. Must be one of the two handles passed in.
+  void setActive(mpv_handle* mpv);
   ~PlayerRenderer() override;
   void render();
+  // render() when the video comes from a VideoRenderThread.
+  void renderFromThread();
   void swap();
 
 public slots:
   void onVideoPlaybackActive(bool active);
 
+signals:
+  // The next video frame is due in delayMs; the window should be repainted by then.
+  void frameScheduled(int delayMs);
+
 private:
   static void on_update(void *ctx);
+  // True if the pending frame is not due before the next vsync, in which case a repaint has
+  // been scheduled for it.
+  bool frameDueLater();
+
   mpv::qt::Handle m_mpv;
+  mpv::qt::Handle m_standby;
   mpv_render_context* m_mpvGL;
+  mpv_render_context* m_standbyGL;
+  mpv_render_context* m_activeGL;
+  mpv_handle* m_activeMpv;
   QQuickWindow* m_window;
   QSize m_size;
   HANDLE m_hAvrtHandle;
   QRect m_videoRectangle;
-  QOpenGLFramebufferObject* m_fbo;
+  // The video is rendered into one of these and blitted to the window, so that it can be shown
+  // again when only the web UI changed.
+  FramebufferPool m_fbos;
+  // Where the last frame was rendered: by which context, into which framebuffer, at what size.
+  mpv_render_context* m_renderedGL;
+  QOpenGLFramebufferObject* m_renderedFbo;
+  QSize m_renderedSize;
+  bool m_framePending;
+  bool m_swapPending;
+  qint64 m_vsyncUs;
+  int64_t m_scheduledTime;
+  RenderStats* m_stats;
+
+  // Frame pacing: the render thread's clock, and the rendered frame waiting for its swap.
+  RenderTiming* m_timing;
+  QElapsedTimer m_clock;
+  qint64 m_lastPresentUs;
+  qint32 m_frameRenderUs;
+  int64_t m_frameTarget;
+
+  // Set if the video is rendered on its own thread; the renderer then only shows its frames.
+  VideoRenderThread* m_videoThread;
+  GLuint m_readFbo;
 };
 
 class PlayerQuickItem : public QQuickItem
@@ -51,22 +165,36 @@ public:
     explicit PlayerQuickItem(QQuickItem* parent = nullptr);
     ~PlayerQuickItem() override;
     void initMpv(PlayerComponent* player);
-    QString debugInfo() { return m_debugInfo; }
+    QString debugInfo();
+    // Repaint counters and frame timing, for the web client.
+    QVariantMap renderStats();
 
 signals:
     void onFatalError(QString message);
 
+protected:
+    // Only used with the software renderer, which shows frames as a texture node.
+    QSGNode* updatePaintNode(QSGNode* oldNode, UpdatePaintNodeData* data) override;
+
 private slots:
     void onWindowChanged(QQuickWindow* win);
     void onSynchronize();
     void onInvalidate();
     void onHandleFatalError(QString message);
+    void onFrameScheduled(int delayMs);
 
 private:
     mpv::qt::Handle m_mpv;
+    mpv::qt::Handle m_standby;
     mpv_render_context* m_mpvGL;
     PlayerRenderer* m_renderer;
     QString m_debugInfo;
+    RenderStats m_renderStats;
+    RenderTiming m_renderTiming;
+    // Only set if the video is rendered on its own thread.
+    QOffscreenSurface* m_surface;
+    // Only set if the video is rendered in software.
+    SoftwareRenderer* m_software;
 };
 
 #endif
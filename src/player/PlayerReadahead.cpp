@@ -0,0 +1,188 @@
+#include "PlayerReadahead.h"
+
+#include <QFile>
+#include <QTextStream>
+
+#include "settings/SettingsComponent.h"
+#include "settings/SettingsSection.h"
+#include "QtHelper.h"
+#include "QsLog.h"
+
+// Interval at which the player is sampled during playback.
+#define READAHEAD_SAMPLE_MS 2000
+
+// Share of the available memory the buffers may use, in percent.
+#define READAHEAD_MEMORY_PERCENT 25
+
+// Limits for the forward buffer, whatever the bitrate.
+#define READAHEAD_MIN_BYTES (8 * 1024 * 1024)
+#define READAHEAD_MAX_BYTES (1024 * 1024 * 1024)
+
+// Used if the available memory can't be determined.
+#define READAHEAD_DEFAULT_BUDGET (256 * 1024 * 1024)
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+ReadaheadController::ReadaheadController(QObject* parent)
+  : QObject(parent), m_mpv(nullptr), m_timer(this), m_enabled(false), m_targetSecs(0),
+    m_backSecs(0), m_serverBitrate(0), m_bitrate(0), m_measured(false), m_cacheSpeed(0), m_budget(0),
+    m_forwardBytes(0), m_backBytes(0)
+{
+  m_timer.setInterval(READAHEAD_SAMPLE_MS);
+  connect(&m_timer, &QTimer::timeout, this, &ReadaheadController::sample);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void ReadaheadController::setPlayer(mpv_handle* mpv)
+{
+  m_mpv = mpv;
+  if (m_mpv && m_forwardBytes > 0)
+    apply(m_forwardBytes, m_backBytes);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void ReadaheadController::start(qint64 serverBitrate)
+{
+  m_enabled = SettingsComponent::Get().value(SETTINGS_SECTION_VIDEO, "readahead.adaptive").toBool();
+  if (!m_enabled)
+  {
+    m_timer.stop();
+    return;
+  }
+
+  m_targetSecs = qMax(1, SettingsComponent::Get().value(SETTINGS_SECTION_VIDEO, "readahead.seconds").toInt());
+  m_backSecs = qMax(0, SettingsComponent::Get().value(SETTINGS_SECTION_VIDEO, "readahead.back_seconds").toInt());
+  m_serverBitrate = serverBitrate * 1000;
+  m_bitrate = m_serverBitrate;
+  m_measured = false;
+  m_cacheSpeed = 0;
+
+  // Size for the server's idea of the bitrate until there's something measured.
+  sample();
+  m_timer.start();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void ReadaheadController::stop()
+{
+  // The sizes stay, the next item is likely similar.
+  m_timer.stop();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void ReadaheadController::sample()
+{
+  if (!m_mpv || !m_enabled)
+    return;
+
+  // What's buffered tells the actual bitrate of the selected streams, which may be a lot less
+  // than the server's figure for the whole file (or more, with a variable bitrate).
+  double buffered = mpv::qt::get_property(m_mpv, "demuxer-cache-duration").toDouble();
+  QVariantMap cacheState = mpv::qt::get_property(m_mpv, "demuxer-cache-state").toMap();
+  qint64 bufferedBytes = cacheState["fw-bytes"].toLongLong();
+  qint64 totalBytes = qMax(bufferedBytes, cacheState["total-bytes"].toLongLong());
+  qint64 measured = 0;
+  if (buffered > 1 && bufferedBytes > 0)
+    measured = (qint64)(bufferedBytes * 8 / buffered);
+  else
+    measured = mpv::qt::get_property(m_mpv, "video-bitrate").toLongLong() +
+               mpv::qt::get_property(m_mpv, "audio-bitrate").toLongLong();
+
+  // The server's figure only stands in until there's a measurement, which then replaces it.
+  if (measured > 0)
+  {
+    m_bitrate = m_measured ? (m_bitrate * 3 + measured) / 4 : measured;
+    m_measured = true;
+  }
+
+  // cache-speed is 0 while the cache is full, so only a non-zero value says anything.
+  qint64 speed = mpv::qt::get_property(m_mpv, "cache-speed").toLongLong();
+  if (speed > 0)
+    m_cacheSpeed = speed;
+
+  if (m_bitrate <= 0)
+    return;
+
+  // If the network is barely faster than the stream, a dropout takes long to recover from, so
+  // buffer more.
+  qint64 bytesPerSec = m_bitrate / 8;
+  int targetSecs = m_targetSecs;
+  if (m_cacheSpeed > 0 && m_cacheSpeed < bytesPerSec * 2)
+    targetSecs = targetSecs * 3 / 2;
+
+  qint64 forward = qBound((qint64)READAHEAD_MIN_BYTES, bytesPerSec * targetSecs, (qint64)READAHEAD_MAX_BYTES);
+  qint64 back = bytesPerSec * m_backSecs;
+
+  // What is buffered is already taken from the available memory. Only count what is actually
+  // used, the configured maxima may not be filled.
+  qint64 available = availableMemory();
+  m_budget = available >= 0 ? (available + totalBytes) * READAHEAD_MEMORY_PERCENT / 100 : READAHEAD_DEFAULT_BUDGET;
+  if (forward + back > m_budget)
+  {
+    // Give up the back buffer first, it only makes seeking back faster.
+    back = qMax((qint64)0, m_budget - forward);
+    forward = qMax((qint64)READAHEAD_MIN_BYTES, qMin(forward, m_budget));
+  }
+
+  // Don't poke the player for small changes.
+  if (qAbs(forward - m_forwardBytes) * 5 < m_forwardBytes && qAbs(back - m_backBytes) * 5 <= m_backBytes)
+    return;
+
+  QLOG_DEBUG() << "Readahead:" << forward / 1024 << "KB forward," << back / 1024 << "KB back for"
+               << m_bitrate / 1000 << "kbit/s, budget" << m_budget / 1024 << "KB";
+  apply(forward, back);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void ReadaheadController::apply(qint64 forward, qint64 back)
+{
+  m_forwardBytes = forward;
+  m_backBytes = back;
+
+  if (!m_mpv)
+    return;
+
+  mpv::qt::property_batch props(m_mpv);
+  props.set("demuxer-max-bytes", forward);
+  props.set("demuxer-max-back-bytes", back);
+  props.set("demuxer-readahead-secs", (double)(m_targetSecs * 2));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+qint64 ReadaheadController::availableMemory()
+{
+  QFile file("/proc/meminfo");
+  if (!file.open(QIODevice::ReadOnly | QIODevice::Text))
+    return -1;
+
+  qint64 available = -1, free = 0, cached = 0;
+  QTextStream stream(&file);
+  QString line;
+  while (stream.readLineInto(&line))
+  {
+    QStringList fields = line.simplified().split(' ');
+    if (fields.size() < 2)
+      continue;
+    qint64 kb = fields[1].toLongLong();
+    if (fields[0] == "MemAvailable:")
+      available = kb;
+    else if (fields[0] == "MemFree:")
+      free = kb;
+    else if (fields[0] == "Cached:")
+      cached = kb;
+  }
+
+  // Kernels before 3.14 don't report MemAvailable.
+  if (available < 0)
+    available = free + cached;
+
+  return available * 1024;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+QString ReadaheadController::summary() const
+{
+  if (!m_enabled)
+    return "off";
+  return QString("%1 KB forward, %2 KB back, %3 kbit/s, budget %4 KB")
+    .arg(m_forwardBytes / 1024).arg(m_backBytes / 1024).arg(m_bitrate / 1000).arg(m_budget / 1024);
+}
@@ -0,0 +1,50 @@
+#ifndef PLAYERREADAHEAD_H
+#define PLAYERREADAHEAD_H
+
+#include <QObject>
+#include <QTimer>
+#include <QVariant>
+
+#include <mpv/client.h>
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Sizes the demuxer's forward and back buffers to hold a number of seconds of the current item,
+// instead of a fixed number of bytes. The bitrate is taken from the server metadata and what the
+// player measures, and the buffers are kept within a share of the available system memory.
+class ReadaheadController : public QObject
+{
+  Q_OBJECT
+public:
+  explicit ReadaheadController(QObject* parent = nullptr);
+
+  // The player whose buffers are managed. Changing it applies the current sizes to the new one.
+  void setPlayer(mpv_handle* mpv);
+
+  // Start adapting to a new item. serverBitrate is in kbit/s, 0 if unknown.
+  void start(qint64 serverBitrate);
+  void stop();
+
+  // Current estimates and sizes, for the debug overlay.
+  QString summary() const;
+
+private:
+  Q_SLOT void sample();
+  void apply(qint64 forward, qint64 back);
+  // Available memory in bytes, from /proc/meminfo. -1 if unknown.
+  static qint64 availableMemory();
+
+  mpv_handle* m_mpv;
+  QTimer m_timer;
+  bool m_enabled;
+  int m_targetSecs;
+  int m_backSecs;
+  qint64 m_serverBitrate;   // bit/s
+  qint64 m_bitrate;         // bit/s, best estimate
+  bool m_measured;          // m_bitrate is measured, not the server's figure
+  qint64 m_cacheSpeed;      // bytes/s
+  qint64 m_budget;          // bytes
+  qint64 m_forwardBytes;
+  qint64 m_backBytes;
+};
+
+#endif // PLAYERREADAHEAD_H
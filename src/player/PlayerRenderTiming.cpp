@@ -0,0 +1,126 @@
+#include "PlayerRenderTiming.h"
+
+#include <algorithm>
+
+// Interval at which the GUI thread collects the samples of the render thread.
+#define RENDER_TIMING_COLLECT_MS 1000
+
+// A present interval off the median by more than this share counts as irregular.
+#define RENDER_TIMING_IRREGULAR 0.25
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// p50/p95/p99/max of the known values of one field, in ms.
+static QVariantMap percentiles(const QVector<RenderSample>& samples, qint32 RenderSample::*field, QVector<qint32>* sortedOut = nullptr)
+{
+  QVector<qint32> values;
+  values.reserve(samples.size());
+  for (const RenderSample& sample : samples)
+  {
+    if (sample.*field != RenderSample::Unknown)
+      values << sample.*field;
+  }
+
+  QVariantMap res;
+  if (values.isEmpty())
+    return res;
+
+  std::sort(values.begin(), values.end());
+  auto at = [&](int percent) { return values[qMin(values.size() - 1, values.size() * percent / 100)] / 1000.0; };
+  res.insert("p50", at(50));
+  res.insert("p95", at(95));
+  res.insert("p99", at(99));
+  res.insert("max", values.last() / 1000.0);
+  res.insert("count", values.size());
+  if (sortedOut)
+    *sortedOut = values;
+  return res;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+RenderTiming::RenderTiming(QObject* parent)
+  : QObject(parent), m_dropped(0), m_timer(this), m_historyPos(0), m_frames(0)
+{
+  m_timer.setInterval(RENDER_TIMING_COLLECT_MS);
+  connect(&m_timer, &QTimer::timeout, this, &RenderTiming::collect);
+  m_timer.start();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void RenderTiming::add(const RenderSample& sample)
+{
+  if (!m_queue.push(sample))
+    m_dropped.fetch_add(1, std::memory_order_relaxed);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void RenderTiming::collect()
+{
+  RenderSample sample;
+  while (m_queue.pop(sample))
+  {
+    if (m_history.size() < HistorySize)
+    {
+      m_history.append(sample);
+    }
+    else
+    {
+      m_history[m_historyPos] = sample;
+      m_historyPos = (m_historyPos + 1) % HistorySize;
+    }
+    m_frames++;
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+QVariantMap RenderTiming::toVariant()
+{
+  collect();
+
+  QVariantMap res;
+  res.insert("frames", m_frames);
+  res.insert("dropped", m_dropped.load(std::memory_order_relaxed));
+  res.insert("renderMs", percentiles(m_history, &RenderSample::renderUs));
+  res.insert("lateMs", percentiles(m_history, &RenderSample::lateUs));
+
+  QVector<qint32> intervals;
+  QVariantMap interval = percentiles(m_history, &RenderSample::intervalUs, &intervals);
+  if (!intervals.isEmpty())
+  {
+    qint32 median = intervals[intervals.size() / 2];
+    int irregular = 0;
+    for (qint32 value : intervals)
+    {
+      if (qAbs(value - median) > median * RENDER_TIMING_IRREGULAR)
+        irregular++;
+    }
+    interval.insert("irregular", (double)irregular / intervals.size());
+  }
+  res.insert("intervalMs", interval);
+  return res;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+QString RenderTiming::summary()
+{
+  QVariantMap stats = toVariant();
+
+  auto line = [&](const QString& title, const QString& key)
+  {
+    QVariantMap values = stats[key].toMap();
+    if (values.isEmpty())
+      return QString("  %1: -\n").arg(title);
+    return QString("  %1: p50 %2 p95 %3 p99 %4 max %5 ms\n").arg(title)
+             .arg(values["p50"].toDouble(), 0, 'f', 2).arg(values["p95"].toDouble(), 0, 'f', 2)
+             .arg(values["p99"].toDouble(), 0, 'f', 2).arg(values["max"].toDouble(), 0, 'f', 2);
+  };
+
+  QString res;
+  res += QString("  Frame timing (last %1 frames):\n").arg(m_history.size());
+  res += line("  Render", "renderMs");
+  res += line("  Present interval", "intervalMs");
+  res += line("  Late vs. mpv target", "lateMs");
+  QVariantMap interval = stats["intervalMs"].toMap();
+  if (interval.contains("irregular"))
+    res += QString("    Irregular intervals: %1%\n").arg(interval["irregular"].toDouble() * 100, 0, 'f', 1);
+  return res;
+}
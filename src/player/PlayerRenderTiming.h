@@ -0,0 +1,59 @@
+#ifndef PLAYERRENDERTIMING_H
+#define PLAYERRENDERTIMING_H
+
+#include <QObject>
+#include <QTimer>
+#include <QVariant>
+#include <QVector>
+
+#include <atomic>
+#include <limits>
+
+#include "utils/SpscQueue.h"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Timing of one video frame, from rendering it to the swap that presented it. All in us.
+struct RenderSample
+{
+  static const qint32 Unknown = std::numeric_limits<qint32>::min();
+
+  qint32 renderUs;   // spent in PlayerRenderer::render()
+  qint32 intervalUs; // since the previous frame was presented, Unknown after a pause
+  qint32 lateUs;     // presented after mpv's target time for the frame (negative if early)
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Frame pacing of the render thread. The render thread adds a sample for every video frame it
+// presents, without locking; the GUI thread collects them once a second and keeps the recent
+// ones for percentiles. Tells apart judder caused by mpv (frames rendered late or slowly) from
+// judder caused by the scene graph (frames rendered on time, but presented unevenly).
+class RenderTiming : public QObject
+{
+  Q_OBJECT
+public:
+  // Frames the percentiles are computed over.
+  static const int HistorySize = 600;
+
+  explicit RenderTiming(QObject* parent = nullptr);
+
+  // Render thread only.
+  void add(const RenderSample& sample);
+
+  // GUI thread only. Percentiles of the recent frames, as text for the debug overlay, or for
+  // the web client.
+  QString summary();
+  QVariantMap toVariant();
+
+private:
+  Q_SLOT void collect();
+
+  SpscQueue<RenderSample, 1024> m_queue;
+  std::atomic<int> m_dropped;
+  QTimer m_timer;
+
+  QVector<RenderSample> m_history;
+  int m_historyPos;
+  qint64 m_frames;
+};
+
+#endif // PLAYERRENDERTIMING_H
@@ -0,0 +1,242 @@
+#include "PlayerSoftwareRenderer.h"
+
+#include <QtGlobal>
+#include <QElapsedTimer>
+
+#include "PlayerQuickItem.h"
+#include "QsLog.h"
+
+// Alignment of the frame buffers and of their lines.
+#define SW_ALIGNMENT 64
+
+// Byte order of QImage::Format_RGB32 (0xffRRGGBB), so frames are shown without conversion.
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+#define SW_FORMAT "bgr0"
+#else
+#define SW_FORMAT "0rgb"
+#endif
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+SoftwareRenderer::SoftwareRenderer(mpv::qt::Handle mpv, mpv::qt::Handle standby)
+  : m_mpv(mpv), m_standby(standby), m_mpvSW(nullptr), m_standbySW(nullptr), m_stats(nullptr),
+    m_timing(nullptr), m_quit(false), m_updatePending(true), m_active(mpv), m_displayed(-1), m_newest(-1)
+{
+  setObjectName("VideoRender");
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+SoftwareRenderer::~SoftwareRenderer()
+{
+  stopRendering();
+
+  // Keep in mind that the mpv handles must be held until this is done.
+  if (m_mpvSW)
+    mpv_render_context_free(m_mpvSW);
+  if (m_standbySW)
+    mpv_render_context_free(m_standbySW);
+
+  for (int n = 0; n < RingSize; n++)
+    qFreeAligned(m_slots[n].buffer);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool SoftwareRenderer::init(RenderStats* stats, RenderTiming* timing)
+{
+  m_stats = stats;
+  m_timing = timing;
+
+#ifdef MPV_RENDER_API_TYPE_SW
+  mpv_render_param params[] = {
+    {MPV_RENDER_PARAM_API_TYPE, (void*)MPV_RENDER_API_TYPE_SW},
+    {MPV_RENDER_PARAM_INVALID}
+  };
+
+  if (mpv_render_context_create(&m_mpvSW, m_mpv, params) < 0)
+  {
+    QLOG_ERROR() << "Could not create a software render context.";
+    return false;
+  }
+  mpv_render_context_set_update_callback(m_mpvSW, on_update, (void *)this);
+
+  if (m_standby)
+  {
+    if (mpv_render_context_create(&m_standbySW, m_standby, params) >= 0)
+      mpv_render_context_set_update_callback(m_standbySW, on_update, (void *)this);
+    else
+      QLOG_WARN() << "Could not create a software render context for the standby player.";
+  }
+
+  QLOG_INFO() << "Rendering video in software.";
+  start(QThread::HighestPriority);
+  return true;
+#else
+  QLOG_ERROR() << "libmpv was built without the software renderer.";
+  return false;
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void SoftwareRenderer::stopRendering()
+{
+  {
+    QMutexLocker lock(&m_lock);
+    m_quit = true;
+    m_wake.wakeAll();
+  }
+  wait();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void SoftwareRenderer::setActive(mpv_handle* mpv)
+{
+  QMutexLocker lock(&m_lock);
+  if (mpv != m_active)
+  {
+    m_active = mpv;
+    m_updatePending = true;
+    m_wake.wakeAll();
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void SoftwareRenderer::setSize(const QSize& size)
+{
+  QMutexLocker lock(&m_lock);
+  if (size != m_size)
+  {
+    m_size = size;
+    m_updatePending = true;
+    m_wake.wakeAll();
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+QImage SoftwareRenderer::acquireFrame(bool* isNew)
+{
+  QMutexLocker lock(&m_lock);
+  *isNew = m_newest >= 0 && m_newest != m_displayed;
+  m_displayed = m_newest;
+  if (m_displayed < 0)
+    return QImage();
+  return m_slots[m_displayed].image;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void SoftwareRenderer::on_update(void* ctx)
+{
+  SoftwareRenderer *self = (SoftwareRenderer *)ctx;
+  QMutexLocker lock(&self->m_lock);
+  self->m_updatePending = true;
+  self->m_wake.wakeAll();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool SoftwareRenderer::renderSlot(int slot, mpv_render_context* ctx, const QSize& size)
+{
+#ifdef MPV_RENDER_API_TYPE_SW
+  Slot& s = m_slots[slot];
+
+  // Buffers are only reallocated when the size changes, not for every frame.
+  if (s.image.size() != size)
+  {
+    s.image = QImage();
+    qFreeAligned(s.buffer);
+    s.stride = ((size_t)size.width() * 4 + SW_ALIGNMENT - 1) / SW_ALIGNMENT * SW_ALIGNMENT;
+    s.buffer = (uchar *)qMallocAligned(s.stride * size.height(), SW_ALIGNMENT);
+    if (!s.buffer)
+    {
+      QLOG_ERROR() << "Could not allocate a" << size << "software frame buffer.";
+      return false;
+    }
+    s.image = QImage(s.buffer, size.width(), size.height(), (int)s.stride, QImage::Format_RGB32);
+    if (m_stats)
+      m_stats->fboAllocations.ref();
+  }
+
+  int sw_size[2] = {size.width(), size.height()};
+  size_t sw_stride = s.stride;
+  // The frame is shown whenever the scene graph gets to it; waiting for its display time here
+  // would only delay the next one.
+  int block = 0;
+  mpv_render_param params[] = {
+    {MPV_RENDER_PARAM_SW_SIZE, sw_size},
+    {MPV_RENDER_PARAM_SW_FORMAT, (void*)SW_FORMAT},
+    {MPV_RENDER_PARAM_SW_STRIDE, &sw_stride},
+    {MPV_RENDER_PARAM_SW_POINTER, s.buffer},
+    {MPV_RENDER_PARAM_BLOCK_FOR_TARGET_TIME, &block},
+    {MPV_RENDER_PARAM_INVALID}
+  };
+  return mpv_render_context_render(ctx, params) >= 0;
+#else
+  Q_UNUSED(slot);
+  Q_UNUSED(ctx);
+  Q_UNUSED(size);
+  return false;
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void SoftwareRenderer::run()
+{
+  QElapsedTimer clock;
+  clock.start();
+  qint64 lastPresentUs = -1;
+  mpv_render_context* renderedSW = nullptr;
+  QSize renderedSize;
+
+  while (true)
+  {
+    QSize size;
+    mpv_handle* active;
+    {
+      QMutexLocker lock(&m_lock);
+      while (!m_quit && !m_updatePending)
+        m_wake.wait(&m_lock);
+      if (m_quit)
+        break;
+      m_updatePending = false;
+      size = m_size;
+      active = m_active;
+    }
+
+    mpv_render_context* activeSW = (m_standbySW && active == (mpv_handle *)m_standby) ? m_standbySW : m_mpvSW;
+
+    bool newFrame = mpv_render_context_update(activeSW) & MPV_RENDER_UPDATE_FRAME;
+    if (size.isEmpty() || (!newFrame && activeSW == renderedSW && size == renderedSize))
+      continue;
+
+    // With three slots, one is always neither shown nor the newest.
+    int slot = 0;
+    {
+      QMutexLocker lock(&m_lock);
+      while (slot == m_displayed || slot == m_newest)
+        slot++;
+    }
+
+    qint64 startUs = clock.nsecsElapsed() / 1000;
+    if (!renderSlot(slot, activeSW, size))
+      continue;
+
+    {
+      QMutexLocker lock(&m_lock);
+      m_newest = slot;
+    }
+    renderedSW = activeSW;
+    renderedSize = size;
+
+    qint64 nowUs = clock.nsecsElapsed() / 1000;
+    if (m_stats)
+      m_stats->rendered.ref();
+    if (m_timing)
+    {
+      RenderSample sample;
+      sample.renderUs = (qint32)(nowUs - startUs);
+      sample.intervalUs = (lastPresentUs >= 0 && nowUs - lastPresentUs < 1000000) ? (qint32)(nowUs - lastPresentUs) : RenderSample::Unknown;
+      sample.lateUs = RenderSample::Unknown;
+      m_timing->add(sample);
+    }
+    lastPresentUs = nowUs;
+
+    emit frameReady();
+  }
+}
@@ -0,0 +1,89 @@
+#ifndef PLAYERSOFTWARERENDERER_H
+#define PLAYERSOFTWARERENDERER_H
+
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QImage>
+#include <QSize>
+
+#include <mpv/client.h>
+#include <mpv/render.h>
+
+#include "PlayerRenderTiming.h"
+#include "QtHelper.h"
+
+struct RenderStats;
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Renders the video with mpv's software renderer (MPV_RENDER_API_TYPE_SW) on its own thread, for
+// hosts without usable OpenGL and for headless runs (e.g. with the Qt Quick software backend and
+// the offscreen platform). Selected with the hidden video setting render_api = "sw". Like
+// VideoRenderThread, frames go into a ring of memory buffers: the one the scene graph shows, the
+// newest finished one, and the one being rendered, so the scene graph sync only swaps buffers
+// (see PlayerQuickItem::updatePaintNode()).
+class SoftwareRenderer : public QThread
+{
+  Q_OBJECT
+public:
+  SoftwareRenderer(mpv::qt::Handle mpv, mpv::qt::Handle standby);
+  ~SoftwareRenderer() override;
+
+  // Create the render contexts and start rendering. Fails if libmpv was built without the
+  // software renderer.
+  bool init(RenderStats* stats, RenderTiming* timing);
+
+  // Any thread.
+  void setActive(mpv_handle* mpv);
+  void setSize(const QSize& size);
+
+  // Scene graph thread: the newest finished frame, or a null image if there is none yet. isNew
+  // is set if the frame wasn't returned before. The image refers to the buffer, which is left
+  // alone until the next call.
+  QImage acquireFrame(bool* isNew);
+
+Q_SIGNALS:
+  // A new frame is ready to be shown. Emitted from the render thread.
+  void frameReady();
+
+protected:
+  void run() override;
+
+private:
+  static void on_update(void* ctx);
+  void stopRendering();
+  // Render into the slot, (re)allocating its buffer if the size changed.
+  bool renderSlot(int slot, mpv_render_context* ctx, const QSize& size);
+
+  static const int RingSize = 3;
+
+  struct Slot
+  {
+    Slot() : buffer(nullptr), stride(0) {}
+    // 64 byte aligned buffer with 64 byte aligned lines, as mpv's SIMD code likes it.
+    uchar* buffer;
+    size_t stride;
+    QImage image;
+  };
+
+  mpv::qt::Handle m_mpv;
+  mpv::qt::Handle m_standby;
+  mpv_render_context* m_mpvSW;
+  mpv_render_context* m_standbySW;
+  RenderStats* m_stats;
+  RenderTiming* m_timing;
+
+  QMutex m_lock;
+  QWaitCondition m_wake;
+  bool m_quit;
+  bool m_updatePending;
+  mpv_handle* m_active;
+  QSize m_size;
+  // Only the render thread touches the slots, except for the ones at m_displayed and m_newest,
+  // which it leaves alone.
+  Slot m_slots[RingSize];
+  int m_displayed; // slot the scene graph shows, -1 if none
+  int m_newest;    // newest finished slot, -1 if none
+};
+
+#endif // PLAYERSOFTWARERENDERER_H
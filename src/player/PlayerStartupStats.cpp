@@ -0,0 +1,179 @@
+#include "PlayerStartupStats.h"
+
+#include <QTextStream>
+
+#include <algorithm>
+
+// Upper bounds (in ms) of the histogram buckets; the last bucket is open ended.
+static const qint64 BucketLimits[] = { 50, 100, 250, 500, 1000, 2000, 5000 };
+static const int BucketCount = sizeof(BucketLimits) / sizeof(BucketLimits[0]) + 1;
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+StartupStats::StartupStats()
+  : m_active(false), m_currentProbeHit(-1), m_lastProbeHit(-1), m_probeLookups(0), m_probeHits(0)
+{
+  for (int n = 0; n < StageCount; n++)
+  {
+    m_current[n] = -1;
+    m_last[n] = -1;
+    m_historyPos[n] = 0;
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+const char* StartupStats::stageName(Stage stage)
+{
+  switch (stage)
+  {
+    case Queued:        return "queued";
+    case StartFile:     return "start_file";
+    case OnLoad:        return "on_load";
+    case OnLoadResumed: return "on_load_resumed";
+    case CodecsStart:   return "codecs_start";
+    case CodecsDone:    return "codecs_done";
+    case OnPreloaded:   return "on_preloaded";
+    case VoConfigured:  return "vo_configured";
+    case Playing:       return "playing";
+    default:            return "unknown";
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void StartupStats::begin()
+{
+  for (int n = 0; n < StageCount; n++)
+    m_current[n] = -1;
+  m_currentProbeHit = -1;
+  m_timer.start();
+  m_active = true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void StartupStats::mark(Stage stage, bool update)
+{
+  if (!m_active)
+    return;
+  if (m_current[stage] < 0 || update)
+    m_current[stage] = m_timer.elapsed();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void StartupStats::setProbeCacheHit(bool hit)
+{
+  if (m_active)
+    m_currentProbeHit = hit ? 1 : 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void StartupStats::finish()
+{
+  if (!m_active)
+    return;
+  m_active = false;
+
+  m_lastProbeHit = m_currentProbeHit;
+  if (m_currentProbeHit >= 0)
+  {
+    m_probeLookups++;
+    m_probeHits += m_currentProbeHit;
+  }
+
+  for (int n = 0; n < StageCount; n++)
+  {
+    m_last[n] = m_current[n];
+    if (m_current[n] < 0)
+      continue;
+
+    QVector<qint64>& history = m_history[n];
+    if (history.size() < HistorySize)
+    {
+      history.append(m_current[n]);
+    }
+    else
+    {
+      history[m_historyPos[n]] = m_current[n];
+      m_historyPos[n] = (m_historyPos[n] + 1) % HistorySize;
+    }
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+QString StartupStats::lastLoadSummary() const
+{
+  QString str;
+  QTextStream info(&str);
+  bool first = true;
+  for (int n = 0; n < StageCount; n++)
+  {
+    if (m_last[n] < 0)
+      continue;
+    if (!first)
+      info << ", ";
+    first = false;
+    info << stageName((Stage)n) << "=" << m_last[n] << "ms";
+  }
+  if (m_lastProbeHit >= 0)
+    info << (first ? "" : ", ") << "probe_cache=" << (m_lastProbeHit ? "hit" : "miss");
+  info.flush();
+  return str;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+QVariantMap StartupStats::toVariant() const
+{
+  QVariantMap last;
+  QVariantMap stages;
+
+  for (int n = 0; n < StageCount; n++)
+  {
+    const char* name = stageName((Stage)n);
+    if (m_last[n] >= 0)
+      last.insert(name, m_last[n]);
+
+    QVector<qint64> sorted = m_history[n];
+    if (sorted.isEmpty())
+      continue;
+    std::sort(sorted.begin(), sorted.end());
+
+    QVector<int> counts(BucketCount, 0);
+    for (qint64 value : sorted)
+    {
+      int bucket = 0;
+      while (bucket < BucketCount - 1 && value > BucketLimits[bucket])
+        bucket++;
+      counts[bucket]++;
+    }
+
+    QVariantList histogram;
+    for (int b = 0; b < BucketCount; b++)
+    {
+      QVariantMap bucket;
+      bucket.insert("le", b < BucketCount - 1 ? QVariant(BucketLimits[b]) : QVariant());
+      bucket.insert("count", counts[b]);
+      histogram << bucket;
+    }
+
+    QVariantMap stage;
+    stage.insert("count", sorted.size());
+    stage.insert("min", sorted.first());
+    stage.insert("median", sorted[sorted.size() / 2]);
+    stage.insert("p90", sorted[(sorted.size() * 9) / 10]);
+    stage.insert("max", sorted.last());
+    stage.insert("histogram", histogram);
+    stages.insert(name, stage);
+  }
+
+  if (m_lastProbeHit >= 0)
+    last.insert("probe_cache_hit", m_lastProbeHit == 1);
+
+  QVariantMap probeCache;
+  probeCache.insert("lookups", m_probeLookups);
+  probeCache.insert("hits", m_probeHits);
+  probeCache.insert("hitRate", m_probeLookups ? (double)m_probeHits / m_probeLookups : 0.0);
+
+  QVariantMap res;
+  res.insert("last", last);
+  res.insert("stages", stages);
+  res.insert("probeCache", probeCache);
+  return res;
+}
@@ -0,0 +1,75 @@
+#ifndef PLAYERSTARTUPSTATS_H
+#define PLAYERSTARTUPSTATS_H
+
+#include <QElapsedTimer>
+#include <QString>
+#include <QVariant>
+#include <QVector>
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Breaks down the time from queueing a file to the first "playing" state into stages. Each load
+// records the time at which every stage was first reached, relative to the start of the load.
+// Completed loads are added to rolling per-stage histograms.
+class StartupStats
+{
+public:
+  enum Stage
+  {
+    Queued,          // queueMedia()
+    StartFile,       // MPV_EVENT_START_FILE
+    OnLoad,          // on_load hook started
+    OnLoadResumed,   // on_load done waiting for the refresh rate switch
+    CodecsStart,     // first startCodecsLoading()
+    CodecsDone,      // last codec loading completion before playback
+    OnPreloaded,     // on_preloaded hook started
+    VoConfigured,    // first vo-configured
+    Playing,         // first "playing" state
+    StageCount
+  };
+
+  // Number of completed loads kept per stage.
+  static const int HistorySize = 64;
+
+  StartupStats();
+
+  static const char* stageName(Stage stage);
+
+  // Start timing a new load. Anything recorded for a previous, incomplete load is dropped.
+  void begin();
+  bool isActive() const { return m_active; }
+  bool reached(Stage stage) const { return m_active && m_current[stage] >= 0; }
+
+  // Record that the current load reached the given stage. Only the first time is kept, unless
+  // update is set. Does nothing if no load is being timed.
+  void mark(Stage stage, bool update = false);
+
+  // Record whether the current load found its probe results in the cache. Loads of items that
+  // can't be cached don't count.
+  void setProbeCacheHit(bool hit);
+
+  // Finish the current load and add it to the histograms.
+  void finish();
+
+  // Human readable summary of the last load, for the log and the debug overlay.
+  QString lastLoadSummary() const;
+
+  // Last load and per-stage histograms, for the web client.
+  QVariantMap toVariant() const;
+
+private:
+  QElapsedTimer m_timer;
+  bool m_active;
+  // Milliseconds since begin() per stage, -1 if not reached.
+  qint64 m_current[StageCount];
+  qint64 m_last[StageCount];
+  // Ring buffers of the last HistorySize completed loads per stage.
+  QVector<qint64> m_history[StageCount];
+  int m_historyPos[StageCount];
+  // -1 if not looked up, 0 for a miss, 1 for a hit.
+  int m_currentProbeHit;
+  int m_lastProbeHit;
+  int m_probeLookups;
+  int m_probeHits;
+};
+
+#endif // PLAYERSTARTUPSTATS_H
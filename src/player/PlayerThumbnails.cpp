@@ -0,0 +1,464 @@
+#include "PlayerThumbnails.h"
+
+#include <QBuffer>
+#include <QCryptographicHash>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QImage>
+#include <QMutexLocker>
+
+#include "PlayerEventThread.h"
+#include "shared/Paths.h"
+#include "utils/Utils.h"
+#include "QsLog.h"
+
+// Number of items whose thumbnails are kept on disk.
+#define THUMBNAIL_DISK_ITEMS 20
+
+// mpv reply_userdata of the seek commands.
+#define THUMBNAIL_SEEK_ID 1
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+int ThumbnailCache::reset(int maxBytes)
+{
+  QMutexLocker lock(&m_lock);
+  m_cache.clear();
+  m_cache.setMaxCost(maxBytes);
+  return ++m_generation;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void ThumbnailCache::insert(int generation, qint64 ms, const QByteArray& jpeg)
+{
+  QMutexLocker lock(&m_lock);
+  if (generation == m_generation)
+    m_cache.insert(ms, new QByteArray(jpeg), jpeg.size());
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool ThumbnailCache::find(qint64 ms, QByteArray& jpeg)
+{
+  QMutexLocker lock(&m_lock);
+  // QCache::object() also marks the entry as most recently used.
+  QByteArray* data = m_cache.object(ms);
+  if (!data)
+    return false;
+  jpeg = *data;
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool ThumbnailCache::contains(qint64 ms)
+{
+  QMutexLocker lock(&m_lock);
+  return m_cache.contains(ms);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static void thumbnailWakeup(void* context)
+{
+  QMetaObject::invokeMethod((ThumbnailWorker*)context, "handleEvents", Qt::QueuedConnection);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+ThumbnailWorker::ThumbnailWorker(const QSharedPointer<ThumbnailCache>& cache)
+  : QObject(nullptr), m_cache(cache), m_generation(0), m_state(Idle), m_duration(0), m_nextSweep(0),
+  m_current(0), m_watchdog(this)
+{
+  // A seek that never finishes (e.g. broken file near the end) must not stall everything else.
+  m_watchdog.setSingleShot(true);
+  m_watchdog.setInterval(5000);
+  connect(&m_watchdog, &QTimer::timeout, this, [=]()
+  {
+    if (m_state == Seeking)
+    {
+      QLOG_WARN() << "Thumbnail seek to" << m_current << "ms timed out";
+      finishFrame(false);
+    }
+  });
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+ThumbnailWorker::~ThumbnailWorker()
+{
+  close();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void ThumbnailWorker::open(const ThumbnailSource& source, int generation)
+{
+  close();
+
+  m_source = source;
+  m_generation = generation;
+  m_duration = 0;
+  m_nextSweep = 0;
+  m_requests.clear();
+  m_failed.clear();
+
+  m_diskDir.clear();
+  if (!source.itemKey.isEmpty())
+  {
+    QByteArray hash = QCryptographicHash::hash(source.itemKey.toUtf8(), QCryptographicHash::Sha1).toHex();
+    QString dir = QString("thumbnails/%1/%2").arg(QString(hash)).arg(source.width);
+    m_diskDir = Paths::cacheDir(dir);
+    if (!QDir().mkpath(m_diskDir))
+      m_diskDir.clear();
+    else
+      pruneDiskCache(QString(hash));
+  }
+
+  m_mpv = mpv::qt::Handle::FromRawHandle(mpv_create());
+  if (!m_mpv)
+  {
+    QLOG_ERROR() << "Failed to create thumbnail player.";
+    return;
+  }
+
+  mpv_request_log_messages(m_mpv, "error");
+
+  mpv::qt::set_property(m_mpv, "config", "no");
+  mpv::qt::set_property(m_mpv, "load-scripts", "no");
+  mpv::qt::set_property(m_mpv, "ytdl", "no");
+  mpv::qt::set_property(m_mpv, "idle", "yes");
+  mpv::qt::set_property(m_mpv, "keep-open", "yes");
+  mpv::qt::set_property(m_mpv, "pause", "yes");
+  mpv::qt::set_property(m_mpv, "vo", "null");
+  mpv::qt::set_property(m_mpv, "ao", "null");
+  mpv::qt::set_property(m_mpv, "aid", "no");
+  mpv::qt::set_property(m_mpv, "sid", "no");
+
+  // Same timestamps as the main player (see PlayerComponent::componentInitialize()).
+  mpv::qt::set_property(m_mpv, "demuxer-mkv-probe-start-time", false);
+
+  // Keyframes only, in software, scaled down before they are converted for screenshot-raw.
+  // Keep the load low; this is competing with the main player for CPU and bandwidth.
+  mpv::qt::set_property(m_mpv, "hr-seek", "no");
+  mpv::qt::set_property(m_mpv, "hwdec", "no");
+  mpv::qt::set_property(m_mpv, "vd-lavc-skipframe", "nokey");
+  mpv::qt::set_property(m_mpv, "vd-lavc-skiploopfilter", "all");
+  mpv::qt::set_property(m_mpv, "vd-lavc-fast", true);
+  mpv::qt::set_property(m_mpv, "vd-lavc-threads", 1);
+  mpv::qt::set_property(m_mpv, "vf", QString("scale=%1:-2").arg(source.width));
+  mpv::qt::set_property(m_mpv, "cache", "no");
+  mpv::qt::set_property(m_mpv, "demuxer-readahead-secs", 0);
+
+  if (!source.userAgent.isEmpty())
+    mpv::qt::set_property(m_mpv, "user-agent", source.userAgent);
+  mpv::qt::set_property(m_mpv, "tls-ca-file", source.tlsCaFile);
+  mpv::qt::set_property(m_mpv, "tls-verify", source.tlsVerify);
+
+  if (mpv_initialize(m_mpv) < 0)
+  {
+    QLOG_ERROR() << "Failed to initialize thumbnail player.";
+    m_mpv = mpv::qt::Handle();
+    return;
+  }
+
+  mpv_set_wakeup_callback(m_mpv, thumbnailWakeup, this);
+
+  mpv::qt::command(m_mpv, QStringList() << "loadfile" << source.url);
+  m_state = Loading;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void ThumbnailWorker::close()
+{
+  m_watchdog.stop();
+  m_state = Idle;
+  if (m_mpv)
+  {
+    mpv_set_wakeup_callback(m_mpv, nullptr, nullptr);
+    m_mpv = mpv::qt::Handle();
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void ThumbnailWorker::request(qint64 ms)
+{
+  if ((m_state == Seeking && ms == m_current) || m_failed.contains(ms))
+    return;
+
+  // Newest first: when scrubbing, the position the user just moved to matters most. Only keep a
+  // few, since older positions are likely not on screen anymore.
+  m_requests.removeAll(ms);
+  m_requests.prepend(ms);
+  while (m_requests.size() > 8)
+    m_requests.removeLast();
+
+  startNext();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void ThumbnailWorker::handleEvents()
+{
+  while (m_mpv)
+  {
+    mpv_event* event = mpv_wait_event(m_mpv, 0);
+    if (event->event_id == MPV_EVENT_NONE)
+      break;
+
+    switch (event->event_id)
+    {
+      case MPV_EVENT_LOG_MESSAGE:
+      {
+        PlayerEventThread::logMessage((mpv_event_log_message *)event->data);
+        break;
+      }
+      case MPV_EVENT_PLAYBACK_RESTART:
+      {
+        if (m_state == Loading)
+        {
+          m_duration = (qint64)(mpv::qt::get_property(m_mpv, "duration").toDouble() * 1000);
+          m_state = Ready;
+          startNext();
+        }
+        else if (m_state == Seeking)
+        {
+          finishFrame(true);
+        }
+        break;
+      }
+      case MPV_EVENT_COMMAND_REPLY:
+      {
+        if (event->reply_userdata == THUMBNAIL_SEEK_ID && event->error < 0 && m_state == Seeking)
+          finishFrame(false);
+        break;
+      }
+      case MPV_EVENT_END_FILE:
+      {
+        mpv_event_end_file* endFile = (mpv_event_end_file *)event->data;
+        if (endFile->reason == MPV_END_FILE_REASON_ERROR)
+        {
+          QLOG_WARN() << "Thumbnail player failed to open the item:" << mpv_error_string(endFile->error);
+          m_watchdog.stop();
+          m_state = Idle;
+        }
+        break;
+      }
+      default:; /* ignore */
+    }
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void ThumbnailWorker::startNext()
+{
+  while (m_state == Ready)
+  {
+    qint64 ms;
+    if (!m_requests.isEmpty())
+    {
+      ms = m_requests.takeFirst();
+    }
+    else if (m_nextSweep <= m_duration)
+    {
+      ms = m_nextSweep;
+      m_nextSweep += m_source.interval;
+    }
+    else
+    {
+      return;
+    }
+
+    if ((m_duration > 0 && ms > m_duration) || m_failed.contains(ms) || m_cache->contains(ms))
+      continue;
+    if (loadFromDisk(ms))
+      continue;
+
+    QByteArray target = QByteArray::number(ms / 1000.0, 'f', 3);
+    const char* args[] = {"seek", target.constData(), "absolute+keyframes", nullptr};
+    if (mpv_command_async(m_mpv, THUMBNAIL_SEEK_ID, args) < 0)
+    {
+      m_failed.insert(ms);
+      continue;
+    }
+
+    m_current = ms;
+    m_state = Seeking;
+    m_watchdog.start();
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void ThumbnailWorker::finishFrame(bool success)
+{
+  m_watchdog.stop();
+  m_state = Ready;
+
+  QByteArray jpeg;
+  if (success)
+    jpeg = grabFrame();
+
+  if (jpeg.isEmpty())
+  {
+    m_failed.insert(m_current);
+  }
+  else
+  {
+    m_cache->insert(m_generation, m_current, jpeg);
+    if (!m_diskDir.isEmpty())
+      Utils::safelyWriteFile(diskPath(m_current), jpeg);
+    emit thumbnailReady(m_current);
+  }
+
+  startNext();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+QByteArray ThumbnailWorker::grabFrame()
+{
+  mpv::qt::node_builder args(QVariantList() << "screenshot-raw" << "video");
+  mpv_node result;
+  if (mpv_command_node(m_mpv, args.node(), &result) < 0)
+    return QByteArray();
+
+  QByteArray jpeg;
+  mpv::qt::node_view frame(&result);
+  int width = frame["w"].to_int();
+  int height = frame["h"].to_int();
+  qint64 stride = frame["stride"].to_int64();
+  const mpv_byte_array* data = frame["data"].to_byte_array();
+
+  if (frame["format"].equals("bgr0") && data && width > 0 && height > 0 &&
+      stride >= width * 4 && (qint64)data->size >= stride * height)
+  {
+    QImage image((const uchar *)data->data, width, height, (int)stride, QImage::Format_RGB32);
+    // In case the scale filter is not available.
+    if (image.width() > m_source.width)
+      image = image.scaledToWidth(m_source.width, Qt::SmoothTransformation);
+
+    QBuffer buffer(&jpeg);
+    buffer.open(QIODevice::WriteOnly);
+    if (!image.save(&buffer, "JPG", 75))
+      jpeg.clear();
+  }
+
+  mpv_free_node_contents(&result);
+  return jpeg;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool ThumbnailWorker::loadFromDisk(qint64 ms)
+{
+  if (m_diskDir.isEmpty())
+    return false;
+
+  QFile file(diskPath(ms));
+  if (!file.open(QIODevice::ReadOnly))
+    return false;
+
+  QByteArray jpeg = file.readAll();
+  if (jpeg.isEmpty())
+    return false;
+
+  m_cache->insert(m_generation, ms, jpeg);
+  emit thumbnailReady(ms);
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+QString ThumbnailWorker::diskPath(qint64 ms) const
+{
+  return QDir(m_diskDir).filePath(QString::number(ms) + ".jpg");
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void ThumbnailWorker::pruneDiskCache(const QString& keep)
+{
+  QDir root(Paths::cacheDir("thumbnails"));
+  QFileInfoList items = root.entryInfoList(QDir::Dirs | QDir::NoDotAndDotDot, QDir::Time);
+  for (int i = THUMBNAIL_DISK_ITEMS; i < items.size(); i++)
+  {
+    if (items[i].fileName() != keep)
+      QDir(items[i].absoluteFilePath()).removeRecursively();
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+PlayerThumbnails::PlayerThumbnails(QObject* parent)
+  : QObject(parent), m_cache(new ThumbnailCache), m_generation(0), m_opened(false)
+{
+  qRegisterMetaType<ThumbnailSource>();
+
+  m_thread = new QThread(this);
+  m_thread->setObjectName("Thumbnails");
+
+  m_worker = new ThumbnailWorker(m_cache);
+  m_worker->moveToThread(m_thread);
+  connect(m_worker, &ThumbnailWorker::thumbnailReady, this, &PlayerThumbnails::thumbnailReady);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+PlayerThumbnails::~PlayerThumbnails()
+{
+  if (m_thread->isRunning())
+  {
+    QMetaObject::invokeMethod(m_worker, "close", Qt::BlockingQueuedConnection);
+    m_thread->exit(0);
+    m_thread->wait();
+  }
+
+  delete m_worker;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlayerThumbnails::setSource(const ThumbnailSource& source)
+{
+  bool sameItem = m_source.isValid() && source.isValid() && source.width == m_source.width &&
+                  source.interval == m_source.interval &&
+                  (source.itemKey.isEmpty() ? source.url == m_source.url : source.itemKey == m_source.itemKey);
+  if (!sameItem)
+  {
+    clear();
+    m_source = source;
+    return;
+  }
+
+  // Keep the thumbnails, but reopen with the new URL in case the old one goes away (e.g. the
+  // previous transcode session after a stream switch).
+  bool reopen = m_opened && source.url != m_source.url;
+  m_source = source;
+  if (reopen)
+    QMetaObject::invokeMethod(m_worker, "open", Qt::QueuedConnection,
+                              Q_ARG(ThumbnailSource, m_source), Q_ARG(int, m_generation));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlayerThumbnails::clear()
+{
+  m_generation = m_cache->reset(m_source.cacheSize);
+  m_source = ThumbnailSource();
+
+  if (m_opened)
+    QMetaObject::invokeMethod(m_worker, "close", Qt::QueuedConnection);
+  m_opened = false;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+QByteArray PlayerThumbnails::thumbnail(qint64 ms)
+{
+  if (!m_source.isValid() || ms < 0)
+    return QByteArray();
+
+  ms -= ms % m_source.interval;
+
+  QByteArray jpeg;
+  if (m_cache->find(ms, jpeg))
+    return jpeg;
+
+  if (!m_opened)
+  {
+    if (!m_thread->isRunning())
+      m_thread->start(QThread::LowPriority);
+
+    m_generation = m_cache->reset(m_source.cacheSize);
+    QMetaObject::invokeMethod(m_worker, "open", Qt::QueuedConnection,
+                              Q_ARG(ThumbnailSource, m_source), Q_ARG(int, m_generation));
+    m_opened = true;
+  }
+
+  QMetaObject::invokeMethod(m_worker, "request", Qt::QueuedConnection, Q_ARG(qint64, ms));
+  return QByteArray();
+}
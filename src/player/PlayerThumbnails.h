@@ -0,0 +1,137 @@
+#ifndef PLAYERTHUMBNAILS_H
+#define PLAYERTHUMBNAILS_H
+
+#include <QObject>
+#include <QThread>
+#include <QTimer>
+#include <QCache>
+#include <QMutex>
+#include <QSet>
+#include <QList>
+#include <QByteArray>
+#include <QSharedPointer>
+
+#include <mpv/client.h>
+
+#include "QtHelper.h"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// The item to generate thumbnails for, and how to do it.
+struct ThumbnailSource
+{
+  ThumbnailSource() : tlsVerify(false), interval(10000), width(320), cacheSize(32 * 1024 * 1024) {}
+
+  bool isValid() const { return !url.isEmpty(); }
+
+  QString url;
+  // Identifies the item across sessions. Thumbnails are only persisted to disk if it's set.
+  QString itemKey;
+  QString userAgent;
+  QString tlsCaFile;
+  bool tlsVerify;
+  int interval;  // ms between thumbnails
+  int width;     // pixels
+  int cacheSize; // bytes of JPEG data kept in memory
+};
+Q_DECLARE_METATYPE(ThumbnailSource)
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// JPEG thumbnails of the current item by timestamp, as a memory-bounded LRU cache. Shared between
+// the GUI thread and the worker thread. The generation number is bumped on every item change, so
+// that a late insert from the worker can't put thumbnails of the previous item into the cache.
+class ThumbnailCache
+{
+public:
+  ThumbnailCache() : m_generation(0) {}
+
+  int reset(int maxBytes);
+  void insert(int generation, qint64 ms, const QByteArray& jpeg);
+  bool find(qint64 ms, QByteArray& jpeg);
+  bool contains(qint64 ms);
+
+private:
+  QMutex m_lock;
+  QCache<qint64, QByteArray> m_cache;
+  int m_generation;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Lives on the thumbnail thread. Owns a headless mpv instance that decodes keyframes only, and
+// works through explicit requests first, then sweeps the whole item at the configured interval.
+class ThumbnailWorker : public QObject
+{
+  Q_OBJECT
+public:
+  explicit ThumbnailWorker(const QSharedPointer<ThumbnailCache>& cache);
+  ~ThumbnailWorker() override;
+
+  Q_SLOT void open(const ThumbnailSource& source, int generation);
+  Q_SLOT void close();
+  Q_SLOT void request(qint64 ms);
+  Q_SLOT void handleEvents();
+
+  Q_SIGNAL void thumbnailReady(qint64 ms);
+
+private:
+  enum State
+  {
+    Idle,    // nothing loaded, or loading failed
+    Loading, // waiting for the first frame
+    Ready,
+    Seeking,
+  };
+
+  void startNext();
+  void finishFrame(bool success);
+  QByteArray grabFrame();
+  bool loadFromDisk(qint64 ms);
+  QString diskPath(qint64 ms) const;
+  static void pruneDiskCache(const QString& keep);
+
+  QSharedPointer<ThumbnailCache> m_cache;
+  mpv::qt::Handle m_mpv;
+  ThumbnailSource m_source;
+  int m_generation;
+  State m_state;
+  QString m_diskDir;
+  qint64 m_duration;
+  qint64 m_nextSweep;
+  qint64 m_current;
+  QList<qint64> m_requests;
+  QSet<qint64> m_failed;
+  QTimer m_watchdog;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// GUI thread side of the thumbnail generator. Nothing is decoded until the first thumbnail of an
+// item is asked for, so items nobody scrubs through cost nothing.
+class PlayerThumbnails : public QObject
+{
+  Q_OBJECT
+public:
+  explicit PlayerThumbnails(QObject* parent = nullptr);
+  ~PlayerThumbnails() override;
+
+  // Switch to a new item. Passing the current item again keeps its thumbnails.
+  void setSource(const ThumbnailSource& source);
+  void clear();
+
+  int interval() const { return m_source.interval; }
+
+  // Return the JPEG thumbnail for the interval containing ms. If it's not available yet, it's
+  // generated in the background, and thumbnailReady() is emitted once it is.
+  QByteArray thumbnail(qint64 ms);
+
+Q_SIGNALS:
+  void thumbnailReady(qint64 ms);
+
+private:
+  QThread* m_thread;
+  ThumbnailWorker* m_worker;
+  QSharedPointer<ThumbnailCache> m_cache;
+  ThumbnailSource m_source;
+  int m_generation;
+  bool m_opened;
+};
+
+#endif // PLAYERTHUMBNAILS_H
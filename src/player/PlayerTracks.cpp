@@ -0,0 +1,122 @@
+#include "PlayerTracks.h"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void TrackList::invalidate()
+{
+  m_valid = false;
+  m_tracks.clear();
+  m_byFFIndex.clear();
+  m_byType.clear();
+  m_byFile.clear();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void TrackList::update(const mpv::qt::node_view& trackList)
+{
+  invalidate();
+
+  m_tracks.reserve(trackList.size());
+  for (auto node : trackList)
+  {
+    TrackInfo track;
+    track.id = node["id"].to_int64();
+    track.type = node["type"].to_string();
+    track.ffIndex = node["ff-index"].to_int(-1);
+    track.external = node["external"].to_bool();
+    track.externalFilename = track.external ? node["external-filename"].to_string() : QString();
+    track.selected = node["selected"].to_bool();
+    track.codec = node["codec"].to_string();
+    track.demuxChannelCount = node["demux-channel-count"].to_int();
+    track.demuxSampleRate = node["demux-samplerate"].to_int();
+    track.demuxWidth = node["demux-w"].to_int();
+    track.demuxHeight = node["demux-h"].to_int();
+
+    int pos = m_tracks.size();
+    m_tracks.append(track);
+    if (track.ffIndex >= 0)
+      m_byFFIndex.insert(track.ffIndex, pos);
+    m_byType[track.type].append(pos);
+    m_byFile[track.externalFilename].append(pos);
+  }
+
+  m_valid = true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+QVector<const TrackInfo*> TrackList::lookup(const QHash<QString, QVector<int>>& index,
+                                            const QString& key) const
+{
+  QVector<const TrackInfo*> res;
+  for (int pos : index.value(key))
+    res.append(&m_tracks[pos]);
+  return res;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+QVector<const TrackInfo*> TrackList::forFile(const QString& externalFilename) const
+{
+  return lookup(m_byFile, externalFilename);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+QVector<const TrackInfo*> TrackList::forType(const QString& type) const
+{
+  return lookup(m_byType, type);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+const TrackInfo* TrackList::find(const QString& type, int ffIndex,
+                                 const QString& externalFilename) const
+{
+  for (auto it = m_byFFIndex.constFind(ffIndex); it != m_byFFIndex.constEnd() && it.key() == ffIndex; ++it)
+  {
+    const TrackInfo& track = m_tracks[it.value()];
+    if (track.type == type && track.externalFilename == externalFilename)
+      return &track;
+  }
+  return nullptr;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void ServerMediaInfo::clear()
+{
+  m_streams.clear();
+  m_byIndex.clear();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void ServerMediaInfo::parse(const QVariantMap& media)
+{
+  clear();
+
+  for (auto partInfo : media["Part"].toList())
+  {
+    for (auto streamInfo : partInfo.toMap()["Stream"].toList())
+    {
+      auto streamInfoMap = streamInfo.toMap();
+
+      StreamInfo stream = {};
+      stream.isVideo = streamInfoMap["width"].isValid();
+      stream.isAudio = streamInfoMap["channels"].isValid();
+      stream.codec = Codecs::plexNameToFF(streamInfoMap["codec"].toString());
+      stream.audioChannels = streamInfoMap["channels"].toInt();
+      stream.videoResolution = QSize(streamInfoMap["width"].toInt(), streamInfoMap["height"].toInt());
+      stream.profile = streamInfoMap["profile"].toString();
+
+      // If the index is duplicated, the last stream wins.
+      bool ok = false;
+      int index = streamInfoMap["index"].toInt(&ok);
+      if (ok)
+        m_byIndex.insert(index, m_streams.size());
+
+      m_streams.append(stream);
+    }
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+const StreamInfo* ServerMediaInfo::findByIndex(int index) const
+{
+  auto it = m_byIndex.constFind(index);
+  return it != m_byIndex.constEnd() ? &m_streams[it.value()] : nullptr;
+}
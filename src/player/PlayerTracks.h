@@ -0,0 +1,80 @@
+#ifndef PLAYERTRACKS_H
+#define PLAYERTRACKS_H
+
+#include <QString>
+#include <QVector>
+#include <QHash>
+#include <QMultiHash>
+
+#include "QtHelper.h"
+#include "CodecsComponent.h"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// The parts of a mpv track-list entry we care about.
+struct TrackInfo {
+  qint64 id;                // mpv track ID, as used by the aid/sid/vid properties
+  QString type;             // "video", "audio" or "sub"
+  int ffIndex;              // stream index within its file, -1 if unknown
+  bool external;            // added with sub-add/audio-add
+  QString externalFilename; // only set for external tracks
+  bool selected;
+  QString codec;
+  int demuxChannelCount;
+  int demuxSampleRate;
+  int demuxWidth, demuxHeight;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Parsed copy of the mpv track-list property, with indexes for the lookups stream selection and
+// codec determination need. PlayerComponent keeps it up to date by observing track-list, so that
+// these don't have to fetch the property from the player core every time.
+class TrackList
+{
+public:
+  TrackList() : m_valid(false) {}
+
+  bool isValid() const { return m_valid; }
+  void invalidate();
+  void update(const mpv::qt::node_view& trackList);
+
+  const QVector<TrackInfo>& tracks() const { return m_tracks; }
+
+  // Tracks of the external file with the given name, or of the main file if the name is empty.
+  QVector<const TrackInfo*> forFile(const QString& externalFilename) const;
+  // Tracks of the given type ("video", "audio", "sub").
+  QVector<const TrackInfo*> forType(const QString& type) const;
+  // The track with the given type and ff-index in the given file (main file if empty).
+  const TrackInfo* find(const QString& type, int ffIndex, const QString& externalFilename) const;
+
+private:
+  QVector<const TrackInfo*> lookup(const QHash<QString, QVector<int>>& index, const QString& key) const;
+
+  bool m_valid;
+  QVector<TrackInfo> m_tracks;
+  // All indexes store positions in m_tracks.
+  QMultiHash<int, int> m_byFFIndex;
+  QHash<QString, QVector<int>> m_byType;
+  QHash<QString, QVector<int>> m_byFile;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// The streams described by the server's media metadata, as passed to queueMedia(). This is parsed
+// once per item, because it's consulted from the load hooks, which block the start of playback.
+class ServerMediaInfo
+{
+public:
+  void parse(const QVariantMap& media);
+  void clear();
+
+  // All streams of all parts, in the form needed for codec determination.
+  const QList<StreamInfo>& streams() const { return m_streams; }
+  // The stream with the given stream index (same as mpv's ff-index), or null.
+  const StreamInfo* findByIndex(int index) const;
+
+private:
+  QList<StreamInfo> m_streams;
+  // Position in m_streams by stream index.
+  QHash<int, int> m_byIndex;
+};
+
+#endif // PLAYERTRACKS_H
@@ -98,6 +98,121 @@ static inline QVariant node_to_variant(const mpv_node *node)
     }
 }
 
+/**
+ * Read-only view of a mpv_node tree. Nothing is copied or converted up front;
+ * the typed accessors only look at the node they're called on. This is much
+ * cheaper than node_to_variant() for large values like track-list, of which
+ * usually only a few fields are needed.
+ *
+ * A view does not own the node, so it must not outlive it (see
+ * property_node). Accessing a missing map key or array index, or converting
+ * to a mismatching type, yields an invalid view or the default value.
+ */
+class node_view
+{
+public:
+    node_view() : node_(NULL) {}
+    explicit node_view(const mpv_node *node) : node_(node) {}
+
+    mpv_format format() const { return node_ ? node_->format : MPV_FORMAT_NONE; }
+    bool is_valid() const { return format() != MPV_FORMAT_NONE; }
+    bool is_map() const { return format() == MPV_FORMAT_NODE_MAP; }
+    bool is_array() const { return format() == MPV_FORMAT_NODE_ARRAY; }
+
+    // Number of entries of an array or map, 0 for anything else.
+    int size() const {
+        return (is_map() || is_array()) && node_->u.list ? node_->u.list->num : 0;
+    }
+    node_view at(int n) const {
+        if (n < 0 || n >= size())
+            return node_view();
+        return node_view(&node_->u.list->values[n]);
+    }
+    // Key of the n-th map entry, or NULL.
+    const char *key_at(int n) const {
+        if (!is_map() || n < 0 || n >= size())
+            return NULL;
+        return node_->u.list->keys[n];
+    }
+    // Map lookup. This is a linear search, which is fast for the small maps
+    // mpv returns (a track-list entry has about 30 keys).
+    node_view operator[](const char *key) const {
+        for (int n = 0; n < size() && is_map(); n++) {
+            if (strcmp(node_->u.list->keys[n], key) == 0)
+                return node_view(&node_->u.list->values[n]);
+        }
+        return node_view();
+    }
+
+    bool to_bool(bool def = false) const {
+        switch (format()) {
+        case MPV_FORMAT_FLAG: return node_->u.flag;
+        case MPV_FORMAT_INT64: return node_->u.int64 != 0;
+        default: return def;
+        }
+    }
+    int64_t to_int64(int64_t def = 0) const {
+        switch (format()) {
+        case MPV_FORMAT_FLAG: return node_->u.flag;
+        case MPV_FORMAT_INT64: return node_->u.int64;
+        case MPV_FORMAT_DOUBLE: return static_cast<int64_t>(node_->u.double_);
+        default: return def;
+        }
+    }
+    int to_int(int def = 0) const { return static_cast<int>(to_int64(def)); }
+    double to_double(double def = 0) const {
+        switch (format()) {
+        case MPV_FORMAT_INT64: return static_cast<double>(node_->u.int64);
+        case MPV_FORMAT_DOUBLE: return node_->u.double_;
+        default: return def;
+        }
+    }
+    // The raw UTF-8 string, or NULL if this is not a string node.
+    const char *to_cstring() const {
+        return format() == MPV_FORMAT_STRING ? node_->u.string : NULL;
+    }
+    // The raw data of a byte array node (e.g. from screenshot-raw), or NULL.
+    const mpv_byte_array *to_byte_array() const {
+        return format() == MPV_FORMAT_BYTE_ARRAY ? node_->u.ba : NULL;
+    }
+    // Compare a string node without allocating.
+    bool equals(const char *str) const {
+        const char *s = to_cstring();
+        return s && strcmp(s, str) == 0;
+    }
+    // Converts scalars the same way QVariant::toString() would.
+    QString to_string() const {
+        switch (format()) {
+        case MPV_FORMAT_STRING: return QString::fromUtf8(node_->u.string);
+        case MPV_FORMAT_FLAG: return node_->u.flag ? "true" : "false";
+        case MPV_FORMAT_INT64: return QString::number(node_->u.int64);
+        case MPV_FORMAT_DOUBLE: return QString::number(node_->u.double_);
+        default: return QString();
+        }
+    }
+    // Full conversion, for when a QVariant is really needed.
+    QVariant to_variant() const {
+        return node_ ? node_to_variant(node_) : QVariant();
+    }
+
+    // Iteration over array or map values.
+    class iterator
+    {
+    public:
+        explicit iterator(const mpv_node *p) : p_(p) {}
+        node_view operator*() const { return node_view(p_); }
+        iterator &operator++() { p_++; return *this; }
+        bool operator!=(const iterator &o) const { return p_ != o.p_; }
+    private:
+        const mpv_node *p_;
+    };
+    iterator begin() const { return iterator(size() ? node_->u.list->values : NULL); }
+    iterator end() const { return iterator(size() ? node_->u.list->values + size() : NULL); }
+
+private:
+    const mpv_node *node_;
+};
+
 struct node_builder {
     node_builder(const QVariant& v) {
         set(&node_, v);
@@ -343,6 +458,32 @@ static inline QVariant get_property(mpv_handle *ctx, const QString &name)
     return node_to_variant(&node);
 }
 
+/**
+ * Fetches a property as mpv_node and keeps it alive for reading it through
+ * node_view, without converting it to QVariant.
+ */
+class property_node
+{
+public:
+    property_node(mpv_handle *ctx, const char *name) {
+        error_ = mpv_get_property(ctx, name, MPV_FORMAT_NODE, &node_);
+        if (error_ < 0)
+            node_.format = MPV_FORMAT_NONE;
+    }
+    ~property_node() {
+        if (error_ >= 0)
+            mpv_free_node_contents(&node_);
+    }
+    // mpv error code (<0 on error, >= 0 on success)
+    int error() const { return error_; }
+    node_view view() const { return node_view(&node_); }
+
+private:
+    Q_DISABLE_COPY(property_node)
+    mpv_node node_;
+    int error_;
+};
+
 /**
  * Set the given property as mpv_node converted from the QVariant argument.
  *
@@ -355,6 +496,152 @@ static inline int set_property(mpv_handle *ctx, const QString &name,
     return mpv_set_property(ctx, name.toUtf8().data(), MPV_FORMAT_NODE, node.node());
 }
 
+/**
+ * Maps C++ types to the native mpv_format used to pass them to libmpv without
+ * going through mpv_node. Only defined for the types listed here, so other
+ * types fall back to the QVariant-based set_property().
+ */
+template <typename T> struct native_format {};
+template <> struct native_format<bool> {
+    typedef int type;
+    static const mpv_format format = MPV_FORMAT_FLAG;
+};
+#define MPV_QT_NATIVE_FORMAT(T, N, F) \
+    template <> struct native_format<T> { \
+        typedef N type; \
+        static const mpv_format format = F; \
+    };
+MPV_QT_NATIVE_FORMAT(int, int64_t, MPV_FORMAT_INT64)
+MPV_QT_NATIVE_FORMAT(unsigned int, int64_t, MPV_FORMAT_INT64)
+MPV_QT_NATIVE_FORMAT(long, int64_t, MPV_FORMAT_INT64)
+MPV_QT_NATIVE_FORMAT(unsigned long, int64_t, MPV_FORMAT_INT64)
+MPV_QT_NATIVE_FORMAT(long long, int64_t, MPV_FORMAT_INT64)
+MPV_QT_NATIVE_FORMAT(unsigned long long, int64_t, MPV_FORMAT_INT64)
+MPV_QT_NATIVE_FORMAT(float, double, MPV_FORMAT_DOUBLE)
+MPV_QT_NATIVE_FORMAT(double, double, MPV_FORMAT_DOUBLE)
+#undef MPV_QT_NATIVE_FORMAT
+
+/**
+ * Set a flag, integer or floating point property using its native format.
+ * Unlike the QVariant variant, this does not allocate.
+ *
+ * @return mpv error code (<0 on error, >= 0 on success)
+ */
+template <typename T>
+static inline int set_property(mpv_handle *ctx, const char *name, T v,
+                               typename native_format<T>::type * = nullptr)
+{
+    typename native_format<T>::type native = static_cast<typename native_format<T>::type>(v);
+    return mpv_set_property(ctx, name, native_format<T>::format, &native);
+}
+
+/**
+ * Set a string property using MPV_FORMAT_STRING.
+ *
+ * @return mpv error code (<0 on error, >= 0 on success)
+ */
+static inline int set_property(mpv_handle *ctx, const char *name, const char *v)
+{
+    return mpv_set_property_string(ctx, name, v);
+}
+
+static inline int set_property(mpv_handle *ctx, const char *name, const QString &v)
+{
+    return mpv_set_property_string(ctx, name, v.toUtf8().constData());
+}
+
+/**
+ * Collects property changes and sends them with mpv_set_property_async(), so
+ * applying a group of properties does not wait for the player core once per
+ * property. Values use the same native formats as set_property(). Anything not
+ * applied explicitly is applied when the batch is destroyed.
+ *
+ * Errors are reported asynchronously as MPV_EVENT_SET_PROPERTY_REPLY, with the
+ * reply_userdata passed to the constructor.
+ */
+class property_batch
+{
+public:
+    explicit property_batch(mpv_handle *ctx, uint64_t reply_userdata = 0)
+        : ctx_(ctx), reply_userdata_(reply_userdata) {}
+    ~property_batch() { apply(); }
+
+    template <typename T>
+    property_batch &set(const char *name, T v, typename native_format<T>::type * = nullptr) {
+        entry e(name, native_format<T>::format);
+        if (e.format == MPV_FORMAT_FLAG)
+            e.u.flag = v ? 1 : 0;
+        else if (e.format == MPV_FORMAT_INT64)
+            e.u.int64 = static_cast<int64_t>(v);
+        else
+            e.u.double_ = static_cast<double>(v);
+        entries_.append(e);
+        return *this;
+    }
+    property_batch &set(const char *name, const char *v) {
+        entry e(name, MPV_FORMAT_STRING);
+        e.string = QByteArray(v);
+        entries_.append(e);
+        return *this;
+    }
+    property_batch &set(const char *name, const QString &v) {
+        entry e(name, MPV_FORMAT_STRING);
+        e.string = v.toUtf8();
+        entries_.append(e);
+        return *this;
+    }
+    property_batch &set(const char *name, const QVariant &v) {
+        entry e(name, MPV_FORMAT_NODE);
+        e.variant = v;
+        entries_.append(e);
+        return *this;
+    }
+
+    /**
+     * Send all collected properties. Returns the first error that could be
+     * detected immediately (<0), or >= 0 if all requests were queued.
+     */
+    int apply() {
+        int res = 0;
+        for (int n = 0; n < entries_.size(); n++) {
+            entry &e = entries_[n];
+            int err;
+            if (e.format == MPV_FORMAT_STRING) {
+                char *str = e.string.data();
+                err = mpv_set_property_async(ctx_, reply_userdata_, e.name, e.format, &str);
+            } else if (e.format == MPV_FORMAT_NODE) {
+                node_builder node(e.variant);
+                err = mpv_set_property_async(ctx_, reply_userdata_, e.name, e.format, node.node());
+            } else {
+                err = mpv_set_property_async(ctx_, reply_userdata_, e.name, e.format, &e.u);
+            }
+            if (err < 0 && res >= 0)
+                res = err;
+        }
+        entries_.clear();
+        return res;
+    }
+
+private:
+    Q_DISABLE_COPY(property_batch)
+    struct entry {
+        entry() : name(nullptr), format(MPV_FORMAT_NONE) { u.int64 = 0; }
+        entry(const char *n, mpv_format f) : name(n), format(f) { u.int64 = 0; }
+        const char *name; // expected to be a string literal
+        mpv_format format;
+        union {
+            int flag;
+            int64_t int64;
+            double double_;
+        } u;
+        QByteArray string;
+        QVariant variant;
+    };
+    mpv_handle *ctx_;
+    uint64_t reply_userdata_;
+    QList<entry> entries_;
+};
+
 /**
  * mpv_command_node() equivalent.
  *
@@ -372,6 +659,18 @@ static inline QVariant command(mpv_handle *ctx, const QVariant &args)
     return node_to_variant(&res);
 }
 
+/**
+ * mpv_command_node_async() equivalent. The result is returned as
+ * MPV_EVENT_COMMAND_REPLY with the given reply_userdata.
+ *
+ * @return mpv error code (<0 on error, >= 0 if the command was queued)
+ */
+static inline int command_async(mpv_handle *ctx, uint64_t reply_userdata, const QVariant &args)
+{
+    node_builder node(args);
+    return mpv_command_node_async(ctx, reply_userdata, node.node());
+}
+
 }
 }
 
@@ -0,0 +1,68 @@
+#ifndef SPSCQUEUE_H
+#define SPSCQUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Bounded lock-free FIFO for exactly one producer thread and one consumer thread.
+// Neither side ever blocks: push() fails if the queue is full, pop() fails if it's empty.
+// N must be a power of two.
+template <typename T, size_t N>
+class SpscQueue
+{
+  static_assert(N > 0 && (N & (N - 1)) == 0, "SpscQueue size must be a power of two");
+
+public:
+  SpscQueue() : m_head(0), m_tail(0) {}
+
+  // Producer side. The item is only moved from if there was room for it.
+  bool push(T&& item)
+  {
+    size_t tail = m_tail.load(std::memory_order_relaxed);
+    if (tail - m_head.load(std::memory_order_acquire) == N)
+      return false;
+    m_items[tail & (N - 1)] = std::move(item);
+    m_tail.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  bool push(const T& item)
+  {
+    T copy(item);
+    return push(std::move(copy));
+  }
+
+  // Consumer side.
+  bool pop(T& item)
+  {
+    size_t head = m_head.load(std::memory_order_relaxed);
+    if (head == m_tail.load(std::memory_order_acquire))
+      return false;
+    item = std::move(m_items[head & (N - 1)]);
+    m_head.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Only a snapshot; may be outdated by the time the caller looks at it.
+  size_t size() const
+  {
+    return m_tail.load(std::memory_order_acquire) - m_head.load(std::memory_order_acquire);
+  }
+
+  bool isEmpty() const { return size() == 0; }
+
+  static constexpr size_t capacity() { return N; }
+
+private:
+  SpscQueue(const SpscQueue&) = delete;
+  SpscQueue& operator=(const SpscQueue&) = delete;
+
+  T m_items[N];
+  // Keep the indexes on separate cache lines, so producer and consumer don't fight over them.
+  alignas(64) std::atomic<size_t> m_head;
+  alignas(64) std::atomic<size_t> m_tail;
+};
+
+#endif // SPSCQUEUE_H